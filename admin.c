@@ -0,0 +1,298 @@
+/* admin.c - the admin socket, where the stats can be read */
+/* Created: Mon Oct 19 13:41:09 PM EDT 2026 malakai */
+/* $Id: admin.c,v 1.1 2026/10/19 17:41:09 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The main process answers HTTP on a localhost port and/or a unix socket,
+ * with the stats in the Prometheus text format.  It's a tiny request
+ * answered right there in the accept loop, so the timeouts keep a stuck
+ * scraper from holding up new players for long. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "debug.h"
+#include "muditm.h"
+#include "stats.h"
+#include "admin.h"
+
+/* ---- local #defines ---- */
+#define ADMIN_TIMEOUT_MS 1000
+#define ADMIN_REQUEST_MAX 2048
+
+/* ---- structs and typedefs ---- */
+
+/* ---- local variable declarations ---- */
+int admin_sock[ADMIN_MAX_LISTEN];
+int admin_sock_count = 0;
+
+/* ---- local function declarations ---- */
+int admin_listen_tcp(char *address, int port);
+int admin_listen_unix(char *path);
+int admin_wait(int s, short events, struct timespec *deadline);
+int admin_write(int s, char *buf, size_t len, struct timespec *deadline);
+void admin_reply(int s, char *status, char *body, size_t len, struct timespec *deadline);
+
+/* ---- code starts here ---- */
+
+/* open whichever admin sockets the config asks for.  Returns how many. */
+int admin_listen(GKeyFile *gkf) {
+
+	char *address, *path;
+	int port, s;
+
+	port = get_conf_int(gkf,"muditm","admin-port",0);
+	address = get_conf_string(gkf,"muditm","admin-address","127.0.0.1");
+	path = get_conf_string(gkf,"muditm","admin-socket","");
+
+	if(port > 0) {
+		if( (s = admin_listen_tcp(address,port)) != -1) {
+			admin_sock[admin_sock_count++] = s;
+			muditm_log("Admin stats on http://%s:%d/metrics",address,port);
+		}
+	}
+	if(*path) {
+		if( (s = admin_listen_unix(path)) != -1) {
+			admin_sock[admin_sock_count++] = s;
+			muditm_log("Admin stats on unix socket %s",path);
+		}
+	}
+
+	free(address);
+	free(path);
+	return(admin_sock_count);
+}
+
+int admin_listen_tcp(char *address, int port) {
+
+	struct sockaddr_in6 addr6;
+	struct sockaddr_in addr4;
+	struct sockaddr *addr;
+	socklen_t addrlen;
+	int s, on = 1;
+
+	memset(&addr6,0,sizeof(addr6));
+	memset(&addr4,0,sizeof(addr4));
+	if(inet_pton(AF_INET,address,&(addr4.sin_addr)) == 1) {
+		addr4.sin_family = AF_INET;
+		addr4.sin_port = htons(port);
+		addr = (struct sockaddr *)&addr4;
+		addrlen = sizeof(addr4);
+	} else if(inet_pton(AF_INET6,address,&(addr6.sin6_addr)) == 1) {
+		addr6.sin6_family = AF_INET6;
+		addr6.sin6_port = htons(port);
+		addr = (struct sockaddr *)&addr6;
+		addrlen = sizeof(addr6);
+	} else {
+		muditm_log("admin-address %s isn't an IP address.",address);
+		return(-1);
+	}
+
+	if( (s = socket(addr->sa_family,SOCK_STREAM,0)) == -1) {
+		muditm_log("Admin socket error: %s",strerror(errno));
+		return(-1);
+	}
+	setsockopt(s,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(on));
+	if( (bind(s,addr,addrlen) == -1) || (listen(s,8) == -1) ) {
+		muditm_log("Couldn't listen for admin on %s port %d: %s",address,port,strerror(errno));
+		close(s);
+		return(-1);
+	}
+	fcntl(s,F_SETFL,O_NONBLOCK);
+	return(s);
+}
+
+int admin_listen_unix(char *path) {
+
+	struct sockaddr_un addr;
+	int s;
+
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		muditm_log("admin-socket %s is too long.",path);
+		return(-1);
+	}
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path,path);
+
+	if( (s = socket(AF_UNIX,SOCK_STREAM,0)) == -1) {
+		muditm_log("Admin socket error: %s",strerror(errno));
+		return(-1);
+	}
+	/* a leftover from the last run would be in the way. */
+	unlink(path);
+	if( (bind(s,(struct sockaddr *)&addr,sizeof(addr)) == -1) || (listen(s,8) == -1) ) {
+		muditm_log("Couldn't listen for admin on %s: %s",path,strerror(errno));
+		close(s);
+		return(-1);
+	}
+	fcntl(s,F_SETFL,O_NONBLOCK);
+	return(s);
+}
+
+/* sessions have no use for these. */
+void admin_close(void) {
+	int i;
+	for(i=0; i<admin_sock_count; i++) {
+		close(admin_sock[i]);
+	}
+	admin_sock_count = 0;
+}
+
+/* This all happens in the parent, which isn't accepting players meanwhile,
+ * so the whole request gets ADMIN_TIMEOUT_MS, however slowly it trickles
+ * in or out.  >0 if s is ready before then. */
+int admin_wait(int s, short events, struct timespec *deadline) {
+
+	struct pollfd pfd;
+	struct timespec now;
+	long int left;
+	int ret;
+
+	pfd.fd = s;
+	pfd.events = events;
+	do {
+		clock_gettime(CLOCK_MONOTONIC,&now);
+		left = (deadline->tv_sec - now.tv_sec) * 1000L +
+			(deadline->tv_nsec - now.tv_nsec) / 1000000L;
+		if(left <= 0) {
+			return(0);
+		}
+	} while( ((ret = poll(&pfd,1,left)) == -1) && (errno == EINTR) );
+	return(ret);
+}
+
+/* 1 if it all got written in time. */
+int admin_write(int s, char *buf, size_t len, struct timespec *deadline) {
+
+	ssize_t w;
+
+	while(len > 0) {
+		if( (w = write(s,buf,len)) > 0) {
+			buf += w;
+			len -= w;
+			continue;
+		}
+		if( (w == -1) && ((errno == EAGAIN) || (errno == EINTR)) &&
+			(admin_wait(s,POLLOUT,deadline) > 0)
+		) {
+			continue;
+		}
+		return(0);
+	}
+	return(1);
+}
+
+void admin_reply(int s, char *status, char *body, size_t len, struct timespec *deadline) {
+
+	char head[256];
+	int n;
+
+	n = snprintf(head,sizeof(head),
+		"HTTP/1.0 %s\r\n"
+		"Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+		"Content-Length: %zu\r\n"
+		"Connection: close\r\n\r\n",
+		status,len
+	);
+	if(admin_write(s,head,n,deadline)) {
+		admin_write(s,body,len,deadline);
+	}
+}
+
+/* answer one request on a listener that poll() said was ready. */
+void admin_serve(int listener) {
+
+	char req[ADMIN_REQUEST_MAX];
+	struct timespec deadline;
+	char *body = NULL, *path, *end;
+	size_t len = 0, got = 0;
+	ssize_t r;
+	FILE *f;
+	int s, ok;
+
+	if( (s = accept(listener,NULL,NULL)) == -1) {
+		return;
+	}
+	fcntl(s,F_SETFL,O_NONBLOCK);
+	clock_gettime(CLOCK_MONOTONIC,&deadline);
+	deadline.tv_sec += ADMIN_TIMEOUT_MS / 1000;
+	deadline.tv_nsec += (ADMIN_TIMEOUT_MS % 1000) * 1000000L;
+	if(deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	/* just the request line matters, but read the headers too. */
+	while(got < sizeof(req)-1) {
+		if( (r = read(s,req+got,sizeof(req)-1-got)) == -1) {
+			if( ((errno == EAGAIN) || (errno == EINTR)) &&
+				(admin_wait(s,POLLIN,&deadline) > 0)
+			) {
+				continue;
+			}
+			break;
+		}
+		if(r == 0) break;
+		got += r;
+		req[got] = '\0';
+		if(strstr(req,"\r\n\r\n") || strstr(req,"\n\n")) break;
+	}
+	req[got] = '\0';
+
+	if(strncmp(req,"GET ",4)) {
+		admin_reply(s,"405 Method Not Allowed","",0,&deadline);
+		close(s);
+		return;
+	}
+	path = req+4;
+	if( (end = strpbrk(path," ?\r\n")) ) *end = '\0';
+
+	if(strcmp(path,"/metrics") && strcmp(path,"/")) {
+		admin_reply(s,"404 Not Found","",0,&deadline);
+		close(s);
+		return;
+	}
+
+	if( (f = open_memstream(&body,&len)) ) {
+		ok = stats_prometheus(f);
+		fclose(f);
+		if(ok) {
+			admin_reply(s,"200 OK",body,len,&deadline);
+		} else {
+			admin_reply(s,"500 Internal Server Error","",0,&deadline);
+		}
+		free(body);
+	} else {
+		admin_reply(s,"500 Internal Server Error","",0,&deadline);
+	}
+	close(s);
+}
@@ -0,0 +1,42 @@
+/* admin.h - the admin socket, where the stats can be read */
+/* Created: Mon Oct 19 13:41:09 PM EDT 2026 malakai */
+/* $Id: admin.h,v 1.1 2026/10/19 17:41:09 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUDITM_ADMIN_H
+#define MUDITM_ADMIN_H
+
+#include <glib.h>
+
+/* global #defines */
+#define ADMIN_MAX_LISTEN 2
+
+/* structs and typedefs */
+
+/* exported global variable declarations */
+extern int admin_sock[ADMIN_MAX_LISTEN];
+extern int admin_sock_count;
+
+/* exported function declarations */
+int admin_listen(GKeyFile *gkf);
+void admin_serve(int listener);
+void admin_close(void);
+
+#endif /* MUDITM_ADMIN_H */
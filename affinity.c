@@ -0,0 +1,170 @@
+/* affinity.c - which CPUs the sessions run on, and busy polling */
+/* Created: Mon Oct 19 22:51:06 PM EDT 2026 malakai */
+/* $Id: affinity.c,v 1.1 2026/10/20 02:51:06 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Left alone, the scheduler moves sessions from CPU to CPU as it pleases,
+ * and their caches go cold each time.  Where every bit of latency counts,
+ * they can be pinned instead.
+ *
+ * With cpus set, each new session gets one CPU out of that list, taking
+ * turns.  With cpu-steering too, a session goes to the CPU that its
+ * connection's packets came in on, as the kernel tells it with
+ * SO_INCOMING_CPU, so that the interrupt, the TCP stack and the session
+ * all share one CPU's cache.  That works best with the NIC's receive
+ * queues spread over the same CPUs with RSS or RPS.
+ *
+ * busy-poll sets SO_BUSY_POLL, so that a read with nothing there yet spins
+ * on the device queue for that many microseconds before going to sleep. */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "debug.h"
+#include "muditm.h"
+#include "config.h"
+#include "affinity.h"
+
+/* ---- local #defines ---- */
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49
+#endif
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+/* ---- structs and typedefs ---- */
+
+/* ---- local variable declarations ---- */
+static cpu_set_t affinity_set;
+static int affinity_count = 0;
+static int affinity_generation = -1;	/* of the config affinity_set came from */
+static unsigned long int affinity_turn = 0;
+
+/* ---- local function declarations ---- */
+int affinity_parse(char *list, cpu_set_t *set);
+
+/* ---- code starts here ---- */
+
+/* "0-3,6,8-9" into a cpu_set_t.  Returns how many, or -1 if it's no good. */
+int affinity_parse(char *list, cpu_set_t *set) {
+
+	gchar **part;
+	char *end;
+	long int lo, hi, n;
+	int i, ok = 1;
+
+	CPU_ZERO(set);
+	part = g_strsplit(list,",",-1);
+	for(i=0; ok && part[i]; i++) {
+		g_strstrip(part[i]);
+		if(!*part[i]) {
+			continue;
+		}
+		lo = hi = strtol(part[i],&end,10);
+		if(*end == '-') {
+			hi = strtol(end+1,&end,10);
+		}
+		if(*end || lo < 0 || hi < lo || hi >= CPU_SETSIZE) {
+			ok = 0;
+			break;
+		}
+		for(n=lo; n<=hi; n++) {
+			CPU_SET(n,set);
+		}
+	}
+	g_strfreev(part);
+	return(ok?CPU_COUNT(set):-1);
+}
+
+/* In the parent, for a connection just accepted.  The CPU its session
+ * should run on, or -1 to leave it be. */
+int affinity_pick(Config *c, int sock) {
+
+	socklen_t len;
+	int cpu, n;
+
+	/* once per config, not per connection. */
+	if(c->generation != affinity_generation) {
+		affinity_generation = c->generation;
+		if( (affinity_count = affinity_parse(c->cpus,&affinity_set)) == -1) {
+			muditm_log("Can't make sense of cpus = %s, not pinning sessions.",c->cpus);
+			affinity_count = 0;
+		}
+	}
+	if(!affinity_count) {
+		return(-1);
+	}
+
+	if(c->cpu_steering) {
+		len = sizeof(cpu);
+		if( (getsockopt(sock,SOL_SOCKET,SO_INCOMING_CPU,&cpu,&len) == 0) &&
+			(cpu >= 0) && (cpu < CPU_SETSIZE) && CPU_ISSET(cpu,&affinity_set)
+		) {
+			return(cpu);
+		}
+	}
+
+	/* take turns. */
+	n = affinity_turn++ % affinity_count;
+	for(cpu=0; cpu<CPU_SETSIZE; cpu++) {
+		if(CPU_ISSET(cpu,&affinity_set) && (n-- == 0)) {
+			return(cpu);
+		}
+	}
+	return(-1);
+}
+
+/* In the session, first thing. */
+void affinity_pin(int cpu) {
+
+	cpu_set_t one;
+
+	if(cpu < 0) {
+		return;
+	}
+	CPU_ZERO(&one);
+	CPU_SET(cpu,&one);
+	if(sched_setaffinity(0,sizeof(one),&one) == -1) {
+		muditm_log("Couldn't pin to CPU %d: %s",cpu,strerror(errno));
+		return;
+	}
+	muditm_debug("Pinned to CPU %d.",cpu);
+}
+
+/* Sockets accepted from the listener get the listener's setting. */
+void affinity_busy_poll(Config *c, int sock, char *what) {
+
+	int usec = c->busy_poll;
+
+	if(usec <= 0) {
+		return;
+	}
+	if(setsockopt(sock,SOL_SOCKET,SO_BUSY_POLL,&usec,sizeof(usec)) == -1) {
+		muditm_log("Couldn't set busy-poll on the %s: %s",what,strerror(errno));
+	}
+}
@@ -0,0 +1,39 @@
+/* affinity.h - which CPUs the sessions run on, and busy polling */
+/* Created: Mon Oct 19 22:51:06 PM EDT 2026 malakai */
+/* $Id: affinity.h,v 1.1 2026/10/20 02:51:06 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUDITM_AFFINITY_H
+#define MUDITM_AFFINITY_H
+
+#include "config.h"
+
+/* global #defines */
+
+/* structs and typedefs */
+
+/* exported global variable declarations */
+
+/* exported function declarations */
+int affinity_pick(Config *c, int sock);
+void affinity_pin(int cpu);
+void affinity_busy_poll(Config *c, int sock, char *what);
+
+#endif /* MUDITM_AFFINITY_H */
@@ -0,0 +1,501 @@
+/* backend.c - choosing among several game servers, and checking on them */
+/* Created: Mon Oct 19 21:40:17 PM EDT 2026 malakai */
+/* $Id: backend.c,v 1.1 2026/10/20 01:40:17 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* A game can be split over several servers, with a standby or two for
+ * when they're down.  Each session picks one when it connects, either the
+ * one with the fewest sessions for its weight, or the one its client's
+ * address hashes to, so a player who reconnects lands where they were.  If
+ * that one won't connect, the next best one gets a try, and so on down
+ * the list.
+ *
+ * Whether a server is up is decided by one health checker process that the
+ * parent forks, which connects to each of them every so often.  The
+ * sessions don't each find out the hard way. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "debug.h"
+#include "muditm.h"
+#include "config.h"
+#include "backend.h"
+#include "sockopt.h"
+
+/* ---- local #defines ---- */
+#define BACKEND_PASS_UP 0	/* weighted servers that are up */
+#define BACKEND_PASS_STANDBY 1	/* standbys that are up */
+#define BACKEND_PASS_ANY 2	/* whatever is left, in case the checker is wrong */
+#define BACKEND_PASSES 3
+
+/* ---- structs and typedefs ---- */
+
+/* ---- local variable declarations ---- */
+struct backend_data *backends = NULL;
+struct backend *backend_mine = NULL;	/* the one this session is connected to */
+static int backend_slot = -1;		/* this session's entry in backends->session */
+static char *backend_balance_name[] = { "least-connections", "hash" };
+
+/* ---- local function declarations ---- */
+int backend_parse(char *entry, char *service, struct backend *b);
+int backend_dial(struct backend *b, int timeout, struct sockopt_data *so, const char **why);
+void backend_mark(struct backend *b, int up, const char *why);
+unsigned long int backend_score(char *addr, struct backend *b, int weight);
+int backend_pick(char *addr, int pass, char *tried);
+void backend_take(int i);
+void backend_checker(pid_t parent);
+
+/* ---- code starts here ---- */
+
+/* host:service:weight, with the host in [brackets] if it's an IPv6
+ * address.  service and weight can be left off. */
+int backend_parse(char *entry, char *service, struct backend *b) {
+
+	char *host, *rest, *end;
+	gchar **f;
+	int ok = 1;
+
+	host = entry;
+	if(*host == '[') {
+		if(!(end = strchr(++host,']'))) {
+			return(0);
+		}
+		*end++ = '\0';
+		if(*end && *end != ':') {
+			return(0);
+		}
+		rest = (*end)?end+1:end;
+	} else if( (rest = strchr(host,':')) ) {
+		*rest++ = '\0';
+	} else {
+		rest = "";
+	}
+	if(!*host) {
+		return(0);
+	}
+
+	f = g_strsplit(rest,":",2);
+	snprintf(b->host,sizeof(b->host),"%s",host);
+	snprintf(b->service,sizeof(b->service),"%s",(f[0] && *f[0])?f[0]:service);
+	snprintf(b->name,sizeof(b->name),(strchr(b->host,':'))?"[%s]:%s":"%s:%s",
+		b->host,b->service
+	);
+	b->weight = 1;
+	if(f[0] && f[1]) {
+		b->weight = strtol(f[1],&end,10);
+		if(*end || end == f[1] || b->weight < 0 || b->weight > BACKEND_WEIGHT_MAX) {
+			ok = 0;
+		}
+	}
+	g_strfreev(f);
+	return(ok);
+}
+
+/* Called once in the parent, before any forking.  Forks the health
+ * checker if there's more than one server to choose from.  0 if the
+ * server list is no good. */
+int backend_init(Config *c) {
+
+	gchar **list;
+	char *entry;
+	struct backend *b;
+	pid_t pid, parent;
+	int i;
+
+	backends = (struct backend_data *)mmap(NULL,sizeof(struct backend_data),
+		PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0
+	);
+	if(backends == MAP_FAILED) {
+		muditm_log("Couldn't map the game server list: %s",strerror(errno));
+		backends = NULL;
+		return(0);
+	}
+	memset(backends,0,sizeof(struct backend_data));
+
+	/* without a list, host and service are the only one. */
+	if(*(c->game_backends)) {
+		list = g_strsplit(c->game_backends,";",-1);
+	} else {
+		list = g_new0(gchar *,2);
+		list[0] = g_strdup_printf(strchr(c->game_host,':')?"[%s]":"%s",c->game_host);
+	}
+	for(i=0; list[i]; i++) {
+		entry = g_strstrip(list[i]);
+		if(!*entry) {
+			continue;
+		}
+		if(backends->count == BACKEND_MAX) {
+			muditm_log("Only %d game servers, ignoring %s and the rest.",BACKEND_MAX,entry);
+			break;
+		}
+		b = &(backends->backend[backends->count]);
+		if(!backend_parse(entry,c->game_service,b)) {
+			muditm_log("Can't make sense of game server '%s'.",list[i]);
+			g_strfreev(list);
+			return(0);
+		}
+		b->up = 1;
+		backends->count++;
+	}
+	g_strfreev(list);
+	if(!backends->count) {
+		muditm_log("There aren't any game servers in the backends list.");
+		return(0);
+	}
+
+	if(!strcasecmp(c->game_balance,"hash")) {
+		backends->balance = BACKEND_HASH;
+	} else {
+		if(strcasecmp(c->game_balance,"least-connections")) {
+			muditm_log("Unknown balance '%s', using least-connections.",c->game_balance);
+		}
+		backends->balance = BACKEND_LEAST;
+	}
+	backends->interval = c->game_health_interval;
+	backends->timeout = (c->game_connect_timeout > 0)?c->game_connect_timeout:0;
+
+	for(i=0; i<backends->count; i++) {
+		b = &(backends->backend[i]);
+		if(b->weight) {
+			muditm_log("Game server %s, weight %d.",b->name,b->weight);
+		} else {
+			muditm_log("Game server %s, standby.",b->name);
+		}
+	}
+	if(backends->count == 1 || backends->interval <= 0) {
+		return(1);
+	}
+
+	parent = getpid();
+	if((pid = fork()) < 0) {
+		muditm_log("Can't fork the health checker: %s",strerror(errno));
+		return(1);
+	}
+	if(pid == 0) {
+		backend_checker(parent);
+	}
+	__atomic_store_n(&(backends->checker),pid,__ATOMIC_RELEASE);
+	muditm_log("Balancing %d game servers by %s, health checker is pid %d, every %ds.",
+		backends->count,backend_balance_name[backends->balance],pid,backends->interval
+	);
+	return(1);
+}
+
+/* connect, but give up after timeout seconds, 0 for however long the
+ * kernel takes.  *why says what went wrong if it returns -1. */
+int backend_dial(struct backend *b, int timeout, struct sockopt_data *so, const char **why) {
+
+	struct addrinfo hints;
+	struct addrinfo *result, *rp;
+	struct pollfd pfd;
+	socklen_t len;
+	int s = -1, flags, ret, err;
+
+	/* get the possible addresses from the host and service port */
+	memset(&hints,0,sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;		/* doesn't matter, I can take IPv4 or IPv6 */
+	hints.ai_socktype = SOCK_STREAM;	/* tcp please */
+
+	ret = getaddrinfo(b->host,b->service,&hints,&result);
+	if(ret != 0) {
+		*why = gai_strerror(ret);
+		return(-1);
+	}
+
+	/* loop through the list until one of them works. */
+	err = 0;
+	for(rp = result; rp != NULL; rp=rp->ai_next) {
+		if( (s = socket(rp->ai_family,rp->ai_socktype,rp->ai_protocol)) == -1) {
+			err = errno;
+			continue;
+		}
+		/* before connect(), so the buffer sizes count for the window. */
+		sockopt_apply(s,so,"game side");
+		flags = fcntl(s,F_GETFL);
+		if(timeout) {
+			fcntl(s,F_SETFL,flags|O_NONBLOCK);
+		}
+		if(connect(s,rp->ai_addr,rp->ai_addrlen) == 0) {
+			/* connected! */
+			fcntl(s,F_SETFL,flags);
+			break;
+		}
+		err = errno;
+		if(err == EINPROGRESS) {
+			pfd.fd = s;
+			pfd.events = POLLOUT;
+			while( ((ret = poll(&pfd,1,timeout*1000)) == -1) && (errno == EINTR) );
+			len = sizeof(err);
+			if(ret == 0) {
+				err = ETIMEDOUT;
+			} else if(ret < 0) {
+				err = errno;
+			} else if(getsockopt(s,SOL_SOCKET,SO_ERROR,&err,&len) == -1) {
+				err = errno;
+			}
+			if(!err) {
+				fcntl(s,F_SETFL,flags);
+				break;
+			}
+		}
+		close(s);
+		s = -1;
+	}
+	freeaddrinfo(result);
+
+	if(s == -1) {
+		*why = strerror(err);
+	}
+	return(s);
+}
+
+/* up or down, and say so if that's news. */
+void backend_mark(struct backend *b, int up, const char *why) {
+
+	int was = !up;
+
+	if(!__atomic_compare_exchange_n(&(b->up),&was,up,0,__ATOMIC_RELAXED,__ATOMIC_RELAXED)) {
+		return;
+	}
+	if(up) {
+		muditm_log("Game server %s is up.",b->name);
+	} else {
+		muditm_log("Game server %s is down, %s",b->name,why);
+	}
+}
+
+/* Rendezvous hashing.  Every server gets a score for the address, and the
+ * best score wins, so adding or losing a server only moves the players
+ * that were on it.  A server gets one try per weight, keeping the best,
+ * which makes its chance of winning go with its weight. */
+unsigned long int backend_score(char *addr, struct backend *b, int weight) {
+
+	unsigned long int h, best = 0;
+	char *s;
+	int r;
+
+	for(r=0; r<weight; r++) {
+		/* FNV-1a over the address, the server and the try. */
+		h = 14695981039346656037UL;
+		for(s=addr; *s; s++) {
+			h = (h ^ (unsigned char)*s) * 1099511628211UL;
+		}
+		for(s=b->name; *s; s++) {
+			h = (h ^ (unsigned char)*s) * 1099511628211UL;
+		}
+		h = (h ^ r) * 1099511628211UL;
+		/* and mix it, so servers with similar names don't score alike. */
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdUL;
+		h ^= h >> 33;
+		if(h > best) {
+			best = h;
+		}
+	}
+	return(best);
+}
+
+/* The best server for this pass that hasn't been tried.  -1 if there
+ * aren't any more. */
+int backend_pick(char *addr, int pass, char *tried) {
+
+	struct backend *b;
+	unsigned long int score, best_score = 0;
+	long int active, best_active = 0;
+	int i, best = -1, weight, best_weight = 0, up;
+
+	for(i=0; i<backends->count; i++) {
+		b = &(backends->backend[i]);
+		up = __atomic_load_n(&(b->up),__ATOMIC_RELAXED);
+		if(tried[i]) continue;
+		if(pass == BACKEND_PASS_UP && !(up && b->weight)) continue;
+		if(pass == BACKEND_PASS_STANDBY && !(up && !b->weight)) continue;
+
+		weight = (b->weight)?b->weight:1;
+		if(backends->balance == BACKEND_HASH) {
+			score = backend_score(addr,b,weight);
+			if(best == -1 || score > best_score) {
+				best = i;
+				best_score = score;
+			}
+		} else {
+			/* fewest sessions per weight, counting the one about to
+			 * land, so that a heavier server wins when they're even. */
+			active = __atomic_load_n(&(b->active),__ATOMIC_RELAXED) + 1;
+			if(best == -1 || active * best_weight < best_active * weight) {
+				best = i;
+				best_active = active;
+				best_weight = weight;
+			}
+		}
+	}
+	return(best);
+}
+
+/* put our name on the server we got, so it's given back if we die. */
+void backend_take(int i) {
+
+	pid_t none, me = getpid();
+	int slot;
+
+	for(slot=0; slot<BACKEND_SESSIONS; slot++) {
+		none = 0;
+		if(__atomic_compare_exchange_n(&(backends->session[slot].pid),&none,me,
+			0,__ATOMIC_ACQUIRE,__ATOMIC_RELAXED)) {
+			backends->session[slot].backend = i;
+			backend_slot = slot;
+			return;
+		}
+	}
+}
+
+/* Connect this session to a game server.  Returns the socket, or -1 if
+ * none of them would have it.  addr is the client's address, for
+ * hashing.  so is the socket settings for the game side. */
+int backend_connect(char *addr, struct sockopt_data *so, struct backend **chosen) {
+
+	char tried[BACKEND_MAX];
+	struct backend *b;
+	const char *why;
+	int pass, i, s;
+
+	memset(tried,0,sizeof(tried));
+	for(pass=0; pass<BACKEND_PASSES; pass++) {
+		while( (i = backend_pick(addr,pass,tried)) != -1) {
+			tried[i] = 1;
+			b = &(backends->backend[i]);
+
+			/* counted before connecting, so the sessions forked right
+			 * after this one see it. */
+			__atomic_add_fetch(&(b->active),1,__ATOMIC_RELAXED);
+			__atomic_add_fetch(&(b->connects),1,__ATOMIC_RELAXED);
+			if( (s = backend_dial(b,backends->timeout,so,&why)) != -1) {
+				backend_take(i);
+				backend_mine = b;
+				*chosen = b;
+				if(pass != BACKEND_PASS_UP) {
+					muditm_log("Failing over to game server %s",b->name);
+				}
+				return(s);
+			}
+			__atomic_sub_fetch(&(b->active),1,__ATOMIC_RELAXED);
+			__atomic_add_fetch(&(b->failures),1,__ATOMIC_RELAXED);
+			muditm_log("Couldn't connect to game server %s, %s",b->name,why);
+
+			/* only with a checker around to notice it coming back. */
+			if(__atomic_load_n(&(backends->checker),__ATOMIC_RELAXED)) {
+				backend_mark(b,0,why);
+			}
+		}
+	}
+	return(-1);
+}
+
+/* this session is done with its game server. */
+void backend_release(void) {
+
+	if(!backend_mine) {
+		return;
+	}
+	__atomic_sub_fetch(&(backend_mine->active),1,__ATOMIC_RELAXED);
+	if(backend_slot != -1) {
+		__atomic_store_n(&(backends->session[backend_slot].pid),0,__ATOMIC_RELEASE);
+		backend_slot = -1;
+	}
+	backend_mine = NULL;
+}
+
+/* From the SIGCHLD handler, so only atomics.  Gives back the server of a
+ * session that died without saying so.  Returns 1 if it was the health
+ * checker. */
+int backend_reap(pid_t pid) {
+
+	pid_t held;
+	int slot, i;
+
+	if(!backends) {
+		return(0);
+	}
+	if(pid == __atomic_load_n(&(backends->checker),__ATOMIC_RELAXED)) {
+		/* nobody is checking any more, so don't rule any of them out. */
+		__atomic_store_n(&(backends->checker),0,__ATOMIC_RELAXED);
+		for(i=0; i<backends->count; i++) {
+			__atomic_store_n(&(backends->backend[i].up),1,__ATOMIC_RELAXED);
+		}
+		return(1);
+	}
+	for(slot=0; slot<BACKEND_SESSIONS; slot++) {
+		held = pid;
+		if(__atomic_compare_exchange_n(&(backends->session[slot].pid),&held,0,
+			0,__ATOMIC_RELEASE,__ATOMIC_RELAXED)) {
+			i = backends->session[slot].backend;
+			__atomic_sub_fetch(&(backends->backend[i].active),1,__ATOMIC_RELAXED);
+			break;
+		}
+	}
+	return(0);
+}
+
+/* The health checker process.  Connects to each server in turn and hangs
+ * right up, every interval seconds, until the main process goes away. */
+void backend_checker(pid_t parent) {
+
+	struct sigaction sa;
+	const char *why;
+	int i, s, n;
+
+	/* like the log writer, it goes when the main process does. */
+	sa.sa_handler = SIG_IGN;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sigaction(SIGHUP,&sa,NULL);
+	sigaction(SIGINT,&sa,NULL);
+	sigaction(SIGTERM,&sa,NULL);
+	sigaction(SIGPIPE,&sa,NULL);
+	sigaction(SIGUSR2,&sa,NULL);
+
+	for(;;) {
+		for(i=0; i<backends->count; i++) {
+			s = backend_dial(&(backends->backend[i]),backends->timeout,NULL,&why);
+			if(s != -1) {
+				close(s);
+			}
+			backend_mark(&(backends->backend[i]),(s != -1),why);
+		}
+		for(n=0; n<backends->interval; n++) {
+			if(getppid() != parent) {
+				_exit(EXIT_SUCCESS);
+			}
+			sleep(1);
+		}
+	}
+}
@@ -0,0 +1,81 @@
+/* backend.h - choosing among several game servers, and checking on them */
+/* Created: Mon Oct 19 21:40:17 PM EDT 2026 malakai */
+/* $Id: backend.h,v 1.1 2026/10/20 01:40:17 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUDITM_BACKEND_H
+#define MUDITM_BACKEND_H
+
+#include <sys/types.h>
+#include "config.h"
+#include "sockopt.h"
+
+/* global #defines */
+#define BACKEND_MAX 16
+#define BACKEND_HOST_MAX 96
+#define BACKEND_SERVICE_MAX 28
+#define BACKEND_NAME_MAX 128		/* [host]:service */
+#define BACKEND_WEIGHT_MAX 100
+#define BACKEND_SESSIONS 1024	/* sessions whose backend gets given back if they die */
+
+#define BACKEND_LEAST 0		/* fewest sessions per weight */
+#define BACKEND_HASH 1		/* same client address, same backend */
+
+/* structs and typedefs */
+
+struct backend {
+	char host[BACKEND_HOST_MAX];
+	char service[BACKEND_SERVICE_MAX];
+	char name[BACKEND_NAME_MAX];
+	int weight;		/* 0 for a standby, only used when the rest are down */
+	int up;			/* as of the last health check */
+	long int active;	/* sessions connected to it right now */
+	long int connects;
+	long int failures;	/* connects that didn't work */
+};
+
+struct backend_session {
+	pid_t pid;
+	int backend;
+};
+
+/* In a shared mapping made by the parent, so the health checker's results
+ * and every session's connections are seen by all. */
+struct backend_data {
+	int count;
+	int balance;		/* BACKEND_LEAST or BACKEND_HASH */
+	int interval;		/* seconds between health checks, 0 for none */
+	int timeout;		/* seconds to wait on a connect */
+	pid_t checker;
+	struct backend backend[BACKEND_MAX];
+	struct backend_session session[BACKEND_SESSIONS];
+};
+
+/* exported global variable declarations */
+extern struct backend_data *backends;
+extern struct backend *backend_mine;
+
+/* exported function declarations */
+int backend_init(Config *c);
+int backend_connect(char *addr, struct sockopt_data *so, struct backend **chosen);
+void backend_release(void);
+int backend_reap(pid_t pid);
+
+#endif /* MUDITM_BACKEND_H */
@@ -0,0 +1,263 @@
+/* capture.c - record a session's traffic to a file, to be played back later */
+/* Created: Mon Oct 19 17:20:36 PM EDT 2026 malakai */
+/* $Id: capture.c,v 1.1 2026/10/19 21:20:36 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "debug.h"
+#include "muditm.h"
+#include "config.h"
+#include "proxy.h"
+#include "backend.h"
+#include "capture.h"
+
+/* ---- local #defines ---- */
+#define CAPTURE_BUF (256*1024)	/* stdio buffering for the capture file */
+
+/* ---- structs and typedefs ---- */
+
+/* ---- local variable declarations ---- */
+static FILE *capture_file = NULL;
+static char *capture_name = NULL;
+static Endpoint *capture_ep[2] = { NULL, NULL };
+static struct timespec capture_t0;
+static long int capture_left;		/* bytes to go until capture-max */
+static long int capture_frames;
+static long int capture_bytes;
+
+/* The newest frame isn't written until the next one comes along, in case
+ * the end of it turns out to be compressed.  See capture_retract(). */
+static struct capture_frame capture_held;
+static char *capture_held_buf = NULL;
+static int capture_holding = 0;
+
+/* ---- local function declarations ---- */
+void capture_write_held(void);
+
+/* ---- code starts here ---- */
+
+/* Called by the session before it starts proxying.  Whether this session
+ * gets captured is up to capture-dir and capture-every.  1 if it does. */
+int capture_start(Config *conf, Endpoint *client, Endpoint *game) {
+
+	struct capture_header h;
+	struct tm tm;
+	time_t now;
+	char *dir, stamp[32];
+	int every, max, fd = -1;
+	unsigned int seed;
+
+	if(capture_file) return(1);
+
+	dir = get_conf_string(conf->gkf,"muditm","capture-dir","");
+	every = get_conf_int(conf->gkf,"muditm","capture-every",100);
+	max = get_conf_int(conf->gkf,"muditm","capture-max",10240);
+
+	if(!*dir) {
+		free(dir);
+		return(0);
+	}
+
+	/* one in every so many sessions, picked at random. */
+	now = time(NULL);
+	seed = (unsigned int)(getpid() ^ now);
+	if( (every > 1) && (rand_r(&seed) % every) ) {
+		free(dir);
+		return(0);
+	}
+
+	localtime_r(&now,&tm);
+	strftime(stamp,sizeof(stamp),"%Y%m%d-%H%M%S",&tm);
+	capture_name = g_strdup_printf("%s/muditm-%s-%d.cap",dir,stamp,getpid());
+	free(dir);
+
+	/* passwords and all, so only the owner gets to read it, whatever the
+	 * umask says. */
+	if( ((fd = open(capture_name,O_WRONLY|O_CREAT|O_EXCL,0600)) == -1) ||
+		!(capture_file = fdopen(fd,"w"))
+	) {
+		muditm_log("Can't capture to %s: %s",capture_name,strerror(errno));
+		if(fd != -1) close(fd);
+		g_free(capture_name);
+		capture_name = NULL;
+		return(0);
+	}
+	setvbuf(capture_file,NULL,_IOFBF,CAPTURE_BUF);
+
+	memset(&h,0,sizeof(h));
+	memcpy(h.magic,CAPTURE_MAGIC,sizeof(h.magic));
+	h.version = CAPTURE_VERSION;
+	h.frame_max = EP_BUFSIZE;
+	h.started = now;
+	addr_endpoint(client,h.addr,sizeof(h.addr));
+	snprintf(h.game,sizeof(h.game),"%s",backend_mine?backend_mine->name:"");
+	fwrite(&h,sizeof(h),1,capture_file);
+
+	capture_held_buf = (char *)malloc(EP_BUFSIZE);
+	capture_holding = 0;
+	capture_ep[CAPTURE_CLIENT] = client;
+	capture_ep[CAPTURE_GAME] = game;
+	capture_left = (max > 0)?((long int)max * 1024):LONG_MAX;
+	capture_frames = 0;
+	capture_bytes = 0;
+	clock_gettime(CLOCK_MONOTONIC,&capture_t0);
+
+	muditm_log("Capturing this session to %s",capture_name);
+	return(1);
+}
+
+void capture_write_held(void) {
+
+	if(!capture_holding) return;
+	capture_holding = 0;
+
+	/* all of it might have been taken back. */
+	if(capture_held.len == 0) return;
+
+	if( (fwrite(&capture_held,sizeof(capture_held),1,capture_file) != 1) ||
+		(fwrite(capture_held_buf,capture_held.len,1,capture_file) != 1)
+	) {
+		muditm_log("Capture to %s failed: %s",capture_name,strerror(errno));
+		capture_end();
+		return;
+	}
+	capture_frames++;
+	capture_bytes += capture_held.len;
+}
+
+/* What one read from ep handed the proxy.  flags says how it got here. */
+void capture_frame(Endpoint *ep, char *buf, size_t len, int flags) {
+
+	struct timespec now;
+	int side;
+
+	if(!capture_file) return;
+
+	if(ep == capture_ep[CAPTURE_CLIENT]) {
+		side = CAPTURE_CLIENT;
+	} else if(ep == capture_ep[CAPTURE_GAME]) {
+		side = CAPTURE_GAME;
+	} else {
+		return;
+	}
+
+	capture_write_held();
+	if(!capture_file) return;
+
+	if(len > capture_left || len > EP_BUFSIZE) {
+		muditm_log("Capture hit capture-max, stopping.");
+		capture_end();
+		return;
+	}
+	capture_left -= len;
+
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	capture_held.nsec = (uint64_t)(now.tv_sec - capture_t0.tv_sec) * 1000000000ULL +
+		(now.tv_nsec - capture_t0.tv_nsec);
+	capture_held.len = len;
+	capture_held.side = side;
+	capture_held.flags = flags;
+	capture_held.pad = 0;
+	memcpy(capture_held_buf,buf,len);
+	capture_holding = 1;
+}
+
+/* The last len bytes read from ep weren't telnet after all.  They came in
+ * behind a start of compression, and will be captured again once they've
+ * been inflated. */
+void capture_retract(Endpoint *ep, size_t len) {
+
+	size_t drop;
+
+	if(!capture_file || !capture_holding) return;
+	if(capture_ep[capture_held.side] != ep) return;
+
+	drop = MIN(len,capture_held.len);
+	capture_held.len -= drop;
+	capture_left += drop;
+}
+
+void capture_end(void) {
+
+	FILE *f;
+
+	if(!(f = capture_file)) return;
+
+	capture_write_held();
+	/* capture_write_held() ends it itself if the write fails. */
+	if(!capture_file) return;
+
+	capture_file = NULL;
+	if(fclose(f) != 0) {
+		muditm_log("Capture to %s failed: %s",capture_name,strerror(errno));
+	} else {
+		muditm_log("Captured %ld frames, %ld bytes to %s",
+			capture_frames,capture_bytes,capture_name
+		);
+	}
+	free(capture_held_buf);
+	capture_held_buf = NULL;
+	g_free(capture_name);
+	capture_name = NULL;
+	capture_ep[CAPTURE_CLIENT] = capture_ep[CAPTURE_GAME] = NULL;
+}
+
+/* For reading a capture back.  NULL if it isn't one. */
+FILE *capture_open(char *filename, struct capture_header *h) {
+
+	FILE *f;
+
+	if(!(f = fopen(filename,"r"))) {
+		return(NULL);
+	}
+	if( (fread(h,sizeof(*h),1,f) != 1) ||
+		memcmp(h->magic,CAPTURE_MAGIC,sizeof(h->magic)) ||
+		(h->version != CAPTURE_VERSION)
+	) {
+		fclose(f);
+		errno = EINVAL;
+		return(NULL);
+	}
+	return(f);
+}
+
+/* the next frame, into buf.  1 for a frame, 0 at the end, -1 if the file
+ * is broken or the frame doesn't fit. */
+int capture_read(FILE *f, struct capture_frame *frame, char *buf, size_t len) {
+
+	if(fread(frame,sizeof(*frame),1,f) != 1) {
+		return(feof(f)?0:-1);
+	}
+	if( (frame->len > len) || (frame->side > CAPTURE_GAME) ||
+		(fread(buf,frame->len,1,f) != 1)
+	) {
+		return(-1);
+	}
+	return(1);
+}
@@ -0,0 +1,73 @@
+/* capture.h - record a session's traffic to a file, to be played back later */
+/* Created: Mon Oct 19 17:20:36 PM EDT 2026 malakai */
+/* $Id: capture.h,v 1.1 2026/10/19 21:20:36 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUDITM_CAPTURE_H
+#define MUDITM_CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "proxy.h"
+
+/* global #defines */
+#define CAPTURE_MAGIC "MUDCAP1"
+#define CAPTURE_VERSION 1
+
+#define CAPTURE_CLIENT 0	/* bytes the client sent */
+#define CAPTURE_GAME 1		/* bytes the game sent */
+
+#define CAPTURE_MCCP 0x01	/* arrived compressed, and was inflated */
+
+/* structs and typedefs */
+
+/* A capture file is one of these, then frames until the end of the file.
+ * Everything is in the byte order of the machine that wrote it. */
+struct capture_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t frame_max;	/* no frame is bigger than this */
+	int64_t started;	/* unix time */
+	char addr[48];		/* the client's address */
+	char game[128];		/* host:service */
+};
+
+/* Each frame is what one read from one side handed the proxy, after TLS and
+ * after inflate.  len bytes of it follow the frame header. */
+struct capture_frame {
+	uint64_t nsec;		/* since the session started */
+	uint32_t len;
+	uint8_t side;
+	uint8_t flags;
+	uint16_t pad;
+};
+
+/* exported global variable declarations */
+
+/* exported function declarations */
+int capture_start(Config *conf, Endpoint *client, Endpoint *game);
+void capture_frame(Endpoint *ep, char *buf, size_t len, int flags);
+void capture_retract(Endpoint *ep, size_t len);
+void capture_end(void);
+FILE *capture_open(char *filename, struct capture_header *h);
+int capture_read(FILE *f, struct capture_frame *frame, char *buf, size_t len);
+
+#endif /* MUDITM_CAPTURE_H */
@@ -0,0 +1,362 @@
+/* config.c - the parsed config file and SSL material, loaded once */
+/* Created: Mon Oct 19 12:41:09 PM EDT 2026 malakai */
+/* $Id: config.c,v 1.1 2026/10/19 16:41:09 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <glib.h>
+
+#include "debug.h"
+#include "muditm.h"
+#include "config.h"
+#include "proxy.h"
+#include "mccp.h"
+#include "zcodec.h"
+#include "sslcache.h"
+#include "sockopt.h"
+
+/* ---- local #defines ---- */
+
+/* ---- structs and typedefs ---- */
+
+/* ---- local variable declarations ---- */
+Config *muditm_config = NULL;
+volatile sig_atomic_t config_reload_pending = 0;
+
+/* ---- local function declarations ---- */
+
+/* ---- code starts here ---- */
+
+/* keyfile parsing simplified. */
+char *get_conf_string(GKeyFile * gkf, gchar * group, gchar * key, gchar * def) {
+	gchar *gs = NULL;
+
+	if ((gs = g_key_file_get_string(gkf, group, key, NULL))) {
+		return (gs);
+	} else {
+		return (strdup(def));
+	}
+
+}
+
+/* keyfile parsing simplified. */
+int get_conf_int(GKeyFile * gkf, gchar * group, gchar * key, int def) {
+	gint gs;
+	GError *error = NULL;
+
+	gs = g_key_file_get_integer(gkf, group, key, &error);
+	if (error == NULL) {
+		return (gs);
+	} else {
+		return (def);
+	}
+
+}
+
+/* keyfile parsing simplified. */
+int get_conf_boolean(GKeyFile * gkf, gchar * group, gchar * key, int def) {
+	gint gs;
+	GError *error = NULL;
+
+	gs = g_key_file_get_boolean(gkf, group, key, &error);
+	if (error == NULL) {
+		return (gs);
+	} else {
+		return (def);
+	}
+
+}
+
+/* read and parse the whole config file, and load the SSL material if any
+ * side needs it.  NULL if any of that didn't work. */
+Config *load_config(char *filename, int generation) {
+
+	Config *c;
+	GKeyFile *gkf;
+	GError *error = NULL;
+
+	gkf = g_key_file_new();
+	if(!g_key_file_load_from_file(gkf,filename,G_KEY_FILE_NONE,&error)){
+		muditm_log("Couldn't read config file %s: %s",filename,error->message);
+		g_error_free(error);
+		g_key_file_free(gkf);
+		return(NULL);
+	}
+
+	c = (Config *)malloc(sizeof(Config));
+	memset(c,0,sizeof(Config));
+	c->filename = strdup(filename);
+	c->gkf = gkf;
+	c->generation = generation;
+
+	c->listen = get_conf_int(gkf,"muditm","listen",4143);
+	c->demon = get_conf_boolean(gkf,"muditm","demon",1);
+	c->log_file = g_key_file_get_string(gkf, "muditm", "log-file", NULL);
+	c->log_ring = get_conf_int(gkf,"muditm","log-ring",1024);
+	c->log_format = get_conf_string(gkf,"muditm","log-format","text");
+	c->stunnelproxy = get_conf_boolean(gkf,"muditm","stunnelproxy",0);
+	c->newenv_ipaddress = g_key_file_get_string_list(gkf,"muditm","newenv_ipaddress",
+		&(c->newenv_ipaddress_count),NULL
+	);
+	c->compression_backend = get_conf_string(gkf,"muditm","compression-backend","zlib");
+	c->compression_pool = get_conf_int(gkf,"muditm","compression-pool",2);
+	c->compression_memory = get_conf_int(gkf,"muditm","compression-memory",0);
+	c->io_quantum = get_conf_int(gkf,"muditm","io-quantum",16384);
+	c->cpus = get_conf_string(gkf,"muditm","cpus","");
+	c->cpu_steering = get_conf_boolean(gkf,"muditm","cpu-steering",0);
+	c->busy_poll = get_conf_int(gkf,"muditm","busy-poll",0);
+
+	c->client_security = get_conf_string(gkf,"client","security","none");
+	c->client_compression = get_conf_string(gkf,"client","compression","enable");
+	c->passthrough = get_conf_boolean(gkf,"client","compression-passthrough",0);
+	c->client_tune = parse_deflate(gkf,"client");
+	c->client_rate = get_conf_int(gkf,"client","rate-limit",0);
+	c->client_burst = get_conf_int(gkf,"client","rate-burst",64);
+	c->client_sockopt = parse_sockopt(gkf,"client");
+
+	c->game_host = get_conf_string(gkf,"game","host","::");
+	c->game_service = get_conf_string(gkf,"game","service","4000");
+	c->game_backends = get_conf_string(gkf,"game","backends","");
+	c->game_balance = get_conf_string(gkf,"game","balance","least-connections");
+	c->game_health_interval = get_conf_int(gkf,"game","health-interval",5);
+	c->game_connect_timeout = get_conf_int(gkf,"game","connect-timeout",5);
+	c->game_security = get_conf_string(gkf,"game","security","none");
+	c->game_compression = get_conf_string(gkf,"game","compression","enable");
+	c->game_tune = parse_deflate(gkf,"game");
+	c->game_rate = get_conf_int(gkf,"game","rate-limit",0);
+	c->game_burst = get_conf_int(gkf,"game","rate-burst",64);
+	c->game_sockopt = parse_sockopt(gkf,"game");
+	c->game_ssl_verify = get_conf_boolean(gkf,"game","ssl-verify",0);
+	c->game_ssl_ca = get_conf_string(gkf,"game","ssl-ca","");
+	c->game_ssl_ciphers = get_conf_string(gkf,"game","ssl-ciphers","");
+	c->game_ssl_ciphersuites = get_conf_string(gkf,"game","ssl-ciphersuites","");
+	c->game_ssl_servername = get_conf_string(gkf,"game","ssl-servername","");
+	c->game_session_reuse = get_conf_boolean(gkf,"game","ssl-session-reuse",1);
+
+	c->cert_file = get_conf_string(gkf,"ssl","cert","cert.pem");
+	c->key_file = get_conf_string(gkf,"ssl","key","key.pem");
+	c->chain_file = get_conf_string(gkf,"ssl","chain","");
+
+	if(!strcasecmp(c->client_security,"SSL")) {
+		c->ctx = SSL_CTX_new(TLS_method());
+		if(!c->ctx || 
+			!configure_context(c->ctx,c->cert_file,c->key_file,c->chain_file)
+		) {
+			free_config(c);
+			return(NULL);
+		}
+		/* does nothing until sslcache_init(), which wants this config. */
+		sslcache_attach(c->ctx);
+	}
+
+	/* the game side is an SSL client, it doesn't need our cert. */
+	if(!strcasecmp(c->game_security,"SSL")) {
+		if(!configure_game_context(c)) {
+			free_config(c);
+			return(NULL);
+		}
+	}
+
+	return(c);
+}
+
+void free_config(Config *c) {
+
+	if(!c) return;
+
+	if(c->ctx) SSL_CTX_free(c->ctx);
+	if(c->game_ctx) SSL_CTX_free(c->game_ctx);
+	if(c->gkf) g_key_file_free(c->gkf);
+	if(c->newenv_ipaddress) g_strfreev(c->newenv_ipaddress);
+	g_free(c->log_file);
+	free(c->log_format);
+	free(c->filename);
+	free(c->compression_backend);
+	free(c->cpus);
+	free(c->client_security);
+	free(c->client_compression);
+	free(c->client_tune);
+	free(c->client_sockopt);
+	free(c->game_host);
+	free(c->game_service);
+	free(c->game_backends);
+	free(c->game_balance);
+	free(c->game_security);
+	free(c->game_compression);
+	free(c->game_tune);
+	free(c->game_sockopt);
+	free(c->game_ssl_ca);
+	free(c->game_ssl_ciphers);
+	free(c->game_ssl_ciphersuites);
+	free(c->game_ssl_servername);
+	free(c->cert_file);
+	free(c->key_file);
+	free(c->chain_file);
+	free(c);
+}
+
+/* the settings that live outside of the sessions. */
+void apply_config(Config *c) {
+
+	if( !(zcodec_default = zcodec_find(c->compression_backend)) ) {
+		muditm_log("Compression backend '%s' isn't built in, using %s.",
+			c->compression_backend, zcodec_all[0]->name
+		);
+		zcodec_default = zcodec_all[0];
+	}
+	zcodec_configure(c->compression_pool,(size_t)c->compression_memory * 1024);
+}
+
+/* load the config file again, and if it's good, use it for the sessions from
+ * now on.  Sessions already running keep the one they started with.  If
+ * it's no good, nothing changes. */
+int reload_config(void) {
+
+	Config *old, *c;
+
+	config_reload_pending = 0;
+	old = muditm_config;
+
+	if( !(c = load_config(old->filename,old->generation+1)) ) {
+		muditm_log("Config reload failed, keeping generation %d.",old->generation);
+		return(0);
+	}
+
+	if(c->listen != old->listen) {
+		muditm_log("Changing the listen port needs a restart.");
+	}
+	if(c->busy_poll != old->busy_poll) {
+		muditm_log("Changing busy-poll needs a restart for the client side.");
+	}
+	if(c->client_sockopt->rcvbuf != old->client_sockopt->rcvbuf) {
+		muditm_log("Changing socket-rcvbuf needs a restart for the client side.");
+	}
+	if(g_strcmp0(c->log_file,old->log_file)) {
+		muditm_log("Changing the log-file needs a restart.");
+	}
+	if( (c->log_ring != old->log_ring) || strcasecmp(c->log_format,old->log_format) ) {
+		muditm_log("Changing log-ring or log-format needs a restart.");
+	}
+	if( g_strcmp0(c->game_host,old->game_host) ||
+		g_strcmp0(c->game_service,old->game_service) ||
+		g_strcmp0(c->game_backends,old->game_backends) ||
+		strcasecmp(c->game_balance,old->game_balance) ||
+		(c->game_health_interval != old->game_health_interval) ||
+		(c->game_connect_timeout != old->game_connect_timeout)
+	) {
+		muditm_log("Changing the game servers or how they're balanced needs a restart.");
+	}
+
+	apply_config(c);
+	muditm_config = c;
+	free_config(old);
+
+	muditm_log("Reloaded %s, generation %d.",c->filename,c->generation);
+	return(1);
+}
+
+/* SIGHUP.  The accept loop does the reload once accept() gets interrupted. */
+void config_sighup(int s) {
+	config_reload_pending = 1;
+}
+
+int configure_context(SSL_CTX * ctx,char *cert, char *key, char *chain)
+{
+	SSL_CTX_set_ecdh_auto(ctx, 1);
+
+	/* Set the key and cert */
+	if (SSL_CTX_use_certificate_file(ctx, cert, SSL_FILETYPE_PEM) <= 0) {
+		muditm_sslerr("using cert file");
+		return(0);
+	}
+
+	if (SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) <= 0) {
+		muditm_sslerr("using private key");
+		return(0);
+	}
+
+	if (SSL_CTX_check_private_key(ctx) <= 0) {
+		muditm_sslerr("private key doesn't go with the cert");
+		return(0);
+	}
+
+	if(*chain) {
+		if (SSL_CTX_use_certificate_chain_file(ctx, chain) <= 0) {
+			muditm_sslerr("using chain cert");
+			return(0);
+		}
+	}
+
+	if (SSL_CTX_set_default_verify_paths(ctx) <= 0) {
+		muditm_sslerr("default paths");
+		return(0);
+	}
+
+	return(1);
+}
+
+/* the SSL_CTX for connecting to the game, with its own verify and cipher
+ * settings. */
+int configure_game_context(Config *c) {
+
+	SSL_CTX *ctx;
+
+	if( !(ctx = c->game_ctx = SSL_CTX_new(TLS_client_method())) ) {
+		muditm_sslerr("game SSL context");
+		return(0);
+	}
+
+	if(*(c->game_ssl_ciphers) &&
+		(SSL_CTX_set_cipher_list(ctx,c->game_ssl_ciphers) <= 0)
+	) {
+		muditm_sslerr("game ssl-ciphers %s",c->game_ssl_ciphers);
+		return(0);
+	}
+	if(*(c->game_ssl_ciphersuites) &&
+		(SSL_CTX_set_ciphersuites(ctx,c->game_ssl_ciphersuites) <= 0)
+	) {
+		muditm_sslerr("game ssl-ciphersuites %s",c->game_ssl_ciphersuites);
+		return(0);
+	}
+
+	if(c->game_ssl_verify) {
+		if(*(c->game_ssl_ca)) {
+			if(SSL_CTX_load_verify_locations(ctx,c->game_ssl_ca,NULL) <= 0) {
+				muditm_sslerr("game ssl-ca %s",c->game_ssl_ca);
+				return(0);
+			}
+		} else if(SSL_CTX_set_default_verify_paths(ctx) <= 0) {
+			muditm_sslerr("default paths");
+			return(0);
+		}
+		SSL_CTX_set_verify(ctx,SSL_VERIFY_PEER,NULL);
+	} else {
+		SSL_CTX_set_verify(ctx,SSL_VERIFY_NONE,NULL);
+	}
+
+	sslcache_upstream_attach(ctx,c->game_session_reuse);
+	return(1);
+}
@@ -0,0 +1,108 @@
+/* config.h - the parsed config file and SSL material, loaded once */
+/* Created: Mon Oct 19 12:41:09 PM EDT 2026 malakai */
+/* $Id: config.h,v 1.1 2026/10/19 16:41:09 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUDITM_CONFIG_H
+#define MUDITM_CONFIG_H
+
+#include <signal.h>
+#include <glib.h>
+#include <openssl/ssl.h>
+
+/* global #defines */
+
+/* structs and typedefs */
+
+/* Everything out of the config file, parsed once, plus the SSL_CTX with the
+ * certs already loaded.  The parent keeps the current one and each session
+ * gets whatever was current when it forked.  Nothing changes it after it's
+ * loaded.  A SIGHUP makes a whole new one for the sessions after that. */
+struct config_data {
+	char *filename;
+	GKeyFile *gkf;		/* for anything only read at startup */
+	int generation;
+
+	int listen;
+	int demon;
+	char *log_file;
+	int log_ring;
+	char *log_format;
+	int stunnelproxy;
+	gchar **newenv_ipaddress;
+	gsize newenv_ipaddress_count;
+	char *compression_backend;
+	int compression_pool;
+	int compression_memory;
+	int io_quantum;		/* most bytes read from a side per pass */
+	char *cpus;		/* the CPUs to pin sessions to, empty for no pinning */
+	int cpu_steering;
+	int busy_poll;		/* usec, for SO_BUSY_POLL */
+
+	char *client_security;
+	char *client_compression;
+	int passthrough;
+	struct mccp_tune_data *client_tune;
+	int client_rate;	/* KB/s from the client, 0 for no limit */
+	int client_burst;
+	struct sockopt_data *client_sockopt;
+
+	char *game_host;
+	char *game_service;
+	char *game_backends;	/* ; separated host:service:weight, or empty for just host */
+	char *game_balance;
+	int game_health_interval;
+	int game_connect_timeout;
+	char *game_security;
+	char *game_compression;
+	struct mccp_tune_data *game_tune;
+	int game_rate;		/* KB/s from the game, 0 for no limit */
+	int game_burst;
+	struct sockopt_data *game_sockopt;
+	int game_ssl_verify;
+	char *game_ssl_ca;
+	char *game_ssl_ciphers;
+	char *game_ssl_ciphersuites;
+	char *game_ssl_servername;	/* SNI, and the name the cert has to have */
+	int game_session_reuse;
+
+	char *cert_file;
+	char *key_file;
+	char *chain_file;
+	SSL_CTX *ctx;		/* NULL unless the client side uses SSL */
+	SSL_CTX *game_ctx;	/* NULL unless the game side uses SSL */
+};
+
+typedef struct config_data Config;
+
+/* exported global variable declarations */
+extern Config *muditm_config;
+extern volatile sig_atomic_t config_reload_pending;
+
+/* exported function declarations */
+Config *load_config(char *filename, int generation);
+void free_config(Config *c);
+void apply_config(Config *c);
+int reload_config(void);
+void config_sighup(int s);
+int configure_context(SSL_CTX * ctx,char *cert, char *key, char *chain);
+int configure_game_context(Config *c);
+
+#endif /* MUDITM_CONFIG_H */
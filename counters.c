@@ -0,0 +1,74 @@
+/* counters.c - cheap always-on counts of where a session spends its time */
+/* Created: Mon Oct 19 15:05:12 PM EDT 2026 malakai */
+/* $Id: counters.c,v 1.1 2026/10/19 19:05:12 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+
+#include "counters.h"
+
+/* ---- local #defines ---- */
+
+/* ---- structs and typedefs ---- */
+
+/* ---- local variable declarations ---- */
+struct counter_data counters;
+
+/* ---- local function declarations ---- */
+
+/* ---- code starts here ---- */
+
+/* add from to a set that's shared with other processes, or with a signal
+ * handler. */
+void counters_add_atomic(struct counter_data *to, struct counter_data *from) {
+
+	long int *t = (long int *)to;
+	long int *f = (long int *)from;
+	int i;
+
+	for(i=0; i<COUNTER_LONGS; i++) {
+		if(f[i]) {
+			__atomic_add_fetch(&(t[i]),f[i],__ATOMIC_RELAXED);
+		}
+	}
+}
+
+int counters_printstats(char *buf, size_t len, struct counter_data *c) {
+
+	int n;
+
+	n = snprintf(buf,len,
+		"%ld reads (%ld B avg), %ld writes (%ld B avg), "
+		"pcre2 %ld calls over %ld B, %ld partial holds, %ld B moved, "
+		"deflate %.1fms in %ld calls, inflate %.1fms in %ld calls",
+		c->reads, c->reads?(c->read_bytes / c->reads):0,
+		c->writes, c->writes?(c->write_bytes / c->writes):0,
+		c->matches, c->match_bytes, c->partials, c->moved,
+		c->deflate_nsec / 1000000.0, c->deflates,
+		c->inflate_nsec / 1000000.0, c->inflates
+	);
+	if(c->shaped && (n < len)) {
+		n += snprintf(buf+n,len-n,", %ld rate limit waits",c->shaped);
+	}
+	if(c->quickacks && (n < len)) {
+		n += snprintf(buf+n,len-n,", %ld quick ACKs",c->quickacks);
+	}
+	return(n);
+}
@@ -0,0 +1,64 @@
+/* counters.h - cheap always-on counts of where a session spends its time */
+/* Created: Mon Oct 19 15:05:12 PM EDT 2026 malakai */
+/* $Id: counters.h,v 1.1 2026/10/19 19:05:12 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUDITM_COUNTERS_H
+#define MUDITM_COUNTERS_H
+
+#include <stddef.h>
+
+/* global #defines */
+#define COUNTER_ACTIONS 24	/* room for every PatternAction there is */
+
+/* structs and typedefs */
+
+/* What the hot path did in this session, as counts of calls and bytes.
+ * Nothing but plain increments where it's counted.  All longs,
+ * so they can be added up as an array. */
+struct counter_data {
+	long int reads;		/* read() or SSL_read() calls */
+	long int read_bytes;
+	long int writes;	/* write() or SSL_write() calls */
+	long int write_bytes;
+	long int matches;	/* pcre2_match() calls */
+	long int match_bytes;	/* bytes handed to pcre2_match() */
+	long int partials;	/* times input was held for a partial match */
+	long int moved;		/* bytes pop_iobuf() memmove'd down */
+	long int deflates;
+	long int deflate_nsec;
+	long int inflates;
+	long int inflate_nsec;
+	long int shaped;	/* times a flow used up its rate limit */
+	long int quickacks;	/* TCP_QUICKACK setsockopt() calls after reads */
+	long int action_calls[COUNTER_ACTIONS];
+	long int action_nsec[COUNTER_ACTIONS];
+};
+
+#define COUNTER_LONGS (sizeof(struct counter_data) / sizeof(long int))
+
+/* exported global variable declarations */
+extern struct counter_data counters;
+
+/* exported function declarations */
+void counters_add_atomic(struct counter_data *to, struct counter_data *from);
+int counters_printstats(char *buf, size_t len, struct counter_data *c);
+
+#endif /* MUDITM_COUNTERS_H */
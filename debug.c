@@ -1,8 +1,8 @@
 /* debug.c - Debugging code for muditm */
 /* Created: Wed Mar  3 11:09:27 PM EST 2021 malakai */
-/* $Id: debug.c,v 1.6 2024/02/27 04:39:21 malakai Exp $*/
+/* $Id: debug.c,v 1.7 2026/10/19 16:52:11 malakai Exp $*/
 
-/* Copyright © 2021-2024 Jeff Jahr <malakai@jeffrika.com>
+/* Copyright © 2021-2026 Jeff Jahr <malakai@jeffrika.com>
  *
  * This file is part of MUDitM - MUD in the Middle
  *
@@ -22,22 +22,311 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <time.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <signal.h>
+#include <pthread.h>
 #include <openssl/err.h>
 
 #include "debug.h"
 
+/* ---- local #defines ---- */
+#define LOG_WRITE_BUF (64*1024)		/* the writer's batch of lines */
+#define LOG_LINE_ROOM (LOG_LINE_LEN*6 + 256)	/* worst case, json escaped */
+#define LOG_WRITER_NAP 20000000L	/* ns to sleep when there's nothing to do */
+#define LOG_WRITER_GRACE 100000000L	/* ns for stragglers before it leaves */
+#define LOG_STUCK_SECS 2		/* a ticket not filled in this long is skipped */
+#define LOG_SEQ_FILLING (1UL<<63)	/* or'ed into seq while a line is copied in */
+
+/* ---- structs and typedefs ---- */
+
+/* ---- local variable declarations ---- */
 unsigned int global_debug_flag;
 
 FILE *muditm_logfile;
+struct log_ring *muditm_logring = NULL;
+
+static pid_t log_pid = 0;
+static int log_format = LOG_FORMAT_TEXT;
+static char log_tag[LOG_TAG_LEN] = "";
+static char *log_level_name[] = { "info", "debug" };
+
+/* localtime() and friends only get called when the second changes. */
+static time_t log_cached_sec = -1;
+static char log_cached_text[32];	/* what asctime() would say */
+static char log_cached_iso[32];
+static char log_cached_zone[8];
+
+/* ---- local function declarations ---- */
+void log_atfork_child(void);
+void log_fill(struct log_entry *e, int level, char *str, va_list ap);
+size_t log_json_escape(char *buf, size_t len, char *str, int slen);
+size_t log_format_entry(char *buf, size_t len, struct log_entry *e, int format);
+void log_direct(struct log_entry *e);
+void log_vlog(int level, char *str, va_list ap);
+void log_writer(pid_t parent);
+
+/* ---- code starts here ---- */
+
+void log_atfork_child(void) {
+	log_pid = getpid();
+}
+
+void log_fill(struct log_entry *e, int level, char *str, va_list ap) {
+
+	int len;
+
+	/* the coarse clock is a few ms behind at worst, and never leaves
+	 * userspace. */
+	clock_gettime(CLOCK_REALTIME_COARSE,&(e->ts));
+	e->pid = log_pid?log_pid:getpid();
+	e->level = level;
+	strcpy(e->tag,log_tag);
+	len = vsnprintf(e->msg, sizeof(e->msg), str, ap);
+	if(len < 0) {
+		len = 0;
+		e->msg[0] = '\0';
+	} else if(len >= sizeof(e->msg)) {
+		len = sizeof(e->msg) - 1;
+		memcpy(e->msg + len - 3, "...", 3);
+	}
+	e->len = len;
+}
+
+size_t log_json_escape(char *buf, size_t len, char *str, int slen) {
+
+	size_t used = 0;
+	unsigned char c;
+	int i;
+
+	for(i=0; i<slen && used+7 < len; i++) {
+		c = (unsigned char)str[i];
+		if(c == '"' || c == '\\') {
+			buf[used++] = '\\';
+			buf[used++] = c;
+		} else if(c < 0x20) {
+			used += snprintf(buf+used, len-used, "\\u%04x", c);
+		} else {
+			buf[used++] = c;
+		}
+	}
+	return(used);
+}
+
+size_t log_format_entry(char *buf, size_t len, struct log_entry *e, int format) {
+
+	struct tm tm;
+	size_t used;
+
+	if(e->ts.tv_sec != log_cached_sec) {
+		localtime_r(&(e->ts.tv_sec),&tm);
+		strftime(log_cached_text,sizeof(log_cached_text),"%a %b %e %H:%M:%S %Y",&tm);
+		strftime(log_cached_iso,sizeof(log_cached_iso),"%Y-%m-%dT%H:%M:%S",&tm);
+		strftime(log_cached_zone,sizeof(log_cached_zone),"%z",&tm);
+		log_cached_sec = e->ts.tv_sec;
+	}
+
+	if(format != LOG_FORMAT_JSON) {
+		used = snprintf(buf, len, "%s [%d] %.*s\n",
+			log_cached_text, e->pid, e->len, e->msg
+		);
+		return((used < len)?used:len-1);
+	}
+
+	used = snprintf(buf, len, "{\"time\":\"%s.%03ld%s\",\"pid\":%d,\"level\":\"%s\",",
+		log_cached_iso, e->ts.tv_nsec/1000000, log_cached_zone,
+		e->pid, log_level_name[e->level]
+	);
+	if(*(e->tag)) {
+		used += snprintf(buf+used, len-used, "\"session\":\"");
+		used += log_json_escape(buf+used, len-used, e->tag, strlen(e->tag));
+		used += snprintf(buf+used, len-used, "\",");
+	}
+	used += snprintf(buf+used, len-used, "\"msg\":\"");
+	used += log_json_escape(buf+used, len-used, e->msg, e->len);
+	used += snprintf(buf+used, len-used, "\"}\n");
+	return((used < len)?used:len-1);
+}
+
+/* the old way, for before the ring is going, or if it's off. */
+void log_direct(struct log_entry *e) {
+
+	char buf[LOG_LINE_ROOM];
+	size_t len;
+
+	/* before muditm_log_init(), which needs the config file read first. */
+	if(!muditm_logfile) muditm_logfile = stderr;
+
+	len = log_format_entry(buf, sizeof(buf), e, log_format);
+	fwrite(buf, 1, len, muditm_logfile);
+	fflush(muditm_logfile);
+}
+
+void log_vlog(int level, char *str, va_list ap) {
+
+	struct log_ring *r = muditm_logring;
+	struct log_entry local, *e;
+	unsigned long t, seq;
+
+	/* filled in here first, so the entry is only ours for a memcpy(). */
+	log_fill(&local,level,str,ap);
+
+	if(r && __atomic_load_n(&(r->writer),__ATOMIC_RELAXED)) {
+		t = __atomic_load_n(&(r->head),__ATOMIC_RELAXED);
+		do {
+			/* full means the writer is behind.  Better to lose the line
+			 * than to make the session wait on the disk. */
+			if(t - __atomic_load_n(&(r->tail),__ATOMIC_ACQUIRE) >= r->slots) {
+				__atomic_add_fetch(&(r->dropped),1,__ATOMIC_RELAXED);
+				return;
+			}
+		} while(!__atomic_compare_exchange_n(&(r->head),&t,t+1,1,
+			__ATOMIC_RELAXED,__ATOMIC_RELAXED)
+		);
+
+		/* If we were held up long enough, the writer gave up on this
+		 * ticket, and the entry may belong to somebody else by now. */
+		e = &(r->entry[t % r->slots]);
+		seq = t;
+		if(!__atomic_compare_exchange_n(&(e->seq),&seq,t|LOG_SEQ_FILLING,0,
+			__ATOMIC_ACQUIRE,__ATOMIC_RELAXED)
+		) {
+			__atomic_add_fetch(&(r->dropped),1,__ATOMIC_RELAXED);
+			return;
+		}
+		memcpy(&(e->ts),&(local.ts),offsetof(struct log_entry,msg) -
+			offsetof(struct log_entry,ts) + local.len + 1
+		);
+		seq = t|LOG_SEQ_FILLING;
+		if(!__atomic_compare_exchange_n(&(e->seq),&seq,t+1,0,
+			__ATOMIC_RELEASE,__ATOMIC_RELAXED)
+		) {
+			__atomic_add_fetch(&(r->dropped),1,__ATOMIC_RELAXED);
+		}
+		return;
+	}
+
+	log_direct(&local);
+}
+
+/* The log writer process.  It drains the ring into the log file in big
+ * writes, napping when there's nothing to do.  When the main process goes
+ * away, sessions that are still running log straight to the file again. */
+void log_writer(pid_t parent) {
+
+	struct log_ring *r = muditm_logring;
+	struct log_entry *e, note;
+	struct sigaction sa;
+	struct timespec nap = { 0, LOG_WRITER_NAP };
+	struct timespec grace = { 0, LOG_WRITER_GRACE };
+	struct timespec now;
+	time_t stuck = 0;
+	unsigned long t, seq, dropped, reported = 0;
+	char *out;
+	size_t used, done;
+	ssize_t ret;
+	int fd = fileno(muditm_logfile);
+	int leaving = 0;
+
+	/* it stays around until the main process is gone, whatever
+	 * signals the rest of them get. */
+	sa.sa_handler = SIG_IGN;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sigaction(SIGHUP,&sa,NULL);
+	sigaction(SIGINT,&sa,NULL);
+	sigaction(SIGTERM,&sa,NULL);
+	sigaction(SIGPIPE,&sa,NULL);
+
+	if(!(out = (char *)malloc(LOG_WRITE_BUF))) {
+		__atomic_store_n(&(r->writer),0,__ATOMIC_RELAXED);
+		_exit(EXIT_FAILURE);
+	}
+
+	t = r->tail;
+	for(;;) {
+		used = 0;
+		while(LOG_WRITE_BUF - used > LOG_LINE_ROOM) {
+			if(t == __atomic_load_n(&(r->head),__ATOMIC_RELAXED)) break;
+			e = &(r->entry[t % r->slots]);
+			seq = __atomic_load_n(&(e->seq),__ATOMIC_ACQUIRE);
+			if(seq != t+1) {
+				/* taken, but not filled in yet.  If whoever took it died
+				 * doing it, it would hold up everybody forever. */
+				clock_gettime(CLOCK_MONOTONIC_COARSE,&now);
+				if(!stuck) stuck = now.tv_sec;
+				if(now.tv_sec - stuck < LOG_STUCK_SECS) break;
+				/* hand the entry on to the next lap's ticket.  If it got
+				 * filled in just now after all, take it the usual way. */
+				if(!__atomic_compare_exchange_n(&(e->seq),&seq,t+r->slots,0,
+					__ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE)
+				) {
+					continue;
+				}
+				__atomic_add_fetch(&(r->dropped),1,__ATOMIC_RELAXED);
+			} else {
+				used += log_format_entry(out+used,LOG_WRITE_BUF-used,e,r->format);
+				__atomic_add_fetch(&(r->written),1,__ATOMIC_RELAXED);
+				__atomic_store_n(&(e->seq),t+r->slots,__ATOMIC_RELEASE);
+			}
+			stuck = 0;
+			t++;
+			__atomic_store_n(&(r->tail),t,__ATOMIC_RELEASE);
+		}
+
+		dropped = __atomic_load_n(&(r->dropped),__ATOMIC_RELAXED);
+		if(dropped != reported && LOG_WRITE_BUF - used > LOG_LINE_ROOM) {
+			clock_gettime(CLOCK_REALTIME_COARSE,&(note.ts));
+			note.pid = getpid();
+			note.level = LOG_LEVEL_INFO;
+			note.tag[0] = '\0';
+			note.len = snprintf(note.msg,sizeof(note.msg),
+				"Log ring was full, %lu lines dropped so far.",dropped
+			);
+			used += log_format_entry(out+used,LOG_WRITE_BUF-used,&note,r->format);
+			reported = dropped;
+		}
+
+		for(done=0; done<used; done+=ret) {
+			if((ret = write(fd,out+done,used-done)) < 0) {
+				if(errno == EINTR) {
+					ret = 0;
+					continue;
+				}
+				__atomic_store_n(&(r->writer),0,__ATOMIC_RELAXED);
+				_exit(EXIT_FAILURE);
+			}
+		}
+		if(used) continue;
+
+		if(leaving) break;
+		if(getppid() != parent) {
+			__atomic_store_n(&(r->writer),0,__ATOMIC_RELAXED);
+			leaving = 1;
+			nanosleep(&grace,NULL);
+			continue;
+		}
+		nanosleep(&nap,NULL);
+	}
+	_exit(EXIT_SUCCESS);
+}
 
 void muditm_log_init(char *pathname) {
 	FILE *out;
+	static int once = 0;
+
+	if(!once) {
+		pthread_atfork(NULL,NULL,log_atfork_child);
+		once = 1;
+	}
+	log_pid = getpid();
 
 	muditm_logfile = stderr;
 	if(pathname && *pathname) {
@@ -48,24 +337,84 @@ void muditm_log_init(char *pathname) {
 		muditm_logfile = out;
 	}
 }
-	
-void muditm_log(char *str, ...)
+
+/* set up the ring and fork off the process that writes it out.  This has
+ * to happen before any sessions fork, for them to share it.  slots of 0
+ * keeps logging the way it always was, one fflush()ed line at a time. */
+int muditm_log_start(int slots, char *format) {
+
+	struct log_ring *r;
+	size_t size;
+	pid_t pid, parent;
+	int i;
+
+	log_format = (format && !strcasecmp(format,"json"))?LOG_FORMAT_JSON:LOG_FORMAT_TEXT;
+	if(slots <= 0) return(0);
+	if(slots < 16) slots = 16;
+
+	size = sizeof(struct log_ring) + sizeof(struct log_entry) * slots;
+	r = (struct log_ring *)mmap(NULL,size,PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_ANONYMOUS,-1,0
+	);
+	if(r == MAP_FAILED) {
+		muditm_log("Can't map %d log ring slots: %s",slots,strerror(errno));
+		return(0);
+	}
+	memset(r,0,size);
+	r->slots = slots;
+	r->format = log_format;
+	for(i=0; i<slots; i++) {
+		r->entry[i].seq = i;
+	}
+
+	fflush(muditm_logfile);
+	parent = getpid();
+	if((pid = fork()) < 0) {
+		muditm_log("Can't fork the log writer: %s",strerror(errno));
+		munmap(r,size);
+		return(0);
+	}
+	muditm_logring = r;
+	if(pid == 0) {
+		log_writer(parent);
+	}
+	__atomic_store_n(&(r->writer),pid,__ATOMIC_RELEASE);
+	muditm_log("Log writer is pid %d, %d line ring.",pid,slots);
+	return(1);
+}
+
+/* the session's client address, for the structured log lines. */
+void muditm_log_tag(char *tag) {
+	snprintf(log_tag,sizeof(log_tag),"%s",tag?tag:"");
+}
+
+/* from the SIGCHLD handler.  If the writer died, go back to the file. */
+int muditm_log_reap(pid_t pid) {
+	struct log_ring *r = muditm_logring;
+
+	if(r && pid == __atomic_load_n(&(r->writer),__ATOMIC_RELAXED)) {
+		__atomic_store_n(&(r->writer),0,__ATOMIC_RELAXED);
+		return(1);
+	}
+	return(0);
+}
+
+void muditm_log_level(int level, char *str, ...)
 {
 	va_list ap;
-	long ct;
-	char *tmstr;
-	char vbuf[LOG_BUF_LEN];
-	vbuf[0] = '\0';
 
 	va_start(ap, str);
-	vsnprintf(vbuf, sizeof(vbuf) - 1, str, ap);
+	log_vlog(level, str, ap);
 	va_end(ap);
+}
 
-	ct = time(0);
-	tmstr = asctime(localtime(&ct));
-	*(tmstr + strlen(tmstr) - 1) = '\0';
-	fprintf(muditm_logfile, "%s [%d] %s\n", tmstr, getpid(), vbuf);
-	fflush(muditm_logfile);
+void muditm_log(char *str, ...)
+{
+	va_list ap;
+
+	va_start(ap, str);
+	log_vlog(LOG_LEVEL_INFO, str, ap);
+	va_end(ap);
 }
 
 int muditm_ssl_err_cb(const char *str, size_t len, void *u) {
@@ -1,8 +1,8 @@
 /* debug.h - Debugging code for muditm */
 /* Created: Wed Mar  3 11:09:27 PM EST 2021 malakai */
-/* $Id: debug.h,v 1.5 2024/02/27 04:39:21 malakai Exp $*/
+/* $Id: debug.h,v 1.6 2026/10/19 16:52:11 malakai Exp $*/
 
-/* Copyright © 2021-2024 Jeff Jahr <malakai@jeffrika.com>
+/* Copyright © 2021-2026 Jeff Jahr <malakai@jeffrika.com>
  *
  * This file is part of MUDitM - MUD in the Middle
  *
@@ -23,18 +23,63 @@
 #ifndef MUDITM_DEBUG_H
 #define MUDITM_DEBUG_H
 
+#include <sys/types.h>
+#include <time.h>
+
 /* global #defines */
 #define LOG_BUF_LEN 8192
+#define LOG_LINE_LEN 1000	/* longest message a ring entry holds */
+#define LOG_TAG_LEN 48		/* room for an IPv6 address */
+
+#define LOG_LEVEL_INFO 0
+#define LOG_LEVEL_DEBUG 1
+
+#define LOG_FORMAT_TEXT 0
+#define LOG_FORMAT_JSON 1
 
-#define muditm_debug(args...) { if(global_debug_flag) { muditm_log(args); } }
+#define muditm_debug(args...) { if(global_debug_flag) { muditm_log_level(LOG_LEVEL_DEBUG,args); } }
 
 /* structs and typedefs */
 
+/* one log line, as it sits in the ring waiting for the writer. */
+struct log_entry {
+	unsigned long seq;	/* the ticket that may fill it in, ticket+1 once
+				   the line is all there */
+	struct timespec ts;
+	pid_t pid;
+	int level;
+	int len;
+	char tag[LOG_TAG_LEN];
+	char msg[LOG_LINE_LEN];
+};
+
+/* Shared by every process.  Anyone that logs takes the next ticket from head
+ * and fills in that entry, no locks and no system calls.  The log writer
+ * process is the only one that writes to the log file, in order of ticket,
+ * and moves tail along as it goes.  Each entry's seq says which ticket it
+ * belongs to, so a logger whose ticket was given up on can tell, and keeps
+ * its hands off the entry. */
+struct log_ring {
+	unsigned long head;	/* next ticket to hand out */
+	unsigned long tail;	/* next ticket to write */
+	unsigned long written;
+	unsigned long dropped;	/* lines that found the ring full */
+	pid_t writer;		/* 0 means log straight to the file */
+	int format;
+	int slots;
+	struct log_entry entry[];
+};
+
 /* exported global variable declarations */
 extern unsigned int global_debug_flag;
+extern struct log_ring *muditm_logring;
 
 /* exported function declarations */
 void muditm_log_init(char *pathname);
+int muditm_log_start(int slots, char *format);
+void muditm_log_tag(char *tag);
+int muditm_log_reap(pid_t pid);
+void muditm_log_level(int level, char *str, ...);
 void muditm_log(char *str, ...);
 void muditm_sslerr(char *str, ...);
 
@@ -40,6 +40,7 @@
 #include "iobuf.h"
 #include "proxy.h"
 #include "mccp.h"
+#include "counters.h"
 
 #include "handlers.h"
 
@@ -50,6 +51,7 @@ struct pattern_data *new_pattern() {
 	m->pat = NULL;
 	m->len = 0;
 	m->action = NULL;
+	m->counter = 0;
 	return(m);
 }
 
@@ -116,6 +118,52 @@ int snprintf_mnes_pair(char *str, size_t size, char *var, char *val) {
 	return(s);
 }
 
+/* names for the actions, for the counters.  Anything not in here gets
+ * counted as "other", in slot 0. */
+static struct {
+	PatternAction *action;
+	char *name;
+} pattern_action_names[] = {
+	{ NULL, "other" },
+	{ redact_match, "redact_match" },
+	{ remove_match, "remove_match" },
+	{ mnes_request, "mnes_request" },
+	{ mnes_client_wont, "mnes_client_wont" },
+	{ mnes_does, "mnes_does" },
+	{ respond_dont, "respond_dont" },
+	{ respond_do, "respond_do" },
+	{ respond_wont, "respond_wont" },
+	{ mccp_ignore, "mccp_ignore" },
+	{ mccp2_do, "mccp2_do" },
+	{ mccp2_dont, "mccp2_dont" },
+	{ mccp2_sb_start, "mccp2_sb_start" },
+	{ mccp3_do, "mccp3_do" },
+	{ mccp3_dont, "mccp3_dont" },
+	{ mccp3_sb_start, "mccp3_sb_start" },
+	{ NULL, NULL }
+};
+
+int pattern_action_index(PatternAction *action) {
+	int i;
+	for(i=1; pattern_action_names[i].name && (i < COUNTER_ACTIONS); i++) {
+		if(pattern_action_names[i].action == action) {
+			return(i);
+		}
+	}
+	return(0);
+}
+
+/* NULL past the last one. */
+char *pattern_action_name(int index) {
+	int i;
+	for(i=0; pattern_action_names[i].name; i++) {
+		if(i == index) {
+			return(pattern_action_names[i].name);
+		}
+	}
+	return(NULL);
+}
+
 void add_pattern(Endpoint *ep,char *pat, size_t size, PatternAction *handler) {
 	struct pattern_data *p;
 	p = new_pattern();
@@ -123,6 +171,7 @@ void add_pattern(Endpoint *ep,char *pat, size_t size, PatternAction *handler) {
 	memcpy(p->pat,pat,size);
 	p->len = size;
 	p->action = handler;
+	p->counter = pattern_action_index(handler);
 	ep->patterns = g_list_append(ep->patterns,p);
 }
 
@@ -202,7 +251,7 @@ void add_client_patterns(Endpoint *ep) {
  * get matched again, and cause a loop.  You've been warned! */
 
 /* It is very simple to strip the match out of the input stream. */
-int remove_match(Iobuf *iob,size_t match_len,Endpoint *from, Endpoint *to,GKeyFile *gkf) {
+int remove_match(Iobuf *iob,size_t match_len,Endpoint *from, Endpoint *to,Config *conf) {
 
 	/* stripping a match out is easy... just remove the match from the input
 	 * buffer, and return 1. */
@@ -212,7 +261,7 @@ int remove_match(Iobuf *iob,size_t match_len,Endpoint *from, Endpoint *to,GKeyFi
 
 /* example showing how to take a match out of the stream and replace it with
  * something else.*/
-int redact_match(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to, GKeyFile *gkf) {
+int redact_match(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to, Config *conf) {
 
 	Iobuf *out;
 	out = (to->iobuf[EP_OUTPUT]);
@@ -232,17 +281,13 @@ int redact_match(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to, GKe
 
 
 /* server has asked for the list of all environment variables.  Inject our special ones! */
-int mnes_request(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to, GKeyFile *gkf) {
+int mnes_request(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to, Config *conf) {
 	
-	gchar **ipreportlist;
-	gsize ipreportcount;
 	char addrtxt[INET6_ADDRSTRLEN];
 	Iobuf *out;
 
 	muditm_log("%s requested mnes new-environ info",from->name);
 	
-	ipreportlist = g_key_file_get_string_list (gkf,"muditm","newenv_ipaddress",&ipreportcount,NULL);
-
 	/* this output is going back to who we got it from, not through the proxy to the other side */
 	out = (from->iobuf[EP_OUTPUT]);
 
@@ -254,20 +299,19 @@ int mnes_request(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to, GKe
 	);
 
 	/* queue all of the host report vars */
-	if(ipreportlist) {
+	if(conf->newenv_ipaddress) {
 		addr_endpoint(to,addrtxt,sizeof(addrtxt));
-		for(int i=0; i<ipreportcount; i++) {
+		for(int i=0; i<conf->newenv_ipaddress_count; i++) {
 			push_iobuf(out, 
 				snprintf_mnes_pair(tail_iobuf(out),avail_iobuf(out),
-					ipreportlist[i],addrtxt
+					conf->newenv_ipaddress[i],addrtxt
 				)
 			);
 			muditm_log("Sent %s '%s' to %s",
-				ipreportlist[i],addrtxt,
+				conf->newenv_ipaddress[i],addrtxt,
 				from->name
 			);
 		}
-		g_strfreev (ipreportlist);
 	}
 
 	/* and write it out. */
@@ -285,7 +329,7 @@ int mnes_request(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to, GKe
 }
 
 /* the client won't do new-env, but we will.  Take note of that, and lie about it. */
-int mnes_client_wont(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to, GKeyFile *gkf) {
+int mnes_client_wont(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to, Config *conf) {
 
 	Iobuf *out;
 	char mnes_will[] = { IAC, WILL, TELOPT_NEW_ENVIRON };
@@ -309,7 +353,7 @@ int mnes_client_wont(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to,
 	return (1);
 }
 
-int mnes_does(Iobuf *iob,size_t match_len,Endpoint *from, Endpoint *to,GKeyFile *gkf) {
+int mnes_does(Iobuf *iob,size_t match_len,Endpoint *from, Endpoint *to,Config *conf) {
 
 	/* just make a note of if. */
 	muditm_log("%s does new-environ.",from->name);
@@ -318,7 +362,7 @@ int mnes_does(Iobuf *iob,size_t match_len,Endpoint *from, Endpoint *to,GKeyFile
 };
 
 /* whatever the sender said he will, we say X on behalf of the other side. */
-int respond_X(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to, GKeyFile *gkf, char X) {
+int respond_X(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to, Config *conf, char X) {
 	
 	Iobuf *out;
 	char proto;
@@ -344,7 +388,7 @@ int respond_X(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to, GKeyFi
 
 
 /* whatever the sender said he will, we say dont. */
-int respond_dont(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to, GKeyFile *gkf) {
+int respond_dont(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to, Config *conf) {
 	
 	char proto;
 
@@ -352,11 +396,11 @@ int respond_dont(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to, GKe
 
 	muditm_debug("send IAC DONT %d to %s",proto,from->name);
 
-	return(respond_X(iob,match_len,from,to,gkf,DONT));
+	return(respond_X(iob,match_len,from,to,conf,DONT));
 }
 
 /* whatever the sender said he will, we say dont. */
-int respond_do(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to, GKeyFile *gkf) {
+int respond_do(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to, Config *conf) {
 	
 	char proto;
 
@@ -364,11 +408,11 @@ int respond_do(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to, GKeyF
 
 	muditm_debug("send IAC DO %d to %s",proto,from->name);
 
-	return(respond_X(iob,match_len,from,to,gkf,DO));
+	return(respond_X(iob,match_len,from,to,conf,DO));
 }
 
 /* whatever the sender said he will, we say dont. */
-int respond_wont(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to, GKeyFile *gkf) {
+int respond_wont(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to, Config *conf) {
 	
 	char proto;
 
@@ -376,5 +420,5 @@ int respond_wont(Iobuf *iob, size_t match_len, Endpoint *from, Endpoint *to, GKe
 
 	muditm_debug("send IAC WONT %d to %s",proto,from->name);
 
-	return(respond_X(iob,match_len,from,to,gkf,DONT));
+	return(respond_X(iob,match_len,from,to,conf,WONT));
 }
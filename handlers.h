@@ -23,6 +23,8 @@
 #ifndef MUDITM_HANDLERS_H
 #define MUDITM_HANDLERS_H
 
+#include "config.h"
+
 /* global #defines */
 #define TELOPT_MCCP2 86
 #define TELOPT_MCCP3 87
@@ -31,13 +33,14 @@
 typedef int PatternAction(Iobuf *iob, size_t match_len,
 	Endpoint *from, 
 	Endpoint *to, 
-	GKeyFile *gkf 
+	Config *conf 
 );
 
 struct pattern_data {
 	char *pat;
 	size_t len;
 	PatternAction *action;
+	int counter;		/* which counters.action_* are this action's */
 };
 
 
@@ -52,6 +55,8 @@ void add_client_patterns(Endpoint *ep);
 void add_pattern(Endpoint *ep,char *pat, size_t size, PatternAction *handler);
 void enable_matching(Endpoint *ep);
 void disable_matching(Endpoint *ep);
+int pattern_action_index(PatternAction *action);
+char *pattern_action_name(int index);
 
 PatternAction redact_match;
 PatternAction remove_match;
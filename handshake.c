@@ -0,0 +1,307 @@
+/* handshake.c - a limit on how many SSL handshakes do their crypto at once */
+/* Created: Mon Oct 19 13:02:51 PM EDT 2026 malakai */
+/* $Id: handshake.c,v 1.1 2026/10/19 17:02:51 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* A burst of new TLS connections means a burst of private key math all at
+ * once, and that eats the CPU that the running sessions need to keep their
+ * players' traffic moving.  So the crypto part of SSL_accept()
+ * gets a limited number of slots, shared by all of the sessions.  Waiting on
+ * the client doesn't hold a slot, only the SSL_accept() calls do. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <openssl/ssl.h>
+#include <glib.h>
+
+#include "debug.h"
+#include "muditm.h"
+#include "handshake.h"
+
+/* ---- local #defines ---- */
+
+/* ---- structs and typedefs ---- */
+
+/* ---- local variable declarations ---- */
+struct handshake_data *handshake = NULL;
+
+/* ---- local function declarations ---- */
+long int handshake_usec(struct timespec *since);
+void handshake_record(long int *hist, long int usec);
+int handshake_take(long int ms);
+void handshake_give(int slot);
+
+/* ---- code starts here ---- */
+
+/* Called once in the parent, before any forking.  0 if there's no limit. */
+int handshake_init(GKeyFile *gkf) {
+
+	int workers;
+	size_t len;
+
+	workers = get_conf_int(gkf,"ssl","handshake-workers",sysconf(_SC_NPROCESSORS_ONLN));
+	if(workers <= 0) {
+		return(0);
+	}
+
+	len = sizeof(struct handshake_data) + workers * sizeof(pid_t);
+	handshake = (struct handshake_data *)mmap(NULL,len,
+		PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0
+	);
+	if(handshake == MAP_FAILED) {
+		muditm_log("Couldn't map the handshake limiter: %s",strerror(errno));
+		handshake = NULL;
+		return(0);
+	}
+	memset(handshake,0,len);
+
+	if(sem_init(&(handshake->slots),1,workers) == -1) {
+		muditm_log("Couldn't set up %d handshake slots: %s",workers,strerror(errno));
+		munmap(handshake,len);
+		handshake = NULL;
+		return(0);
+	}
+	handshake->workers = workers;
+	handshake->timeout = get_conf_int(gkf,"ssl","handshake-timeout",30);
+
+	muditm_log("%d SSL handshakes at once, %ds to finish.",
+		handshake->workers,handshake->timeout
+	);
+	return(1);
+}
+
+long int handshake_usec(struct timespec *since) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return( (now.tv_sec - since->tv_sec) * 1000000L +
+		(now.tv_nsec - since->tv_nsec) / 1000L
+	);
+}
+
+void handshake_record(long int *hist, long int usec) {
+	int b = 0;
+	while( (usec > 1) && (b < HANDSHAKE_BUCKETS-1) ) {
+		usec >>= 1;
+		b++;
+	}
+	__atomic_add_fetch(&(hist[b]),1,__ATOMIC_RELAXED);
+}
+
+/* wait up to ms for a free slot and put our name on it.  -1 if none came
+ * free in time. */
+int handshake_take(long int ms) {
+
+	pid_t none, me = getpid();
+	struct timespec deadline;
+	int slot, ret;
+
+	/* sem_timedwait() only goes by the wall clock. */
+	clock_gettime(CLOCK_REALTIME,&deadline);
+	deadline.tv_sec += ms / 1000L;
+	deadline.tv_nsec += (ms % 1000L) * 1000000L;
+	if(deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	while( ((ret = sem_timedwait(&(handshake->slots),&deadline)) == -1) &&
+		(errno == EINTR)
+	);
+	if(ret == -1) {
+		return(-1);
+	}
+
+	/* the semaphore says one of these is free. */
+	while(1) {
+		for(slot=0; slot<handshake->workers; slot++) {
+			none = 0;
+			if(__atomic_compare_exchange_n(&(handshake->holder[slot]),&none,me,
+				0,__ATOMIC_ACQUIRE,__ATOMIC_RELAXED)) {
+				return(slot);
+			}
+		}
+	}
+}
+
+void handshake_give(int slot) {
+	__atomic_store_n(&(handshake->holder[slot]),0,__ATOMIC_RELEASE);
+	sem_post(&(handshake->slots));
+}
+
+/* The parent calls this for every session that exits.  Only atomics and
+ * sem_post(), since it runs in the SIGCHLD handler. */
+void handshake_reap(pid_t pid) {
+
+	pid_t held;
+	int slot;
+
+	if(!handshake) {
+		return;
+	}
+	for(slot=0; slot<handshake->workers; slot++) {
+		held = pid;
+		if(__atomic_compare_exchange_n(&(handshake->holder[slot]),&held,0,
+			0,__ATOMIC_RELEASE,__ATOMIC_RELAXED)) {
+			__atomic_add_fetch(&(handshake->failed),1,__ATOMIC_RELAXED);
+			sem_post(&(handshake->slots));
+		}
+	}
+}
+
+/* SSL_accept(), but only holding a slot while OpenSSL is actually working.
+ * Returns what SSL_accept() would have. */
+int handshake_accept(SSL *ssl, int sock) {
+
+	struct timespec start, queued;
+	struct pollfd pfd;
+	long int left, w;
+	int flags, ret, err, slot, timedout = 0;
+
+	if(!handshake) {
+		return(SSL_accept(ssl));
+	}
+
+	clock_gettime(CLOCK_MONOTONIC,&start);
+	flags = fcntl(sock,F_GETFL);
+	fcntl(sock,F_SETFL,flags|O_NONBLOCK);
+
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+
+	while(1) {
+
+		/* wait for the client without holding anything. */
+		left = handshake->timeout * 1000L - handshake_usec(&start) / 1000L;
+		if(left <= 0) {
+			ret = 0;
+			break;
+		}
+		ret = poll(&pfd,1,left);
+		if(ret == 0) {
+			break;
+		}
+		if( (ret < 0) && (errno != EINTR) ) {
+			ret = -1;
+			break;
+		}
+
+		/* get in line for a slot. */
+		clock_gettime(CLOCK_MONOTONIC,&queued);
+		w = __atomic_add_fetch(&(handshake->waiting),1,__ATOMIC_RELAXED);
+		if(w > __atomic_load_n(&(handshake->peak_waiting),__ATOMIC_RELAXED)) {
+			__atomic_store_n(&(handshake->peak_waiting),w,__ATOMIC_RELAXED);
+		}
+		left = handshake->timeout * 1000L - handshake_usec(&start) / 1000L;
+		slot = handshake_take(MAX(left,0));
+		__atomic_sub_fetch(&(handshake->waiting),1,__ATOMIC_RELAXED);
+		handshake_record(handshake->wait,handshake_usec(&queued));
+		if(slot == -1) {
+			/* ran out of time in line. */
+			ret = 0;
+			timedout = 1;
+			break;
+		}
+
+		ret = SSL_accept(ssl);
+		err = SSL_get_error(ssl,ret);
+
+		handshake_give(slot);
+
+		if(ret == 1) {
+			break;
+		}
+		if(err == SSL_ERROR_WANT_READ) {
+			pfd.events = POLLIN;
+		} else if(err == SSL_ERROR_WANT_WRITE) {
+			pfd.events = POLLOUT;
+		} else {
+			break;
+		}
+	}
+
+	fcntl(sock,F_SETFL,flags);
+
+	if(ret == 1) {
+		w = handshake_usec(&start);
+		__atomic_add_fetch(&(handshake->completed),1,__ATOMIC_RELAXED);
+		__atomic_add_fetch(&(handshake->latency_usec),w,__ATOMIC_RELAXED);
+		handshake_record(handshake->latency,w);
+	} else if( (ret == 0) &&
+		(timedout || (handshake_usec(&start) >= handshake->timeout * 1000000L))
+	) {
+		muditm_log("SSL handshake took too long.");
+		__atomic_add_fetch(&(handshake->timeouts),1,__ATOMIC_RELAXED);
+		ret = -1;
+	} else {
+		__atomic_add_fetch(&(handshake->failed),1,__ATOMIC_RELAXED);
+	}
+	return(ret);
+}
+
+/* the upper edge of the bucket that the p'th fraction of samples fall
+ * under, in microseconds.  0 if there's nothing yet. */
+long int handshake_percentile(long int *hist, double p) {
+
+	long int total = 0, seen = 0;
+	int b;
+
+	for(b=0; b<HANDSHAKE_BUCKETS; b++) {
+		total += __atomic_load_n(&(hist[b]),__ATOMIC_RELAXED);
+	}
+	if(total == 0) {
+		return(0);
+	}
+	for(b=0; b<HANDSHAKE_BUCKETS; b++) {
+		seen += __atomic_load_n(&(hist[b]),__ATOMIC_RELAXED);
+		if(seen >= p * total) {
+			break;
+		}
+	}
+	return(2L << b);
+}
+
+int handshake_printstats(char *buf, size_t len) {
+
+	if(!handshake) {
+		return(snprintf(buf,len,"no SSL handshake limit"));
+	}
+
+	return(snprintf(buf,len,
+		"SSL handshakes %ld done, %ld failed, %ld timed out, %ld waiting (peak %ld), "
+		"latency p50 %.1fms p90 %.1fms p99 %.1fms, wait p50 %.1fms p99 %.1fms",
+		__atomic_load_n(&(handshake->completed),__ATOMIC_RELAXED),
+		__atomic_load_n(&(handshake->failed),__ATOMIC_RELAXED),
+		__atomic_load_n(&(handshake->timeouts),__ATOMIC_RELAXED),
+		__atomic_load_n(&(handshake->waiting),__ATOMIC_RELAXED),
+		__atomic_load_n(&(handshake->peak_waiting),__ATOMIC_RELAXED),
+		handshake_percentile(handshake->latency,0.50) / 1000.0,
+		handshake_percentile(handshake->latency,0.90) / 1000.0,
+		handshake_percentile(handshake->latency,0.99) / 1000.0,
+		handshake_percentile(handshake->wait,0.50) / 1000.0,
+		handshake_percentile(handshake->wait,0.99) / 1000.0
+	));
+}
@@ -0,0 +1,66 @@
+/* handshake.h - a limit on how many SSL handshakes do their crypto at once */
+/* Created: Mon Oct 19 13:02:51 PM EDT 2026 malakai */
+/* $Id: handshake.h,v 1.1 2026/10/19 17:02:51 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUDITM_HANDSHAKE_H
+#define MUDITM_HANDSHAKE_H
+
+#include <semaphore.h>
+#include <sys/types.h>
+#include <openssl/ssl.h>
+
+/* global #defines */
+#define HANDSHAKE_BUCKETS 32	/* log2 microseconds, up to about an hour */
+
+/* structs and typedefs */
+
+/* In a shared mapping made by the parent, so the limit and the numbers
+ * cover every session. */
+struct handshake_data {
+	sem_t slots;		/* one per handshake allowed to run at once */
+	int workers;
+	int timeout;		/* seconds a client gets to finish */
+
+	long int waiting;	/* handshakes queued for a slot right now */
+	long int peak_waiting;
+	long int completed;
+	long int failed;
+	long int timeouts;
+
+	long int latency[HANDSHAKE_BUCKETS];	/* start to finish */
+	long int latency_usec;			/* all of them added up */
+	long int wait[HANDSHAKE_BUCKETS];	/* time queued for a slot */
+
+	pid_t holder[];		/* who has each slot, so the parent can take
+				   back the ones a dead session was holding */
+};
+
+/* exported global variable declarations */
+extern struct handshake_data *handshake;
+
+/* exported function declarations */
+int handshake_init(GKeyFile *gkf);
+int handshake_accept(SSL *ssl, int sock);
+void handshake_reap(pid_t pid);
+long int handshake_percentile(long int *hist, double p);
+int handshake_printstats(char *buf, size_t len);
+
+#endif /* MUDITM_HANDSHAKE_H */
@@ -0,0 +1,162 @@
+/* histogram.c - log-linear histograms, for latencies */
+/* Created: Mon Oct 19 14:22:47 PM EDT 2026 malakai */
+/* $Id: histogram.c,v 1.1 2026/10/19 18:22:47 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "histogram.h"
+
+/* ---- local #defines ---- */
+
+/* ---- structs and typedefs ---- */
+
+/* ---- local variable declarations ---- */
+
+/* ---- local function declarations ---- */
+int hist_index(long int value);
+long int hist_high(int index);
+
+/* ---- code starts here ---- */
+
+void hist_init(Histogram *h) {
+	memset(h,0,sizeof(Histogram));
+}
+
+/* Below 2*HIST_HALF, every value has its own bucket.  Above that, a power
+ * of two is cut into HIST_HALF steps. */
+int hist_index(long int value) {
+
+	int msb, mag;
+
+	if(value < 2*HIST_HALF) {
+		return( (value < 0)?0:value );
+	}
+	msb = 63 - __builtin_clzl(value);
+	if(msb >= HIST_MAX_BITS) {
+		return(HIST_BUCKETS-1);
+	}
+	mag = msb - (HIST_SUB_BITS-1);
+	return( (mag * HIST_HALF) + (value >> mag) );
+}
+
+/* the biggest value that lands in index. */
+long int hist_high(int index) {
+
+	int mag;
+
+	if(index < 2*HIST_HALF) {
+		return(index);
+	}
+	mag = (index / HIST_HALF) - 1;
+	return( (((long int)(index - (mag * HIST_HALF)) + 1) << mag) - 1 );
+}
+
+void hist_record(Histogram *h, long int value) {
+	h->bucket[hist_index(value)]++;
+	h->count++;
+	h->sum += value;
+	if(value > h->max) {
+		h->max = value;
+	}
+}
+
+/* record the ns since start, and return it. */
+long int hist_since(Histogram *h, struct timespec *start) {
+
+	struct timespec now;
+	long int ns;
+
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	ns = (now.tv_sec - start->tv_sec) * 1000000000L + (now.tv_nsec - start->tv_nsec);
+	hist_record(h,ns);
+	return(ns);
+}
+
+void hist_add(Histogram *to, Histogram *from) {
+
+	int i;
+
+	for(i=0; i<HIST_BUCKETS; i++) {
+		to->bucket[i] += from->bucket[i];
+	}
+	to->count += from->count;
+	to->sum += from->sum;
+	if(from->max > to->max) {
+		to->max = from->max;
+	}
+}
+
+/* hist_add() into a histogram that other processes are adding to, or that
+ * a signal handler might be. */
+void hist_add_atomic(Histogram *to, Histogram *from) {
+
+	long int max;
+	int i;
+
+	for(i=0; i<HIST_BUCKETS; i++) {
+		if(from->bucket[i]) {
+			__atomic_add_fetch(&(to->bucket[i]),from->bucket[i],__ATOMIC_RELAXED);
+		}
+	}
+	__atomic_add_fetch(&(to->count),from->count,__ATOMIC_RELAXED);
+	__atomic_add_fetch(&(to->sum),from->sum,__ATOMIC_RELAXED);
+	max = __atomic_load_n(&(to->max),__ATOMIC_RELAXED);
+	while( (from->max > max) &&
+		!__atomic_compare_exchange_n(&(to->max),&max,from->max,
+			0,__ATOMIC_RELAXED,__ATOMIC_RELAXED)
+	);
+}
+
+/* the value that the p'th fraction of samples are at or under.  0 if there
+ * aren't any samples. */
+long int hist_percentile(Histogram *h, double p) {
+
+	long int seen = 0, want, high;
+	int i;
+
+	if(h->count == 0) {
+		return(0);
+	}
+	/* the rank, rounded up. */
+	want = (long int)(p * h->count);
+	if( (want < p * h->count) || (want < 1) ) want++;
+
+	for(i=0; i<HIST_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if(seen >= want) {
+			break;
+		}
+	}
+	high = hist_high(i);
+	return( (high > h->max)?h->max:high );
+}
+
+int hist_printstats(char *buf, size_t len, Histogram *h) {
+	return(snprintf(buf,len,"%ld samples, p50 %.1fus p99 %.1fus p999 %.1fus max %.1fus",
+		h->count,
+		hist_percentile(h,0.50) / 1000.0,
+		hist_percentile(h,0.99) / 1000.0,
+		hist_percentile(h,0.999) / 1000.0,
+		h->max / 1000.0
+	));
+}
@@ -0,0 +1,60 @@
+/* histogram.h - log-linear histograms, for latencies */
+/* Created: Mon Oct 19 14:22:47 PM EDT 2026 malakai */
+/* $Id: histogram.h,v 1.1 2026/10/19 18:22:47 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUDITM_HISTOGRAM_H
+#define MUDITM_HISTOGRAM_H
+
+#include <stddef.h>
+#include <time.h>
+
+/* global #defines */
+
+/* Each power of two gets HIST_SUB_BITS worth of linear steps, so any value
+ * is known to within about 6%, from 1ns up to 2^HIST_MAX_BITS ns (18
+ * minutes).  Like HdrHistogram, but smaller and dumber. */
+#define HIST_SUB_BITS 5
+#define HIST_HALF (1<<(HIST_SUB_BITS-1))
+#define HIST_MAX_BITS 40
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 2) * HIST_HALF)
+
+/* structs and typedefs */
+struct histogram_data {
+	long int count;
+	long int sum;
+	long int max;
+	long int bucket[HIST_BUCKETS];
+};
+
+typedef struct histogram_data Histogram;
+
+/* exported global variable declarations */
+
+/* exported function declarations */
+void hist_init(Histogram *h);
+void hist_record(Histogram *h, long int value);
+long int hist_since(Histogram *h, struct timespec *start);
+void hist_add(Histogram *to, Histogram *from);
+void hist_add_atomic(Histogram *to, Histogram *from);
+long int hist_percentile(Histogram *h, double p);
+int hist_printstats(char *buf, size_t len, Histogram *h);
+
+#endif /* MUDITM_HISTOGRAM_H */
@@ -25,6 +25,7 @@
 #include <string.h>
 
 #include "iobuf.h"
+#include "counters.h"
 
 /* global #defines */
 
@@ -79,6 +80,7 @@ char *pop_iobuf(Iobuf *iob,size_t len) {
 		return(iob->tail);
 	}
 	
+	counters.moved += (iob->tail - (iob->head+len));
 	memmove(iob->head,iob->head+len,(iob->tail - (iob->head+len)));
 	iob->tail = iob->head + (iob->tail - (iob->head + len));
 
@@ -41,6 +41,7 @@
 struct iostat_data *iostat_new(void) {
 	struct iostat_data *new;
 	new = (struct iostat_data *)malloc(sizeof(struct iostat_data));
+	new->shared = NULL;
 	iostat_init(new);
 	return(new);
 }
@@ -62,12 +63,31 @@ void iostat_init(struct iostat_data *ios) {
 	iostat_counter_init(&(ios->lifetime));
 	iostat_counter_init(&(ios->checkpoint));
 	iostat_counter_init(&(ios->rate));
+	iostat_share(ios,ios->shared);
 }
 
 void iostat_incr(struct iostat_data *ios,int in, int out) {
 	if(!ios) return;
 	ios->lifetime.in += MAX(0,in);
 	ios->lifetime.out += MAX(0,out);
+	if(ios->shared) {
+		/* nobody else writes it, so a plain store will do, as long as
+		 * a reader can't catch it half written. */
+		__atomic_store_n(&(ios->shared->in),ios->lifetime.in,__ATOMIC_RELAXED);
+		__atomic_store_n(&(ios->shared->out),ios->lifetime.out,__ATOMIC_RELAXED);
+	}
+}
+
+/* keep a copy of the lifetime counts somewhere another process can read
+ * them, like a shared memory stats slot.  NULL stops it. */
+void iostat_share(struct iostat_data *ios, struct iostat_counter *shared) {
+	if(!ios) return;
+	ios->shared = shared;
+	if(shared) {
+		shared->ts = ios->lifetime.ts;
+		__atomic_store_n(&(shared->in),ios->lifetime.in,__ATOMIC_RELAXED);
+		__atomic_store_n(&(shared->out),ios->lifetime.out,__ATOMIC_RELAXED);
+	}
 }
 
 /* call this every X seconds to generate a weighted rate.  (weight = 1.0) means
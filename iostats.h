@@ -37,6 +37,7 @@ struct iostat_data {
 	struct iostat_counter lifetime;
 	struct iostat_counter checkpoint;
 	struct iostat_counter rate;
+	struct iostat_counter *shared;	/* kept equal to lifetime, if set */
 };
 
 /* exported global variable declarations */
@@ -46,6 +47,7 @@ struct iostat_data *iostat_new(void);
 void iostat_free(struct iostat_data *ios);
 void iostat_init(struct iostat_data *ios);
 void iostat_incr(struct iostat_data *ios,int in, int out);
+void iostat_share(struct iostat_data *ios, struct iostat_counter *shared);
 int iostat_printraw(char *buf, size_t len, struct iostat_data *ios);
 int iostat_printhuman(char *buf, size_t len, struct iostat_data *ios);
 int iostat_printhrate(char *buf, size_t len, struct iostat_data *ios);
@@ -0,0 +1,864 @@
+/* loadgen.c - load generator, a fake MUD and its players, through muditm */
+/* Created: Mon Oct 19 18:44:09 PM EDT 2026 malakai */
+/* $Id: loadgen.c,v 1.1 2026/10/19 22:44:09 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Starts a stand-in MUD server and a real muditm in front of it, then
+ * connects a crowd of simulated players through the proxy.  The MUD asks
+ * for NEW-ENVIRON, offers MCCP2, and sends output in one of a few patterns
+ * at a steady rate, or as fast as it can.  Each player sends commands at a
+ * steady rate, and times how long the MUD's answer takes to come back.
+ *
+ * That gets done for every combination of client security (none, SSL) and
+ * compression (off, on) asked for, each with its own muditm using a config
+ * made from the given one.  One tab separated line per combination: what
+ * the players got per second, the proxy's CPU time per MB, and the command
+ * round trip percentiles.
+ *
+ * 	mudload [-m muditm] [-c configfile] [-n players] [-t seconds]
+ * 		[-r commands/s] [-l lines/s] [-o spam|room] [-p port]
+ * 		[-s none|ssl|both] [-z off|on|both] [-x off|on|both]
+ * 		[-L logfile]
+ *
+ * -l 0 is as fast as the MUD can go.  The MUD listens on port+1.  SSL
+ * needs the [ssl] cert and key from the config file.  -x on runs muditm in
+ * its low latency setup, sessions pinned to all of the CPUs with
+ * cpu-steering, and busy-poll.
+ */
+
+#include <arpa/inet.h>
+#include <arpa/telnet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <glib.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "histogram.h"
+
+/* ---- local #defines ---- */
+#ifndef TELOPT_MCCP2
+#define TELOPT_MCCP2 86
+#endif
+
+#define LOAD_INFLIGHT 1024	/* commands a player can have unanswered */
+#define LOAD_LINE_MAX 256
+#define LOAD_BUF (64*1024)
+#define LOAD_OUT_MAX (1024*1024)	/* the MUD's unsent output, per player */
+#define LOAD_FLOOD_CHUNK (16*1024)
+#define LOAD_BUSY_POLL 50	/* usec, for -x on */
+
+#define LOAD_SPAM 0
+#define LOAD_ROOM 1
+
+/* ---- structs and typedefs ---- */
+
+struct load_opts {
+	char *muditm;
+	char *conf;
+	char *log;
+	int players;
+	int seconds;
+	int port;
+	double cmd_rate;	/* per player */
+	double line_rate;	/* per player, 0 for flat out */
+	int pattern;
+};
+
+/* just enough telnet to get by on both ends. */
+struct load_telnet {
+	int state;
+	int verb;
+	int sbopt;
+	char line[LOAD_LINE_MAX];
+	int linelen;
+};
+
+#define TN_DATA 0
+#define TN_IAC 1
+#define TN_VERB 2
+#define TN_SB 3
+#define TN_SBDATA 4
+#define TN_SBIAC 5
+
+/* one simulated player. */
+struct load_player {
+	pthread_t thread;
+	struct load_opts *o;
+	SSL_CTX *ctx;
+	int compress;
+	int sock;
+	SSL *ssl;
+	z_stream *z;		/* once the proxy starts MCCP2 */
+	struct load_telnet tn;
+	long int wire;		/* bytes off the socket */
+	long int plain;		/* bytes after inflate */
+	long int lines;
+	long int sent;
+	long int replies;
+	int failed;
+	long int seq;
+	struct timespec sent_at[LOAD_INFLIGHT];
+	Histogram rtt;
+};
+
+/* the MUD's end of one player. */
+struct load_mud {
+	struct load_opts *o;
+	int sock;
+	z_stream *z;
+	struct load_telnet tn;
+	char *out;
+	size_t outlen;
+	long int linecount;
+	long int dropped;
+};
+
+/* ---- local variable declarations ---- */
+static char *load_pattern_name[] = { "spam", "room" };
+
+/* ---- local function declarations ---- */
+size_t load_telnet(struct load_telnet *t, unsigned char *buf, size_t len,
+	void (*option)(void *, int, int), int (*sb)(void *, int),
+	void (*line)(void *, char *, int), void *ctx);
+
+/* ---- code starts here ---- */
+
+double load_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return(ts.tv_sec + ts.tv_nsec / 1000000000.0);
+}
+
+/* Runs buf through the telnet state machine, calling option for each
+ * WILL/WONT/DO/DONT, sb at the end of a subnegotiation, and line for each
+ * line of text.  If sb returns non-zero, stops right there, since whatever
+ * comes next is compressed.  Returns how much of buf it used. */
+size_t load_telnet(struct load_telnet *t, unsigned char *buf, size_t len,
+	void (*option)(void *, int, int), int (*sb)(void *, int),
+	void (*line)(void *, char *, int), void *ctx
+) {
+
+	size_t i;
+	unsigned char c;
+
+	for(i=0; i<len; i++) {
+		c = buf[i];
+		switch(t->state) {
+			case TN_DATA:
+				if(c == IAC) {
+					t->state = TN_IAC;
+				} else if(c == '\n') {
+					line(ctx,t->line,t->linelen);
+					t->linelen = 0;
+				} else if(t->linelen < LOAD_LINE_MAX-1) {
+					t->line[t->linelen++] = c;
+				}
+				break;
+			case TN_IAC:
+				if( (c == WILL) || (c == WONT) || (c == DO) || (c == DONT) ) {
+					t->verb = c;
+					t->state = TN_VERB;
+				} else if(c == SB) {
+					t->state = TN_SB;
+				} else {
+					t->state = TN_DATA;
+				}
+				break;
+			case TN_VERB:
+				option(ctx,t->verb,c);
+				t->state = TN_DATA;
+				break;
+			case TN_SB:
+				t->sbopt = c;
+				t->state = TN_SBDATA;
+				break;
+			case TN_SBDATA:
+				if(c == IAC) t->state = TN_SBIAC;
+				break;
+			case TN_SBIAC:
+				if(c == SE) {
+					t->state = TN_DATA;
+					if(sb(ctx,t->sbopt)) {
+						return(i+1);
+					}
+				} else {
+					t->state = TN_SBDATA;
+				}
+				break;
+		}
+	}
+	return(len);
+}
+
+/* ---- the MUD ---- */
+
+/* queue up output for the player, compressed if it's on.  It goes out as
+ * the socket takes it. */
+void load_mud_send(struct load_mud *m, char *buf, size_t len) {
+
+	size_t room = LOAD_OUT_MAX - m->outlen;
+
+	if(m->z) {
+		m->z->next_in = (unsigned char *)buf;
+		m->z->avail_in = len;
+		m->z->next_out = (unsigned char *)(m->out + m->outlen);
+		m->z->avail_out = room;
+		deflate(m->z,Z_SYNC_FLUSH);
+		if(m->z->avail_in) {
+			m->dropped++;
+		}
+		m->outlen = LOAD_OUT_MAX - m->z->avail_out;
+		return;
+	}
+	if(len > room) {
+		m->dropped++;
+		len = room;
+	}
+	memcpy(m->out + m->outlen,buf,len);
+	m->outlen += len;
+}
+
+void load_mud_option(void *ctx, int verb, int opt) {
+
+	struct load_mud *m = (struct load_mud *)ctx;
+	char start[] = { IAC, SB, TELOPT_MCCP2, IAC, SE };
+
+	if( (verb == DO) && (opt == TELOPT_MCCP2) && !m->z ) {
+		load_mud_send(m,start,sizeof(start));
+		m->z = (z_stream *)calloc(1,sizeof(z_stream));
+		deflateInit(m->z,Z_DEFAULT_COMPRESSION);
+	}
+}
+
+int load_mud_sb(void *ctx, int opt) {
+	/* the proxy's NEW-ENVIRON answer.  Nothing to do with it. */
+	return(0);
+}
+
+void load_mud_line(void *ctx, char *line, int len) {
+
+	struct load_mud *m = (struct load_mud *)ctx;
+	char reply[LOAD_LINE_MAX+32];
+	int n;
+
+	if(len && line[len-1] == '\r') len--;
+	n = snprintf(reply,sizeof(reply),"You said: %.*s\r\n> ",len,line);
+	load_mud_send(m,reply,n);
+}
+
+/* make up count lines of game output. */
+void load_mud_output(struct load_mud *m, long int count) {
+
+	static char *monsters[] = { "orc", "goblin", "troll", "kobold", "dragon" };
+	static char *room =
+		"\033[1;36mThe Dusty Crossroads\033[0m\r\n"
+		"   Four roads meet here under a sky the color of old pewter.  A weathered\r\n"
+		"signpost leans to the east, its arms pointing every direction but the one\r\n"
+		"you came from.  Wagon ruts cut deep into the mud, and somewhere to the north\r\n"
+		"a dog is barking at nothing in particular.\r\n"
+		"\033[0;33m[Exits: north east south west]\033[0m\r\n"
+		"\033[0;32mA tired merchant leans on his cart here.\033[0m\r\n";
+	char buf[LOAD_FLOOD_CHUNK + 1024];
+	size_t len = 0;
+	long int i;
+
+	for(i=0; i<count; i++) {
+		if(m->o->pattern == LOAD_ROOM) {
+			len += snprintf(buf+len,sizeof(buf)-len,"%s",room);
+		} else {
+			len += snprintf(buf+len,sizeof(buf)-len,
+				"The %s hits you for %ld damage!  You parry the %s's next attack.\r\n",
+				monsters[m->linecount % 5],(m->linecount * 7) % 50,monsters[(m->linecount+1) % 5]
+			);
+		}
+		m->linecount++;
+		if(len > LOAD_FLOOD_CHUNK) {
+			load_mud_send(m,buf,len);
+			len = 0;
+		}
+	}
+	len += snprintf(buf+len,sizeof(buf)-len,"<100hp 50m 80mv> ");
+	load_mud_send(m,buf,len);
+}
+
+/* one player's connection to the MUD, in its own process. */
+void load_mud_session(struct load_opts *o, int sock) {
+
+	struct load_mud m;
+	struct pollfd pfd;
+	unsigned char buf[LOAD_BUF];
+	char hello[] = {
+		IAC, DO, TELOPT_NEW_ENVIRON,
+		IAC, SB, TELOPT_NEW_ENVIRON, TELQUAL_SEND, IAC, SE,
+		IAC, WILL, TELOPT_MCCP2
+	};
+	double start, now;
+	long int due;
+	ssize_t n;
+	int timeout;
+
+	memset(&m,0,sizeof(m));
+	m.o = o;
+	m.sock = sock;
+	m.out = (char *)malloc(LOAD_OUT_MAX);
+	fcntl(sock,F_SETFL,O_NONBLOCK);
+
+	load_mud_send(&m,hello,sizeof(hello));
+	start = load_now();
+
+	while(1) {
+		now = load_now();
+		if(o->line_rate > 0) {
+			due = (long int)((now - start) * o->line_rate) - m.linecount;
+			if(due > 0) load_mud_output(&m,due);
+			timeout = (int)(1000.0 / o->line_rate) + 1;
+		} else {
+			if(m.outlen < LOAD_FLOOD_CHUNK) {
+				load_mud_output(&m,o->pattern == LOAD_ROOM?32:200);
+			}
+			timeout = 100;
+		}
+
+		pfd.fd = sock;
+		pfd.events = POLLIN | (m.outlen?POLLOUT:0);
+		if( (poll(&pfd,1,timeout) < 0) && (errno != EINTR) ) break;
+
+		if(pfd.revents & POLLOUT) {
+			n = write(sock,m.out,m.outlen);
+			if(n > 0) {
+				memmove(m.out,m.out+n,m.outlen-n);
+				m.outlen -= n;
+			}
+		}
+		if(pfd.revents & (POLLIN|POLLHUP|POLLERR)) {
+			n = read(sock,buf,sizeof(buf));
+			if(n == 0 || (n < 0 && errno != EAGAIN)) break;
+			if(n > 0) {
+				load_telnet(&(m.tn),buf,n,load_mud_option,load_mud_sb,load_mud_line,&m);
+			}
+		}
+	}
+	_exit(0);
+}
+
+/* The MUD.  Forks for each player, like muditm does. */
+pid_t load_mud_start(struct load_opts *o) {
+
+	struct sockaddr_in6 sa;
+	int ls, sock, one = 1;
+	pid_t pid;
+
+	memset(&sa,0,sizeof(sa));
+	sa.sin6_family = AF_INET6;
+	sa.sin6_addr = in6addr_loopback;
+	sa.sin6_port = htons(o->port+1);
+
+	if( ((ls = socket(AF_INET6,SOCK_STREAM,0)) < 0) ||
+		(setsockopt(ls,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one)) < 0) ||
+		(bind(ls,(struct sockaddr *)&sa,sizeof(sa)) < 0) ||
+		(listen(ls,128) < 0)
+	) {
+		perror("mud listen");
+		return(-1);
+	}
+
+	if((pid = fork()) != 0) {
+		close(ls);
+		return(pid);
+	}
+
+	signal(SIGCHLD,SIG_IGN);
+	while(1) {
+		if((sock = accept(ls,NULL,NULL)) < 0) continue;
+		if(fork() == 0) {
+			close(ls);
+			load_mud_session(o,sock);
+		}
+		close(sock);
+	}
+}
+
+/* ---- the players ---- */
+
+ssize_t load_player_write(struct load_player *p, void *buf, size_t len) {
+	if(p->ssl) return(SSL_write(p->ssl,buf,len));
+	return(write(p->sock,buf,len));
+}
+
+void load_player_option(void *ctx, int verb, int opt) {
+
+	struct load_player *p = (struct load_player *)ctx;
+	unsigned char reply[3] = { IAC, 0, opt };
+
+	if(verb == WILL) {
+		reply[1] = (p->compress && opt == TELOPT_MCCP2)?DO:DONT;
+	} else if(verb == DO) {
+		reply[1] = WONT;
+	} else {
+		return;
+	}
+	load_player_write(p,reply,sizeof(reply));
+}
+
+int load_player_sb(void *ctx, int opt) {
+
+	struct load_player *p = (struct load_player *)ctx;
+
+	if(opt == TELOPT_MCCP2 && !p->z) {
+		p->z = (z_stream *)calloc(1,sizeof(z_stream));
+		inflateInit(p->z);
+		return(1);
+	}
+	return(0);
+}
+
+void load_player_line(void *ctx, char *line, int len) {
+
+	struct load_player *p = (struct load_player *)ctx;
+	struct timespec now, *then;
+	char *s;
+	long int seq;
+
+	p->lines++;
+	line[MIN(len,LOAD_LINE_MAX-1)] = '\0';
+	if(!(s = strstr(line,"You said: cmd "))) return;
+
+	seq = atol(s + 14);
+	if( (seq < 0) || (seq >= p->seq) || (p->seq - seq > LOAD_INFLIGHT) ) return;
+	then = &(p->sent_at[seq % LOAD_INFLIGHT]);
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	hist_record(&(p->rtt),(now.tv_sec - then->tv_sec) * 1000000000L + (now.tv_nsec - then->tv_nsec));
+	p->replies++;
+}
+
+/* what came off the socket, inflated if need be, through the telnet
+ * parser. */
+void load_player_input(struct load_player *p, unsigned char *buf, size_t len) {
+
+	unsigned char out[LOAD_BUF];
+	size_t used;
+	int ret;
+
+	while(len > 0) {
+		if(!p->z) {
+			used = load_telnet(&(p->tn),buf,len,load_player_option,load_player_sb,load_player_line,p);
+			p->plain += used;
+			buf += used;
+			len -= used;
+			continue;
+		}
+		p->z->next_in = buf;
+		p->z->avail_in = len;
+		do {
+			p->z->next_out = out;
+			p->z->avail_out = sizeof(out);
+			ret = inflate(p->z,Z_SYNC_FLUSH);
+			used = sizeof(out) - p->z->avail_out;
+			p->plain += used;
+			load_telnet(&(p->tn),out,used,load_player_option,load_player_sb,load_player_line,p);
+		} while( (ret == Z_OK) && (p->z->avail_out == 0) );
+		if(ret == Z_STREAM_END) {
+			buf = p->z->next_in;
+			len = p->z->avail_in;
+			inflateEnd(p->z);
+			free(p->z);
+			p->z = NULL;
+			continue;
+		}
+		if( (ret != Z_OK) && (ret != Z_BUF_ERROR) ) {
+			p->failed = 1;
+		}
+		return;
+	}
+}
+
+void *load_player_run(void *arg) {
+
+	struct load_player *p = (struct load_player *)arg;
+	struct load_opts *o = p->o;
+	struct sockaddr_in6 sa;
+	struct pollfd pfd;
+	unsigned char buf[LOAD_BUF];
+	char cmd[64];
+	double start, end, next, now;
+	ssize_t n;
+	int len, one = 1;
+
+	hist_init(&(p->rtt));
+
+	memset(&sa,0,sizeof(sa));
+	sa.sin6_family = AF_INET6;
+	sa.sin6_addr = in6addr_loopback;
+	sa.sin6_port = htons(o->port);
+	if( ((p->sock = socket(AF_INET6,SOCK_STREAM,0)) < 0) ||
+		(connect(p->sock,(struct sockaddr *)&sa,sizeof(sa)) < 0)
+	) {
+		p->failed = 1;
+		return(NULL);
+	}
+	setsockopt(p->sock,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+
+	if(p->ctx) {
+		p->ssl = SSL_new(p->ctx);
+		SSL_set_fd(p->ssl,p->sock);
+		if(SSL_connect(p->ssl) <= 0) {
+			p->failed = 1;
+			return(NULL);
+		}
+	}
+
+	start = load_now();
+	end = start + o->seconds;
+	/* spread the players' commands out a little. */
+	next = start + (random() % 1000) / (1000.0 * MAX(o->cmd_rate,1.0));
+
+	while( (now = load_now()) < end ) {
+		if( (o->cmd_rate > 0) && (now >= next) ) {
+			clock_gettime(CLOCK_MONOTONIC,&(p->sent_at[p->seq % LOAD_INFLIGHT]));
+			len = snprintf(cmd,sizeof(cmd),"cmd %ld\r\n",p->seq);
+			p->seq++;
+			if(load_player_write(p,cmd,len) != len) {
+				p->failed = 1;
+				break;
+			}
+			p->sent++;
+			next += 1.0 / o->cmd_rate;
+			continue;
+		}
+
+		if(!p->ssl || (SSL_pending(p->ssl) == 0)) {
+			pfd.fd = p->sock;
+			pfd.events = POLLIN;
+			n = (int)(1000 * (MIN(end,(o->cmd_rate > 0)?next:end) - now)) + 1;
+			if(poll(&pfd,1,n) <= 0) continue;
+		}
+		n = p->ssl?SSL_read(p->ssl,buf,sizeof(buf)):read(p->sock,buf,sizeof(buf));
+		if(n <= 0) {
+			p->failed = 1;
+			break;
+		}
+		p->wire += n;
+		load_player_input(p,buf,n);
+	}
+
+	if(p->ssl) {
+		SSL_shutdown(p->ssl);
+		SSL_free(p->ssl);
+	}
+	close(p->sock);
+	if(p->z) {
+		inflateEnd(p->z);
+		free(p->z);
+	}
+	return(NULL);
+}
+
+/* ---- running muditm ---- */
+
+/* the config for one combination, from the given one.  NULL if it can't. */
+char *load_write_conf(struct load_opts *o, int ssl, int compress, int lowlat) {
+
+	GKeyFile *gkf;
+	gchar *data;
+	gsize len;
+	char *filename;
+	char *mode = compress?"enable":"disable";
+	char *cpus;
+	FILE *f;
+
+	gkf = g_key_file_new();
+	if(o->conf) {
+		g_key_file_load_from_file(gkf,o->conf,G_KEY_FILE_KEEP_COMMENTS,NULL);
+	}
+
+	g_key_file_set_boolean(gkf,"muditm","demon",TRUE);
+	g_key_file_set_integer(gkf,"muditm","listen",o->port);
+	g_key_file_set_string(gkf,"muditm","log-file",o->log);
+	g_key_file_set_boolean(gkf,"muditm","stunnelproxy",FALSE);
+	g_key_file_set_integer(gkf,"muditm","admin-port",0);
+	g_key_file_set_string(gkf,"muditm","admin-socket","");
+	g_key_file_set_string(gkf,"muditm","capture-dir","");
+	g_key_file_set_string(gkf,"client","security",ssl?"SSL":"none");
+	g_key_file_set_string(gkf,"client","compression",mode);
+	g_key_file_set_string(gkf,"game","host","::1");
+	g_key_file_set_integer(gkf,"game","service",o->port+1);
+	g_key_file_set_string(gkf,"game","security","none");
+	g_key_file_set_string(gkf,"game","compression",mode);
+	if(lowlat) {
+		cpus = g_strdup_printf("0-%ld",sysconf(_SC_NPROCESSORS_ONLN)-1);
+		g_key_file_set_string(gkf,"muditm","cpus",cpus);
+		g_key_file_set_boolean(gkf,"muditm","cpu-steering",TRUE);
+		g_key_file_set_integer(gkf,"muditm","busy-poll",LOAD_BUSY_POLL);
+		g_free(cpus);
+	}
+
+	filename = g_strdup_printf("/tmp/mudload-%d.conf",getpid());
+	data = g_key_file_to_data(gkf,&len,NULL);
+	if(!(f = fopen(filename,"w")) || (fwrite(data,1,len,f) != len)) {
+		perror(filename);
+		g_free(filename);
+		filename = NULL;
+	}
+	if(f) fclose(f);
+	g_free(data);
+	g_key_file_free(gkf);
+	return(filename);
+}
+
+/* user+system CPU seconds of a process, and of its children that have been
+ * waited for, which for muditm is every session that's over. */
+double load_cpu(pid_t pid) {
+
+	char path[64], buf[1024], *s;
+	unsigned long int ut, st;
+	long int cut, cst;
+	FILE *f;
+
+	snprintf(path,sizeof(path),"/proc/%d/stat",pid);
+	if(!(f = fopen(path,"r"))) return(0);
+	if(!fgets(buf,sizeof(buf),f) || !(s = strrchr(buf,')'))) {
+		fclose(f);
+		return(0);
+	}
+	fclose(f);
+	/* state ppid pgrp session tty tpgid flags minflt cminflt majflt cmajflt
+	 * then utime stime cutime cstime. */
+	if(sscanf(s+2,"%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %ld %ld",
+		&ut,&st,&cut,&cst) != 4) {
+		return(0);
+	}
+	return( (double)(ut + st + cut + cst) / sysconf(_SC_CLK_TCK) );
+}
+
+/* wait for muditm to be listening. */
+int load_wait_port(int port) {
+
+	struct sockaddr_in6 sa;
+	int s, i;
+
+	memset(&sa,0,sizeof(sa));
+	sa.sin6_family = AF_INET6;
+	sa.sin6_addr = in6addr_loopback;
+	sa.sin6_port = htons(port);
+
+	for(i=0; i<100; i++) {
+		s = socket(AF_INET6,SOCK_STREAM,0);
+		if(connect(s,(struct sockaddr *)&sa,sizeof(sa)) == 0) {
+			close(s);
+			return(1);
+		}
+		close(s);
+		usleep(50000);
+	}
+	return(0);
+}
+
+/* one combination, start to finish. */
+int load_run(struct load_opts *o, int ssl, int compress, int lowlat) {
+
+	struct load_player *p;
+	Histogram *rtt;
+	SSL_CTX *ctx = NULL;
+	char *conf;
+	pid_t mud, proxy;
+	double cpu0, cpu1, start, elapsed, mb;
+	long int wire = 0, plain = 0, lines = 0, sent = 0, replies = 0, failed = 0;
+	int i;
+
+	if(!(conf = load_write_conf(o,ssl,compress,lowlat))) {
+		return(0);
+	}
+	if(ssl) {
+		ctx = SSL_CTX_new(TLS_client_method());
+		SSL_CTX_set_verify(ctx,SSL_VERIFY_NONE,NULL);
+	}
+
+	if((mud = load_mud_start(o)) < 0) {
+		return(0);
+	}
+	if((proxy = fork()) == 0) {
+		execl(o->muditm,o->muditm,"-c",conf,(char *)NULL);
+		perror(o->muditm);
+		_exit(EXIT_FAILURE);
+	}
+	if(!load_wait_port(o->port)) {
+		fprintf(stderr,"muditm never started listening, see %s\n",o->log);
+		kill(proxy,SIGTERM);
+		kill(mud,SIGTERM);
+		waitpid(proxy,NULL,0);
+		waitpid(mud,NULL,0);
+		return(0);
+	}
+	/* load_wait_port's own connection is a session too.  Let it finish. */
+	usleep(200000);
+
+	p = (struct load_player *)calloc(o->players,sizeof(struct load_player));
+	cpu0 = load_cpu(proxy);
+	start = load_now();
+	for(i=0; i<o->players; i++) {
+		p[i].o = o;
+		p[i].ctx = ctx;
+		p[i].compress = compress;
+		pthread_create(&(p[i].thread),NULL,load_player_run,&(p[i]));
+	}
+	rtt = (Histogram *)malloc(sizeof(Histogram));
+	hist_init(rtt);
+	for(i=0; i<o->players; i++) {
+		pthread_join(p[i].thread,NULL);
+		wire += p[i].wire;
+		plain += p[i].plain;
+		lines += p[i].lines;
+		sent += p[i].sent;
+		replies += p[i].replies;
+		failed += p[i].failed;
+		hist_add(rtt,&(p[i].rtt));
+	}
+	elapsed = load_now() - start;
+
+	/* give the sessions time to end and be reaped, so their CPU counts. */
+	usleep(500000);
+	cpu1 = load_cpu(proxy);
+
+	kill(proxy,SIGTERM);
+	kill(mud,SIGTERM);
+	waitpid(proxy,NULL,0);
+	waitpid(mud,NULL,0);
+	unlink(conf);
+	g_free(conf);
+	if(ctx) SSL_CTX_free(ctx);
+
+	mb = plain / 1048576.0;
+	printf("%s\t%s\t%s\t%s\t%d\t%.1f\t%.2f\t%.2f\t%.0f\t%ld\t%ld\t%ld\t%.1f\t%.1f\t%.1f\t%.3f\t%.4f\n",
+		ssl?"ssl":"none", compress?"on":"off", lowlat?"on":"off", load_pattern_name[o->pattern],
+		o->players, elapsed,
+		mb / elapsed, wire / 1048576.0 / elapsed, lines / elapsed,
+		sent, replies, failed,
+		hist_percentile(rtt,0.5) / 1000.0,
+		hist_percentile(rtt,0.99) / 1000.0,
+		hist_percentile(rtt,0.999) / 1000.0,
+		cpu1 - cpu0, (mb > 0)?((cpu1 - cpu0) / mb):0.0
+	);
+	fflush(stdout);
+
+	free(rtt);
+	free(p);
+	return(1);
+}
+
+int main(int argc, char **argv) {
+
+	struct load_opts o;
+	int ssl[2] = { 1, 1 };		/* none, ssl */
+	int zip[2] = { 1, 1 };		/* off, on */
+	int low[2] = { 1, 0 };		/* off, on */
+	int opt, s, z, x;
+
+	memset(&o,0,sizeof(o));
+	o.muditm = "./build/muditm";
+	o.conf = "muditm.conf";
+	o.log = "/dev/null";
+	o.players = 20;
+	o.seconds = 10;
+	o.port = 24443;
+	o.cmd_rate = 2;
+	o.line_rate = 20;
+	o.pattern = LOAD_SPAM;
+
+	while( (opt = getopt(argc,argv,"m:c:n:t:r:l:o:p:s:z:x:L:h")) != -1) {
+		switch(opt) {
+			case 'm':
+				o.muditm = optarg;
+				break;
+			case 'c':
+				o.conf = optarg;
+				break;
+			case 'n':
+				o.players = MAX(1,atoi(optarg));
+				break;
+			case 't':
+				o.seconds = MAX(1,atoi(optarg));
+				break;
+			case 'r':
+				o.cmd_rate = MAX(0,atof(optarg));
+				break;
+			case 'l':
+				o.line_rate = MAX(0,atof(optarg));
+				break;
+			case 'o':
+				o.pattern = strcmp(optarg,"room")?LOAD_SPAM:LOAD_ROOM;
+				break;
+			case 'p':
+				o.port = atoi(optarg);
+				break;
+			case 's':
+				ssl[0] = strcmp(optarg,"ssl")?1:0;
+				ssl[1] = strcmp(optarg,"none")?1:0;
+				break;
+			case 'z':
+				zip[0] = strcmp(optarg,"on")?1:0;
+				zip[1] = strcmp(optarg,"off")?1:0;
+				break;
+			case 'x':
+				low[0] = strcmp(optarg,"on")?1:0;
+				low[1] = strcmp(optarg,"off")?1:0;
+				break;
+			case 'L':
+				o.log = optarg;
+				break;
+			case 'h':
+			default:
+				fprintf(stdout,"Usage: %s [-m muditm] [-c configfile] [-n players] [-t seconds]\n"
+					"\t[-r commands/s] [-l lines/s] [-o spam|room] [-p port]\n"
+					"\t[-s none|ssl|both] [-z off|on|both] [-x off|on|both]\n"
+					"\t[-L logfile]\n",argv[0]);
+				exit(EXIT_SUCCESS);
+		}
+	}
+
+	signal(SIGPIPE,SIG_IGN);
+	printf("security\tcompression\tlowlatency\tpattern\tplayers\tseconds\tplain_MB/s\twire_MB/s\tlines/s\t"
+		"commands\treplies\tfailed\trtt_p50_us\trtt_p99_us\trtt_p999_us\tproxy_cpu_s\tcpu_s/MB\n");
+	for(s=0; s<2; s++) {
+		for(z=0; z<2; z++) {
+			for(x=0; x<2; x++) {
+				if(ssl[s] && zip[z] && low[x]) {
+					load_run(&o,s,z,x);
+				}
+			}
+		}
+	}
+	return(0);
+}
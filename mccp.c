@@ -20,8 +20,10 @@
  * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <linux/sockios.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -33,26 +35,70 @@
 #include <netinet/in.h>
 #include <openssl/err.h>
 #include <openssl/ssl.h>
+#include <time.h>
 #include <zlib.h>
 
 #include "debug.h"
+#include "muditm.h"
 #include "proxy.h"
 #include "handlers.h"
 #include "debug.h"
+#include "zcodec.h"
+#include "counters.h"
+#include "capture.h"
+#include "trace.h"
 
 #include "mccp.h"
 
 /* ---- local #defines ---- */
 
+/* how often the adaptive controller looks at the numbers, in nsec. */
+#define MCCP_TUNE_INTERVAL 1000000000L
+
 /* ---- structs and typedefs ---- */
 
 /* ---- local variable declarations ---- */
+struct {
+	char *name;
+	int strategy;
+} mccp_strategies[] = {
+	{ "default", Z_DEFAULT_STRATEGY },
+	{ "filtered", Z_FILTERED },
+	{ "huffman", Z_HUFFMAN_ONLY },
+	{ "rle", Z_RLE },
+	{ "fixed", Z_FIXED },
+	{ NULL, 0 }
+};
 
 /* ---- local function declarations ---- */
-z_stream *new_zstream(void);
+int mccp2_deflate_start(Endpoint *ep, int announce);
+void mccp2_deflate_end(Endpoint *ep);
+void mccp_tune(Endpoint *ep, Zstream *z);
+int mccp_has_prompt(struct mccp_tune_data *t, char *buf, size_t count);
+void mccp_relay_start(Endpoint *from, Endpoint *to);
+void mccp_relay_stop(Endpoint *from, int restart);
+void mccp_inflate_end(Endpoint *ep);
+ssize_t read_endpoint_relay(Endpoint *ep, void *buf, size_t count);
+ssize_t write_endpoint_relay(Endpoint *ep, void *buf, size_t count);
+int mccp_inflate(Zstream *zstr, int flush);
 
 
 /* ---- code starts here ---- */
+
+/* inflate, with the time it took counted. */
+int mccp_inflate(Zstream *zstr, int flush) {
+
+	struct timespec start, end;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC,&start);
+	ret = inflate_zstream(zstr,flush);
+	clock_gettime(CLOCK_MONOTONIC,&end);
+	counters.inflates++;
+	counters.inflate_nsec += (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+	return(ret);
+}
+
 void add_mccp_game_patterns(Endpoint *ep) {
 
 	muditm_debug("%s config game mccp2 mode %d",ep->name,ep->mccp_mode);
@@ -98,6 +144,14 @@ void add_mccp_game_patterns(Endpoint *ep) {
 			char mccp2_start[] = { IAC, SB, TELOPT_MCCP2, IAC, SE };
 			add_pattern(ep,mccp2_start,sizeof(mccp2_start),mccp2_sb_start);
 
+			/* MUDitM doesn't compress toward the game, and MCCP3 from the
+			 * client ends here, so the game's offers never reach it. */
+			char mccp_trig[] = { IAC, WILL, TELOPT_MCCP };
+			add_pattern(ep,mccp_trig,sizeof(mccp_trig),respond_dont);
+
+			char mccp3_trig[] = { IAC, WILL, TELOPT_MCCP3 };
+			add_pattern(ep,mccp3_trig,sizeof(mccp3_trig),respond_dont);
+
 			return;
 		}
 
@@ -140,6 +194,21 @@ void add_mccp_client_patterns(Endpoint *ep) {
 
 			char mccp2_dontseq[] = { IAC, DONT, TELOPT_MCCP2 };
 			add_pattern(ep,mccp2_dontseq,sizeof(mccp2_dontseq),mccp2_dont);
+
+			char mccp_trig[] = { IAC, DO, TELOPT_MCCP };
+			add_pattern(ep,mccp_trig,sizeof(mccp_trig),respond_wont);
+
+			char mccp3_doseq[] = { IAC, DO, TELOPT_MCCP3 };
+			char mccp3_dontseq[] = { IAC, DONT, TELOPT_MCCP3 };
+			if(ep->mccp_tune && ep->mccp_tune->mccp3) {
+				add_pattern(ep,mccp3_doseq,sizeof(mccp3_doseq),mccp3_do);
+				add_pattern(ep,mccp3_dontseq,sizeof(mccp3_dontseq),mccp3_dont);
+
+				char mccp3_start[] = { IAC, SB, TELOPT_MCCP3, IAC, SE };
+				add_pattern(ep,mccp3_start,sizeof(mccp3_start),mccp3_sb_start);
+			} else {
+				add_pattern(ep,mccp3_doseq,sizeof(mccp3_doseq),respond_wont);
+			}
 			
 			return;
 		}
@@ -147,25 +216,6 @@ void add_mccp_client_patterns(Endpoint *ep) {
 	return;
 }
 
-/* init a new z_stream struct. */
-z_stream *new_zstream(void) {
-
-	z_stream *z;
-
-	z = (z_stream *)malloc(sizeof(z_stream));
-	z->data_type = Z_ASCII;
-	z->zalloc = NULL;
-	z->zfree = NULL;
-	z->opaque = NULL;
-
-	return(z);
-}
-
-void free_zstream(z_stream *z) {
-	free(z);
-	return;
-}
-
 /* set the mccp_mode based on the value from the config file. */
 void configure_compression(Endpoint *ep,char *value) {
 
@@ -179,22 +229,103 @@ void configure_compression(Endpoint *ep,char *value) {
 
 }
 
-/* inject the WILL MCCP2 offer. */
+/* read the deflate settings for one side out of the config file. */
+struct mccp_tune_data *parse_deflate(GKeyFile *gkf,char *group) {
+
+	struct mccp_tune_data *t;
+	char *strategy;
+	int i;
+
+	t = (struct mccp_tune_data *)malloc(sizeof(struct mccp_tune_data));
+	memset(t,0,sizeof(struct mccp_tune_data));
+
+	t->level = get_conf_int(gkf,group,"compression-level",Z_BEST_COMPRESSION);
+	t->window = get_conf_int(gkf,group,"compression-window",MAX_WBITS);
+	t->memlevel = get_conf_int(gkf,group,"compression-memlevel",8);
+	t->adaptive = get_conf_boolean(gkf,group,"compression-adaptive",0);
+	t->minlevel = get_conf_int(gkf,group,"compression-min-level",1);
+	t->maxlevel = get_conf_int(gkf,group,"compression-max-level",Z_BEST_COMPRESSION);
+	t->cpubudget = get_conf_int(gkf,group,"compression-cpu-percent",10) / 100.0;
+	t->backlog = get_conf_int(gkf,group,"compression-backlog",16384);
+
+	t->strategy = Z_DEFAULT_STRATEGY;
+	strategy = get_conf_string(gkf,group,"compression-strategy","default");
+	for(i=0; mccp_strategies[i].name; i++) {
+		if(!strcasecmp(strategy,mccp_strategies[i].name)) {
+			t->strategy = mccp_strategies[i].strategy;
+			break;
+		}
+	}
+	if(!mccp_strategies[i].name) {
+		muditm_log("[%s] unknown compression-strategy '%s', using default.",group,strategy);
+	}
+	free(strategy);
+
+	/* keep everything inside of what zlib and MCCP will put up with. */
+	t->minlevel = CLAMP(t->minlevel,Z_NO_COMPRESSION,Z_BEST_COMPRESSION);
+	t->maxlevel = CLAMP(t->maxlevel,t->minlevel,Z_BEST_COMPRESSION);
+	t->level = CLAMP(t->level,Z_NO_COMPRESSION,Z_BEST_COMPRESSION);
+	if(t->adaptive) {
+		t->level = CLAMP(t->level,t->minlevel,t->maxlevel);
+	}
+	t->window = CLAMP(t->window,9,MAX_WBITS);
+	t->memlevel = CLAMP(t->memlevel,1,MAX_MEM_LEVEL);
+
+	t->flush_ms = get_conf_int(gkf,group,"compression-flush-ms",0);
+	t->flush_bytes = get_conf_int(gkf,group,"compression-flush-bytes",4096);
+
+	t->mccp3 = get_conf_boolean(gkf,group,"compression-mccp3",1);
+
+	return(t);
+}
+
+/* give ep its own copy of the deflate settings, with the controller state
+ * starting fresh. */
+void configure_deflate(Endpoint *ep,struct mccp_tune_data *settings) {
+
+	struct mccp_tune_data *t;
+
+	t = (struct mccp_tune_data *)malloc(sizeof(struct mccp_tune_data));
+	memcpy(t,settings,sizeof(struct mccp_tune_data));
+
+	t->current = t->level;
+	t->lowest = t->level;
+	t->highest = t->level;
+	t->changes = 0;
+	clock_gettime(CLOCK_MONOTONIC,&(t->window_start));
+	t->window_nsec = 0;
+	t->deflate_nsec = 0;
+
+	t->iac = 0;
+	t->unflushed = 0;
+	t->flushes = 0;
+
+	if(ep->mccp_tune) free(ep->mccp_tune);
+	ep->mccp_tune = t;
+}
+
+/* inject the WILL MCCP2 offer, and WILL MCCP3 if that is turned on. */
 void offer_compression(Endpoint *ep) {
 	char mccp2_offer[] = { IAC, WILL, TELOPT_MCCP2 };
+	char mccp3_offer[] = { IAC, WILL, TELOPT_MCCP3 };
 	Iobuf *out = ep->iobuf[EP_OUTPUT];
 
 	muditm_debug("Offering WILL MCCP2 to %s",ep->name);
 	if(ep->mccp_mode == MCCP_ENABLE) {
 		memcpy(tail_iobuf(out),mccp2_offer,sizeof(mccp2_offer));
 		push_iobuf(out,sizeof(mccp2_offer));
+		if(ep->mccp_tune && ep->mccp_tune->mccp3) {
+			muditm_debug("Offering WILL MCCP3 to %s",ep->name);
+			memcpy(tail_iobuf(out),mccp3_offer,sizeof(mccp3_offer));
+			push_iobuf(out,sizeof(mccp3_offer));
+		}
 		flush_endpoint(ep);
 	}
 
 }
 
 /* The stream is no longer TELNET, is it ZLIB.  disable TELNET pattern matching. */
-int mccp_ignore(Iobuf *iob,size_t match_len,Endpoint *from, Endpoint *to,GKeyFile *gkf) {
+int mccp_ignore(Iobuf *iob,size_t match_len,Endpoint *from, Endpoint *to,Config *conf) {
 
 	/* just make a note of if. */
 	muditm_log("%s has entered mccp compression, matching disabled.",from->name);
@@ -202,45 +333,101 @@ int mccp_ignore(Iobuf *iob,size_t match_len,Endpoint *from, Endpoint *to,GKeyFil
 	return(0);
 };
 
-/* A side just requested compression.  Set it up. */
-int mccp2_do(Iobuf *iob,size_t match_len,Endpoint *from, Endpoint *to,GKeyFile *gkf) {
+/* set up a deflate stream on ep's output.  If announce is set, send the
+ * "compressed stream begins now" message first. */
+int mccp2_deflate_start(Endpoint *ep, int announce) {
 
+	struct mccp_tune_data *t;
 	Iobuf *out;
-	z_stream *z;
+	Zstream *z;
 	int ret;
 
-	muditm_log("%s has agreed to mccp2 compression.",from->name);
-	
-	/* Remove that match from the input buffer, we don't want it sent across. */
-	pop_iobuf(iob, match_len);
-
 	/* set up the z_stream */
-	z = new_zstream();
+	z = new_zstream(zcodec_default);
 
 	/* Scandum's implementation uses deflateInit2() with some options, but
-	 * using deflateInit() with the defaults seems to work. */
-	if( (ret = deflateInit(z,Z_BEST_COMPRESSION)) != Z_OK ) {
+	 * using deflateInit() with the defaults seems to work.  These are the
+	 * same defaults, unless the config file says otherwise. */
+	if(ep->mccp_tune) {
+		t = ep->mccp_tune;
+		ret = init_deflate_zstream(z,t->current,t->window,t->memlevel,t->strategy);
+		muditm_debug("%s deflate level %d strategy %d window %d memlevel %d",
+			ep->name,t->current,t->strategy,t->window,t->memlevel
+		);
+	} else {
+		ret = init_deflate_zstream(z,Z_BEST_COMPRESSION,MAX_WBITS,8,Z_DEFAULT_STRATEGY);
+	}
+	if( ret != Z_OK ) {
 		muditm_log("deflateInit failure code %d?",ret);
 		free_zstream(z);
 		return(0);
 	}
 
-	/* send the "compressed stream begins now" message */
-	muditm_debug("Sending start of compression message.");
-	out = (from->iobuf[EP_OUTPUT]);
-	char mccp2_begin[] = { IAC, SB, TELOPT_MCCP2, IAC, SE };
-	memcpy(tail_iobuf(out),mccp2_begin,sizeof(mccp2_begin));
-	push_iobuf(out,sizeof(mccp2_begin));
-	flush_endpoint(from);
+	if(announce) {
+		/* send the "compressed stream begins now" message */
+		muditm_debug("Sending start of compression message.");
+		out = (ep->iobuf[EP_OUTPUT]);
+		char mccp2_begin[] = { IAC, SB, TELOPT_MCCP2, IAC, SE };
+		memcpy(tail_iobuf(out),mccp2_begin,sizeof(mccp2_begin));
+		push_iobuf(out,sizeof(mccp2_begin));
+		flush_endpoint(ep);
+	}
 
 	/* and now really turn it on.*/
-	from->mccp[EP_OUTPUT] = z;
+	ep->mccp[EP_OUTPUT] = z;
+	TRACE2(mccp__start,ep->name,EP_OUTPUT);
+
+	return(1);
+}
+
+/* finish off the deflate stream on ep's output, so that the far side knows
+ * the compressed stream has ended and goes back to plain telnet. */
+void mccp2_deflate_end(Endpoint *ep) {
+
+	Zstream *z;
+	char *workspace;
+	int ret;
+
+	if(!(z = ep->mccp[EP_OUTPUT])) return;
+	ep->mccp[EP_OUTPUT] = NULL;
+	TRACE2(mccp__stop,ep->name,EP_OUTPUT);
+
+	workspace = head_iobuf(ep->ziobuf[EP_OUTPUT]);
+	z->next_in = NULL;
+	z->avail_in = 0;
+	do {
+		z->next_out = (unsigned char *)workspace;
+		z->avail_out = EP_BUFSIZE;
+		ret = deflate_zstream(z,Z_FINISH);
+		if(EP_BUFSIZE - z->avail_out > 0) {
+			write_endpoint_sock(ep,workspace,EP_BUFSIZE - z->avail_out);
+		}
+	} while (ret == Z_OK);
+
+	end_deflate_zstream(z);
+	free_zstream(z);
+}
+
+/* A side just requested compression.  Set it up. */
+int mccp2_do(Iobuf *iob,size_t match_len,Endpoint *from, Endpoint *to,Config *conf) {
+
+	muditm_log("%s has agreed to mccp2 compression.",from->name);
+	
+	/* Remove that match from the input buffer, we don't want it sent across. */
+	pop_iobuf(iob, match_len);
+
+	/* Already compressing?  Then there is nothing to start. */
+	if(from->mccp[EP_OUTPUT] || from->mccp_relay_src) {
+		return(1);
+	}
+
+	mccp2_deflate_start(from,1);
 
 	return(1);
 };
 
 /* A side just requested NO compression.  disable it.*/
-int mccp2_dont(Iobuf *iob,size_t match_len,Endpoint *from, Endpoint *to,GKeyFile *gkf) {
+int mccp2_dont(Iobuf *iob,size_t match_len,Endpoint *from, Endpoint *to,Config *conf) {
 
 	if(from->mccp[EP_OUTPUT]) {
 		muditm_log("%s wants to shut down mccp2 compression.",from->name);
@@ -251,53 +438,450 @@ int mccp2_dont(Iobuf *iob,size_t match_len,Endpoint *from, Endpoint *to,GKeyFile
 	/* Remove that match from the input buffer, we don't want it sent across. */
 	pop_iobuf(iob, match_len);
 
+	/* if the other side's stream is being relayed, end it. */
+	if(from->mccp_relay_src) {
+		mccp_relay_stop(from->mccp_relay_src,0);
+	}
+
 	/* and now really turn it off.*/
 	if(from->mccp[EP_OUTPUT]) {
+		end_deflate_zstream(from->mccp[EP_OUTPUT]);
 		free_zstream(from->mccp[EP_OUTPUT]);
 		from->mccp[EP_OUTPUT] = NULL;
+		TRACE2(mccp__stop,from->name,EP_OUTPUT);
 	}
 
 	return(1);
 }
 
-/* A side just saw the start of compression message.  Set it up. */
-int mccp2_sb_start(Iobuf *iob,size_t match_len,Endpoint *from, Endpoint *to,GKeyFile *gkf) {
+/* set up an inflate stream on ep's input.  Anything left in iob is already
+ * compressed. */
+static int mccp_inflate_start(Iobuf *iob, Endpoint *ep) {
 
-	z_stream *z;
+	Zstream *z;
 	int ret;
+	size_t left, held;
 
-	muditm_log("%s has switched to mccp2 compression.",from->name);
-	
-	/* Remove that match from the input buffer, we don't want it sent across. */
-	pop_iobuf(iob, match_len);
+	if(ep->mccp[EP_INPUT]) {
+		muditm_log("%s started compression twice?",ep->name);
+		return(0);
+	}
+
+	/* the last stream's leftovers have to fit in behind. */
+	left = len_iobuf(iob);
+	held = len_iobuf(ep->ziobuf[EP_INPUT]);
+	if(left + held > EP_BUFSIZE) {
+		muditm_log("%s has too much input to start compression.",ep->name);
+		return(0);
+	}
 
 	/* set up the z_stream */
-	z = new_zstream();
+	z = new_zstream(zcodec_default);
 
-	if( (ret = inflateInit(z)) != Z_OK ) {
+	if( (ret = init_inflate_zstream(z)) != Z_OK ) {
 		muditm_log("inflateInit failure code %d?",ret);
 		free_zstream(z);
 		return(0);
 	}
 
+	/* Anything that came in behind the start message is already compressed,
+	 * so move it over to the inflate side rather than letting it get matched
+	 * as telnet.  So is anything left over from the last stream that wasn't
+	 * read out yet, and it goes in behind. */
+	memmove(head_iobuf(ep->ziobuf[EP_INPUT])+left,head_iobuf(ep->ziobuf[EP_INPUT]),held);
+	memcpy(head_iobuf(ep->ziobuf[EP_INPUT]),head_iobuf(iob),left);
+	popall_iobuf(ep->ziobuf[EP_INPUT]);
+	popall_iobuf(iob);
+	capture_retract(ep,left);
+	left += held;
+
 	/* and now really turn it on.*/
-	z->next_in = (unsigned char *)head_iobuf(from->ziobuf[EP_INPUT]);
-	z->avail_in = 0;
-	from->mccp[EP_INPUT] = z;
+	z->next_in = (unsigned char *)head_iobuf(ep->ziobuf[EP_INPUT]);
+	z->avail_in = left;
+	ep->mccp[EP_INPUT] = z;
+	TRACE2(mccp__start,ep->name,EP_INPUT);
+
+	return(1);
+}
+
+/* A side just saw the start of compression message.  Set it up. */
+int mccp2_sb_start(Iobuf *iob,size_t match_len,Endpoint *from, Endpoint *to,Config *conf) {
+
+	muditm_log("%s has switched to mccp2 compression.",from->name);
+	
+	/* Remove that match from the input buffer, we don't want it sent across. */
+	pop_iobuf(iob, match_len);
+
+	if(!mccp_inflate_start(iob,from)) {
+		return(0);
+	}
+
+	/* If the other side is already taking a compressed stream, it may as
+	 * well take this one as is. */
+	if( to->mccp[EP_OUTPUT] && 
+		conf->passthrough
+	) {
+		mccp_relay_start(from,to);
+	}
+
+	return(1);
+}
+
+/* The client agreed to send compressed.  It follows up with IAC SB MCCP3 IAC
+ * SE when it actually starts. */
+int mccp3_do(Iobuf *iob,size_t match_len,Endpoint *from, Endpoint *to,Config *conf) {
+
+	muditm_log("%s has agreed to mccp3 compression.",from->name);
+	pop_iobuf(iob, match_len);
+	return(1);
+}
+
+/* The client doesn't want to send compressed.  That's fine. */
+int mccp3_dont(Iobuf *iob,size_t match_len,Endpoint *from, Endpoint *to,Config *conf) {
 
+	muditm_log("%s refuses mccp3 compression.",from->name);
+	pop_iobuf(iob, match_len);
 	return(1);
 }
 
+/* The client's stream is compressed from here on.  It gets inflated by
+ * read_endpoint_compressed() just like the game's mccp2 stream, and the game
+ * never finds out. */
+int mccp3_sb_start(Iobuf *iob,size_t match_len,Endpoint *from, Endpoint *to,Config *conf) {
+
+	muditm_log("%s has switched to mccp3 compression.",from->name);
+	pop_iobuf(iob, match_len);
+
+	return(mccp_inflate_start(iob,from));
+}
+
+/* Start passing from's compressed input straight through to the other side. */
+void mccp_relay_start(Endpoint *from, Endpoint *to) {
+
+	struct mccp_relay_data *r;
+	char mccp2_begin[] = { IAC, SB, TELOPT_MCCP2, IAC, SE };
+
+	/* end the stream the other side is getting from us, and tell it a new one
+	 * is coming. */
+	mccp2_deflate_end(to);
+	write_endpoint_sock(to,mccp2_begin,sizeof(mccp2_begin));
+
+	r = (struct mccp_relay_data *)malloc(sizeof(struct mccp_relay_data));
+	r->to = to;
+	r->zbuf = new_iobuf(EP_BUFSIZE);
+	r->zmark = 0;
+	r->zadler = adler32(0L,Z_NULL,0);
+	r->hold = new_iobuf(EP_BUFSIZE);
+	r->hmark = 0;
+	r->plain = 0;
+	r->accepted = new_iobuf(EP_BUFSIZE);
+	r->relayed = 0;
+	r->relayed_adler = r->zadler;
+
+	from->mccp_relay = r;
+	to->mccp_relay_src = from;
+
+	muditm_log("%s is relaying %s's compressed stream.",to->name,from->name);
+}
+
+/* Stop relaying from's compressed stream.  The relayed stream is ended at the
+ * last block that was passed along, and if restart is set, the other side
+ * gets a new stream of our own to carry whatever hasn't been sent yet. */
+void mccp_relay_stop(Endpoint *from, int restart) {
+
+	struct mccp_relay_data *r;
+	Endpoint *to;
+	char mccp2_begin[] = { IAC, SB, TELOPT_MCCP2, IAC, SE };
+
+	if(!(r = from->mccp_relay) || !(to = r->to)) return;
+
+	if( (r->relayed == 0) && !restart ) {
+		/* the other side is still waiting on a stream, give it an empty one. */
+		unsigned char header[] = { 0x78, 0x01 };
+		write_endpoint_sock(to,header,sizeof(header));
+		r->relayed = sizeof(header);
+	}
+
+	if(r->relayed > 0) {
+		/* Everything relayed ends on a byte aligned block, so a final empty
+		 * stored block and the adler32 trailer closes the stream cleanly. */
+		unsigned char trailer[] = { 0x01, 0x00, 0x00, 0xff, 0xff,
+			(r->relayed_adler >> 24) & 0xff, (r->relayed_adler >> 16) & 0xff,
+			(r->relayed_adler >> 8) & 0xff, r->relayed_adler & 0xff
+		};
+		write_endpoint_sock(to,trailer,sizeof(trailer));
+		if(restart) {
+			write_endpoint_sock(to,mccp2_begin,sizeof(mccp2_begin));
+		}
+	}
+	/* If nothing was relayed yet, the other side is still waiting on the
+	 * start of a stream, and our own can simply take its place. */
+
+	to->mccp_relay_src = NULL;
+	r->to = NULL;
+	popall_iobuf(r->zbuf);
+	r->zmark = 0;
+	r->plain = 0;
+
+	muditm_log("%s stopped relaying %s's compressed stream.",to->name,from->name);
+
+	if(restart) {
+		mccp2_deflate_start(to,0);
+	}
+
+	/* text that was let through but never relayed still has to go. */
+	if(len_iobuf(r->accepted) > 0) {
+		if(restart) {
+			write_endpoint_compressed(to,head_iobuf(r->accepted),len_iobuf(r->accepted));
+		} else {
+			write_endpoint_sock(to,head_iobuf(r->accepted),len_iobuf(r->accepted));
+		}
+		popall_iobuf(r->accepted);
+	}
+}
+
+void free_relay(struct mccp_relay_data *r) {
+	if(!r) return;
+	free_iobuf(r->zbuf);
+	free_iobuf(r->hold);
+	free_iobuf(r->accepted);
+	free(r);
+}
+
+/* The sender ended its compressed stream.  What's left of the input is
+ * plain telnet again, so it stays in ziobuf to be read out before anything
+ * else comes off the socket. */
+void mccp_inflate_end(Endpoint *ep) {
+
+	Zstream *zstr = ep->mccp[EP_INPUT];
+
+	muditm_log("%s has ended compression.",ep->name);
+	popall_iobuf(ep->ziobuf[EP_INPUT]);
+	memmove(head_iobuf(ep->ziobuf[EP_INPUT]),zstr->next_in,zstr->avail_in);
+	push_iobuf(ep->ziobuf[EP_INPUT],zstr->avail_in);
+
+	end_inflate_zstream(zstr);
+	free_zstream(zstr);
+	ep->mccp[EP_INPUT] = NULL;
+	TRACE2(mccp__stop,ep->name,EP_INPUT);
+}
+
+/* read_endpoint_compressed() for when the stream is being relayed.  inflate()
+ * is run a block at a time, and only the text up to the last byte aligned
+ * block boundary is handed back, along with the compressed bytes that made
+ * it.  Whatever is past the boundary stays in hold until the block is done. */
+ssize_t read_endpoint_relay(Endpoint *ep, void *buf, size_t count) {
+
+	struct mccp_relay_data *r = ep->mccp_relay;
+	Zstream *zstr = ep->mccp[EP_INPUT];
+	char *workspace;
+	unsigned char *in, *out;
+	ssize_t readsize, finalsize;
+	int ret;
+
+	workspace = head_iobuf(ep->ziobuf[EP_INPUT]);
+
+	/* Marks can keep moving up until some of the marked text has been
+	 * handed back.  After that, the rest of it has to go before the next
+	 * block, so write_endpoint_relay() knows where it ends. */
+	while( (r->to) && ((r->hmark == 0) ||
+		((zstr->avail_in > 0) && (r->plain == 0) && (len_iobuf(r->accepted) == 0)))
+	) {
+
+		if(zstr->avail_in == 0) {
+			/* only read as much as zbuf can keep. */
+			if(avail_iobuf(r->zbuf) == 0) {
+				if(r->hmark > 0) {
+					/* hand back what we've got, and once it's written,
+					 * there's room again. */
+					break;
+				}
+				/* a block too big to keep, give up on relaying. */
+				mccp_relay_stop(ep,1);
+				break;
+			}
+			readsize = read_endpoint_sock(ep,workspace,
+				MIN(EP_BUFSIZE,avail_iobuf(r->zbuf))
+			);
+			if(readsize <= 0) {
+				muditm_debug("%s relay socket_read code %d is errno %d %s",
+					ep->name,readsize,errno,strerror(errno)
+				);
+				return(readsize);
+			}
+			zstr->next_in = (unsigned char *)workspace;
+			zstr->avail_in = readsize;
+		}
+
+		if(avail_iobuf(r->hold) == 0) {
+			if(r->hmark > 0) {
+				/* hand back what we've got, the rest can wait. */
+				break;
+			}
+			/* a block too big to hold, give up on relaying. */
+			mccp_relay_stop(ep,1);
+			break;
+		}
+
+		if(avail_iobuf(r->zbuf) < zstr->avail_in) {
+			/* more compressed input than can be kept, give up on relaying. */
+			mccp_relay_stop(ep,1);
+			break;
+		}
+
+		in = zstr->next_in;
+		out = (unsigned char *)tail_iobuf(r->hold);
+		zstr->next_out = out;
+		zstr->avail_out = avail_iobuf(r->hold);
+
+		ret = mccp_inflate(zstr,Z_BLOCK);
+		if( (ret != Z_OK) && (ret != Z_STREAM_END) ) {
+			muditm_log("%s inflate problem? '%s' code %d",ep->name,zstr->msg,ret);
+			return(-1);
+		}
+
+		memcpy(tail_iobuf(r->zbuf),in,zstr->next_in - in);
+		push_iobuf(r->zbuf,zstr->next_in - in);
+		push_iobuf(r->hold,zstr->next_out - out);
+
+		if(ret == Z_STREAM_END) {
+			/* The relayed stream ends at the last block passed along, and
+			 * the other side gets a stream of ours for the rest of what's
+			 * held, same as if the relay had given up. */
+			mccp_inflate_end(ep);
+			mccp_relay_stop(ep,1);
+			break;
+		}
+
+		/* At the end of a block with no left over bits?  Then the stream
+		 * could be cut off right here. */
+		if( (zstr->data_type & 128) && !(zstr->data_type & 63) ) {
+			r->zmark = len_iobuf(r->zbuf);
+			r->zadler = zstr->adler;
+			r->hmark = len_iobuf(r->hold);
+		}
+	}
+
+	if(!r->to) {
+		/* relay has stopped, everything held goes back to the normal path. */
+		if(len_iobuf(r->hold) == 0) {
+			free_relay(r);
+			ep->mccp_relay = NULL;
+			return(read_endpoint_compressed(ep,buf,count));
+		}
+		finalsize = MIN(count,len_iobuf(r->hold));
+		memcpy(buf,head_iobuf(r->hold),finalsize);
+		pop_iobuf(r->hold,finalsize);
+		if(len_iobuf(r->hold) == 0) {
+			free_relay(r);
+			ep->mccp_relay = NULL;
+		}
+	} else {
+		finalsize = MIN(count,r->hmark);
+		memcpy(buf,head_iobuf(r->hold),finalsize);
+		pop_iobuf(r->hold,finalsize);
+		r->hmark -= finalsize;
+		r->plain += finalsize;
+	}
+
+	iostat_incr(&(ep->mccpstats),finalsize,0);
+	return(finalsize);
+}
+
+/* write_endpoint_compressed() for when ep is getting a relayed stream.  If
+ * buf is exactly the text that was handed to the matcher, the compressed
+ * bytes it came from are passed on instead.  Anything else means a pattern
+ * has gotten involved, so the relay stops and buf gets compressed as usual. */
+ssize_t write_endpoint_relay(Endpoint *ep, void *buf, size_t count) {
+
+	Endpoint *src = ep->mccp_relay_src;
+	struct mccp_relay_data *r = src->mccp_relay;
+	Iobuf *iob = src->iobuf[EP_INPUT];
+	ssize_t ret;
+
+	if( (buf == head_iobuf(iob)) &&
+		(count == len_iobuf(iob)) &&
+		(count == r->plain) &&
+		(r->hmark > 0) &&
+		(avail_iobuf(r->accepted) >= count)
+	) {
+		/* The read was cut short of the block boundary, by the quantum or
+		 * a full input buffer.  Let this much through, and relay it along
+		 * with the rest of its block. */
+		memcpy(tail_iobuf(r->accepted),buf,count);
+		push_iobuf(r->accepted,count);
+		r->plain = 0;
+		return(count);
+	}
+	if( (buf == head_iobuf(iob)) &&
+		(count == len_iobuf(iob)) &&
+		(count == r->plain) &&
+		(r->hmark == 0)
+	) {
+		popall_iobuf(r->accepted);
+		if(r->zmark > 0) {
+			if( (ret = write_endpoint_sock(ep,head_iobuf(r->zbuf),r->zmark)) <= 0) {
+				return(ret);
+			}
+			r->relayed += r->zmark;
+			r->relayed_adler = r->zadler;
+			pop_iobuf(r->zbuf,r->zmark);
+			r->zmark = 0;
+		}
+		r->plain = 0;
+		iostat_incr(&(ep->mccpstats),0,count);
+		return(count);
+	}
+
+	mccp_relay_stop(src,1);
+	return(write_endpoint_compressed(ep,buf,count));
+}
+
+/* true if ep's inflate side is holding input or output that hasn't been read
+ * out yet. */
+int mccp_pending(Endpoint *ep) {
+
+	struct mccp_relay_data *r = ep->mccp_relay;
+	Zstream *zstr = ep->mccp[EP_INPUT];
+
+	/* plain bytes from after a stream ended. */
+	if(len_iobuf(ep->ziobuf[EP_INPUT]) > 0) {
+		return(1);
+	}
+	if(r) {
+		return( (zstr && (zstr->avail_in > 0)) || (r->hmark > 0) ||
+			(!r->to && len_iobuf(r->hold) > 0)
+		);
+	}
+	if(!zstr) {
+		return(0);
+	}
+	return( (zstr->avail_in > 0) || (zstr->avail_out == 0) );
+}
+
 ssize_t read_endpoint_compressed(Endpoint *ep, void *buf, size_t count) {
 
 	ssize_t readtotal,readsize,finalsize, ret;
+	size_t left;
 	char *workspace;
-	int reads;
-	z_stream *zstr;
+	int reads, more;
+	Zstream *zstr;
+
+	/* the stream might be getting passed through to the other side. */
+	if(ep->mccp_relay) {
+		return(read_endpoint_relay(ep,buf,count));
+	}
 
 	/* if compression is not active, this is just a simple call to
-	 * read_endpoint_sock(). */
+	 * read_endpoint_sock(), once whatever came in after the last stream
+	 * ended has been read out. */
 	if(!(zstr = ep->mccp[EP_INPUT])) {
+		if(len_iobuf(ep->ziobuf[EP_INPUT]) > 0) {
+			finalsize = MIN(count,len_iobuf(ep->ziobuf[EP_INPUT]));
+			memcpy(buf,head_iobuf(ep->ziobuf[EP_INPUT]),finalsize);
+			pop_iobuf(ep->ziobuf[EP_INPUT],finalsize);
+			return(finalsize);
+		}
 		return(read_endpoint_sock(ep,buf,count));
 	}
 
@@ -309,6 +893,10 @@ ssize_t read_endpoint_compressed(Endpoint *ep, void *buf, size_t count) {
 	 * processed and placed into the provided space. */
 	workspace = head_iobuf(ep->ziobuf[EP_INPUT]);
 
+	/* If the last inflate filled up all the space it was given, it may be
+	 * holding more output, and should get a go before any more input. */
+	more = (zstr->avail_out == 0);
+
 	/* reset the output to point at the provided space. */
 	zstr->next_out = (unsigned char*)buf;
 	zstr->avail_out = count;
@@ -322,7 +910,7 @@ ssize_t read_endpoint_compressed(Endpoint *ep, void *buf, size_t count) {
 	do {
 
 		/* Need more bytes? */
-		if(zstr->avail_in == 0) {
+		if( (zstr->avail_in == 0) && !more ) {
 
 			/* sure do.  read some more from the socket. */
 			reads++;
@@ -344,7 +932,35 @@ ssize_t read_endpoint_compressed(Endpoint *ep, void *buf, size_t count) {
 			zstr->total_in = 0;
 		}
 
-		if( (ret = inflate(zstr,Z_SYNC_FLUSH)) != Z_OK) {
+		ret = mccp_inflate(zstr,Z_SYNC_FLUSH);
+		more = 0;
+
+		if( (ret == Z_BUF_ERROR) && (zstr->avail_in == 0) ) {
+			/* nothing held after all, go get more input. */
+			continue;
+		}
+
+		if(ret == Z_STREAM_END) {
+			/* The sender ended compression.  Whatever is left over is plain
+			 * telnet again, so as much as fits goes in behind the inflated
+			 * bytes, and the rest waits for the next read. */
+			left = MIN(zstr->avail_in,zstr->avail_out);
+			memcpy(zstr->next_out,zstr->next_in,left);
+			zstr->next_in += left;
+			zstr->avail_in -= left;
+			finalsize = zstr->total_out;
+			iostat_incr(&(ep->mccpstats),finalsize,0);
+
+			mccp_inflate_end(ep);
+
+			if(finalsize + left == 0) {
+				/* nothing to hand back yet, so try the socket. */
+				return(read_endpoint_sock(ep,buf,count));
+			}
+			return(finalsize + left);
+		}
+
+		if(ret != Z_OK) {
 			muditm_log("%s inflate problem? '%s' code %d",ep->name,zstr->msg,ret);
 			return(-1);
 		}
@@ -368,9 +984,18 @@ ssize_t write_endpoint_compressed(Endpoint *ep, void *buf, size_t count) {
 
 	ssize_t consumed,written,ret;
 	int writes;
+	int flush;
+	struct timespec start,end;
+	long int nsec;
+	struct mccp_tune_data *t;
 	
 	char *workspace;
-	z_stream *zstr;
+	Zstream *zstr;
+
+	/* relaying somebody else's compressed stream? */
+	if(ep->mccp_relay_src) {
+		return(write_endpoint_relay(ep,buf,count));
+	}
 
 	/* if compression is not active, this is just a simple call to
 	 * read_endpoint_sock(). */
@@ -381,6 +1006,18 @@ ssize_t write_endpoint_compressed(Endpoint *ep, void *buf, size_t count) {
 	/* Compression is active, This is more involved. */
 	workspace = head_iobuf(ep->ziobuf[EP_OUTPUT]);
 
+	/* Flushing every write costs ratio and makes lots of little packets, so
+	 * the flush can be put off for a few ms, unless there's a prompt in
+	 * here, or enough has piled up already. */
+	t = ep->mccp_tune;
+	flush = Z_SYNC_FLUSH;
+	if( t && (t->flush_ms > 0) && (count > 0) &&
+		((t->unflushed + count) < t->flush_bytes) &&
+		!mccp_has_prompt(t,buf,count)
+	) {
+		flush = Z_NO_FLUSH;
+	}
+
 	zstr->next_in = (unsigned char *)buf;
 	zstr->avail_in = count;
 	zstr->total_in = 0;
@@ -403,26 +1040,40 @@ ssize_t write_endpoint_compressed(Endpoint *ep, void *buf, size_t count) {
 		zstr->avail_out = EP_BUFSIZE;
 		zstr->total_out = 0;
 
-		if( (ret = deflate(zstr,Z_SYNC_FLUSH)) != Z_OK) {
+		clock_gettime(CLOCK_MONOTONIC,&start);
+		ret = deflate_zstream(zstr,flush);
+		clock_gettime(CLOCK_MONOTONIC,&end);
+		nsec = (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+		counters.deflates++;
+		counters.deflate_nsec += nsec;
+		if(ep->mccp_tune) {
+			ep->mccp_tune->window_nsec += nsec;
+			ep->mccp_tune->deflate_nsec += nsec;
+		}
+
+		/* Z_BUF_ERROR just means there was nothing to do. */
+		if( (ret != Z_OK) && (ret != Z_BUF_ERROR) ) {
 			muditm_log("%s deflate problem? '%s' code %d",ep->name,zstr->msg,ret);
 			// exit(EXIT_FAILURE);
 			return(-1);
 		} 
 
-		writes++;
-
-		if( (ret = write_endpoint_sock(ep,workspace,zstr->total_out)) <= 0 ) {
-			if(consumed != 0) {
-				/* There was a successful partial write before this failure, so
-				 * return the byte count that was presumably sent without
-				 * error.  It the write_endpoint_sock fails immediately the
-				 * next time the code gets here, the actual error code from it
-				 * will propigate up. I believe this mimics write(); */
-				break;
-			} else {
-				/* no bytes were put onto the wire, return the underlying error
-				 * code. */
-				return(ret);
+		/* without a flush, deflate may well hang on to all of it. */
+		if(zstr->total_out > 0) {
+			writes++;
+			if( (ret = write_endpoint_sock(ep,workspace,zstr->total_out)) <= 0 ) {
+				if(consumed != 0) {
+					/* There was a successful partial write before this failure, so
+					 * return the byte count that was presumably sent without
+					 * error.  It the write_endpoint_sock fails immediately the
+					 * next time the code gets here, the actual error code from it
+					 * will propigate up. I believe this mimics write(); */
+					break;
+				} else {
+					/* no bytes were put onto the wire, return the underlying error
+					 * code. */
+					return(ret);
+				}
 			}
 		}
 		consumed += zstr->total_in;
@@ -436,8 +1087,165 @@ ssize_t write_endpoint_compressed(Endpoint *ep, void *buf, size_t count) {
 	);
 
 	iostat_incr(&(ep->mccpstats),0,consumed);
+
+	/* keep track of what is waiting on a flush. */
+	if(t) {
+		if(flush == Z_SYNC_FLUSH) {
+			t->unflushed = 0;
+			t->flushes++;
+		} else if(consumed > 0) {
+			if(t->unflushed == 0) {
+				clock_gettime(CLOCK_MONOTONIC,&(t->flush_due));
+				t->flush_due.tv_nsec += t->flush_ms * 1000000L;
+				t->flush_due.tv_sec += t->flush_due.tv_nsec / 1000000000L;
+				t->flush_due.tv_nsec %= 1000000000L;
+			}
+			t->unflushed += consumed;
+		}
+	}
+
+	/* see if the compression level ought to move. */
+	if(t && t->adaptive) {
+		mccp_tune(ep,zstr);
+	}
+
 	/* we want to return the number of bytes that were consumed from the
 	 * arguments, not the actual amount of bytes put out onto the wire. So
 	 * return the total_in bytes consumed. It should be == to count. */
-	return(zstr->total_in);
+	return(consumed);
+}
+
+/* The adaptive compression controller.  Once per MCCP_TUNE_INTERVAL, look at
+ * how much of the wall clock went to deflate() and how much is still sitting
+ * unsent in the socket.  Too much cpu, and the level comes down.  A backlog
+ * means the link is the bottleneck, so the level goes up to make fewer bytes
+ * for it. */
+void mccp_tune(Endpoint *ep, Zstream *z) {
+
+	struct mccp_tune_data *t = ep->mccp_tune;
+	struct timespec now;
+	long int elapsed;
+	double cpu;
+	int backlog = 0;
+	int level;
+	char *workspace;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	elapsed = (now.tv_sec - t->window_start.tv_sec) * 1000000000L + 
+		(now.tv_nsec - t->window_start.tv_nsec);
+	if(elapsed < MCCP_TUNE_INTERVAL) return;
+
+	cpu = (double)t->window_nsec / elapsed;
+	if(ioctl(ep->socket,SIOCOUTQ,&backlog) < 0) {
+		backlog = 0;
+	}
+
+	level = t->current;
+	if( (cpu > t->cpubudget) && (level > t->minlevel) ) {
+		level--;
+	} else if( (backlog > t->backlog) && (level < t->maxlevel) ) {
+		level++;
+	}
+
+	t->window_start = now;
+	t->window_nsec = 0;
+
+	if(level == t->current) return;
+
+	/* deflateParams() may have to push out a block with the old settings, so
+	 * give it somewhere to put it. */
+	workspace = head_iobuf(ep->ziobuf[EP_OUTPUT]);
+	z->next_in = NULL;
+	z->avail_in = 0;
+	z->next_out = (unsigned char *)workspace;
+	z->avail_out = EP_BUFSIZE;
+	ret = params_zstream(z,level,t->strategy);
+	if(EP_BUFSIZE - z->avail_out > 0) {
+		write_endpoint_sock(ep,workspace,EP_BUFSIZE - z->avail_out);
+	}
+	if(ret != Z_OK) {
+		muditm_debug("%s deflateParams code %d, level stays %d",ep->name,ret,t->current);
+		return;
+	}
+
+	muditm_debug("%s deflate level %d -> %d, cpu %0.1f%% backlog %d",
+		ep->name,t->current,level,cpu*100.0,backlog
+	);
+	t->current = level;
+	t->lowest = MIN(t->lowest,level);
+	t->highest = MAX(t->highest,level);
+	t->changes++;
+}
+
+/* print the deflate settings and controller history for the stats log. */
+int mccp_printtune(char *buf, size_t len, Endpoint *ep) {
+
+	struct mccp_tune_data *t = ep->mccp_tune;
+
+	if(!t) {
+		return(g_snprintf(buf,len,"level %d",Z_BEST_COMPRESSION));
+	}
+
+	return(g_snprintf(buf,len,"level %d (start %d, lowest %d, highest %d, %d changes), %0.2f ms in deflate, %d flushes",
+		t->current,t->level,t->lowest,t->highest,t->changes,
+		t->deflate_nsec / 1000000.0, t->flushes
+	));
+}
+
+/* look for IAC GA or IAC EOR, which mark a prompt that the player is
+ * waiting to see.  An IAC at the very end is remembered for next time. */
+int mccp_has_prompt(struct mccp_tune_data *t, char *buf, size_t count) {
+
+	unsigned char *s = (unsigned char *)buf;
+	unsigned char *eos = s + count;
+	int found = 0;
+
+	if(t->iac && (s < eos)) {
+		t->iac = 0;
+		if( (*s == GA) || (*s == EOR) ) found = 1;
+		s++;
+	}
+
+	while( (s < eos) && (s = memchr(s,IAC,eos-s)) ) {
+		s++;
+		if(s == eos) {
+			t->iac = 1;
+			break;
+		}
+		if( (*s == GA) || (*s == EOR) ) found = 1;
+		/* skip the command byte, so IAC IAC isn't taken for two IACs. */
+		s++;
+	}
+
+	return(found);
+}
+
+/* how many ms poll() can wait before ep's deflate stream needs a flush.
+ * -1 means there is nothing waiting. */
+int mccp_flush_wait(Endpoint *ep) {
+
+	struct mccp_tune_data *t = ep->mccp_tune;
+	struct timespec now;
+	long int wait;
+
+	if( !t || !ep->mccp[EP_OUTPUT] || (t->unflushed == 0) ) {
+		return(-1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	wait = (t->flush_due.tv_sec - now.tv_sec) * 1000L +
+		(t->flush_due.tv_nsec - now.tv_nsec + 999999L) / 1000000L;
+
+	return(MAX(0,wait));
+}
+
+/* flush ep's deflate stream if anything has been waiting long enough. */
+void mccp_flush_check(Endpoint *ep) {
+
+	if(mccp_flush_wait(ep) != 0) return;
+
+	muditm_debug("%s deflate flush of %d bytes on deadline.",ep->name,ep->mccp_tune->unflushed);
+	/* an empty write always flushes. */
+	write_endpoint_compressed(ep,NULL,0);
 }
@@ -38,19 +38,79 @@ typedef enum {
 	MCCP_MAX
 } mccp_mode_t;
 
+/* deflate settings for one side of the proxy, and the adaptive controller
+ * that moves the compression level around during the session. */
+struct mccp_tune_data {
+	int level;		/* level deflateInit2() starts with */
+	int strategy;
+	int window;		/* windowBits */
+	int memlevel;
+	int adaptive;		/* if set, level moves between minlevel and maxlevel */
+	int minlevel;
+	int maxlevel;
+	double cpubudget;	/* fraction of wall time deflate may use */
+	int backlog;		/* unsent socket bytes that count as backlogged */
+
+	int current;		/* level in use right now */
+	int lowest;
+	int highest;
+	int changes;
+	struct timespec window_start;
+	long int window_nsec;	/* time spent in deflate this window */
+	long int deflate_nsec;	/* time spent in deflate this session */
+
+	int flush_ms;		/* how long a write may sit in deflate unflushed */
+	int flush_bytes;	/* how much may sit in deflate unflushed */
+	int iac;		/* last write ended on an IAC */
+	size_t unflushed;	/* bytes deflated since the last flush */
+	struct timespec flush_due;
+	int flushes;
+
+	int mccp3;		/* offer to take a compressed stream from this side */
+};
+
+/* State for passing one side's compressed stream straight through to the
+ * other side.  The stream is still inflated for pattern matching, but only
+ * whole, byte aligned deflate blocks are ever relayed, so that the relayed
+ * stream can be cleanly ended if a pattern fires and processing has to go
+ * back to inflate/match/deflate. */
+struct mccp_relay_data {
+	Endpoint *to;		/* who gets the stream, NULL once relay has stopped */
+	Iobuf *zbuf;		/* compressed bytes inflated but not yet relayed */
+	size_t zmark;		/* zbuf length at the last block boundary */
+	unsigned long zadler;		/* adler32 of the plain text at zmark */
+	Iobuf *hold;		/* inflated bytes not yet handed to the matcher */
+	size_t hmark;		/* hold length at the last block boundary */
+	size_t plain;		/* bytes handed to the matcher but not yet relayed */
+	Iobuf *accepted;	/* matched text waiting on the rest of its block */
+	long int relayed;	/* compressed bytes sent to the other side */
+	unsigned long relayed_adler;	/* adler32 of the plain text relayed so far */
+};
+
 /* exported global variable declarations */
 
 /* exported function declarations */
 void configure_compression(Endpoint *ep,char *value);
+struct mccp_tune_data *parse_deflate(GKeyFile *gkf,char *group);
+void configure_deflate(Endpoint *ep,struct mccp_tune_data *settings);
+int mccp_printtune(char *buf, size_t len, Endpoint *ep);
+int mccp_flush_wait(Endpoint *ep);
+void mccp_flush_check(Endpoint *ep);
 void offer_compression(Endpoint *ep);
+int mccp2_deflate_start(Endpoint *ep, int announce);
 void add_mccp_game_patterns(Endpoint *ep);
 void add_mccp_client_patterns(Endpoint *ep);
 ssize_t write_endpoint_compressed(Endpoint *ep, void *buf, size_t count);
 ssize_t read_endpoint_compressed(Endpoint *ep, void *buf, size_t count);
+int mccp_pending(Endpoint *ep);
+void free_relay(struct mccp_relay_data *r);
 
 PatternAction mccp_ignore;
 PatternAction mccp2_do;
 PatternAction mccp2_dont;
 PatternAction mccp2_sb_start;
+PatternAction mccp3_do;
+PatternAction mccp3_dont;
+PatternAction mccp3_sb_start;
 
 #endif /* MUDITM_MCCP_H */
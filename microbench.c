@@ -0,0 +1,529 @@
+/* microbench.c - times the iobuf, matcher and MCCP building blocks alone */
+/* Created: Mon Oct 19 19:32:51 PM EDT 2026 malakai */
+/* $Id: microbench.c,v 1.1 2026/10/19 23:32:51 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Times the pieces the proxy is built from, one at a time, on made up MUD
+ * output with more or less telnet in it, cut up at different read sizes:
+ *
+ * 	iobuf_popall	push_iobuf() a read, popall_iobuf() it, the no match path
+ * 	iobuf_pop	push_iobuf() a read, pop_iobuf() it an IAC at a time
+ * 	match_game	pcre2_match() the game side pattern set, the way
+ * 	match_client	 match_flow() does, and the client side set
+ * 	mccp_write	write_endpoint_compressed() into a socketpair
+ * 	mccp_read	read_endpoint_compressed() back out of it
+ * 	sock_write	write_endpoint_sock() and read_endpoint_sock(), to see
+ * 	sock_read	 what the compression costs on top
+ *
+ * The corpora are "plain" (no IACs), "prompts" (an IAC GA after each
+ * prompt) and "dense" (option negotiation, escaped 255s and subnegotiation
+ * every line or so), plus a file of recorded output if one is given.  Each
+ * case runs for at least -t ms.  One tab separated line per case, or a JSON
+ * object per line with -j, with ns per call and per byte, and how many
+ * mallocs and memmove'd bytes it took per call.
+ *
+ * 	mudbench [-c configfile] [-s KiB] [-t ms] [-r readsizes] [-j] [corpusfile]
+ *
+ * Only the [game] compression-* settings of the config file are used, and
+ * compression-flush-ms isn't one of them.
+ */
+
+#include <arpa/telnet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "debug.h"
+#include "muditm.h"
+#include "iobuf.h"
+#include "proxy.h"
+#include "mccp.h"
+#include "handlers.h"
+#include "counters.h"
+
+/* ---- local #defines ---- */
+#define MBENCH_CORPORA 4
+#define MBENCH_READS 8
+
+/* ---- structs and typedefs ---- */
+
+struct mbench_corpus {
+	char *name;
+	char *buf;
+	size_t size;
+};
+
+/* what one case did. */
+struct mbench_result {
+	long int calls;
+	long int bytes;
+	long int nsec;
+	long int mallocs;
+	long int moved;
+};
+
+/* ---- local variable declarations ---- */
+char *muditm_proxy_name = "mudbench";
+
+static long int mbench_mallocs = 0;
+static int mbench_json = 0;
+static long int mbench_min_nsec = 200000000L;
+
+/* ---- local function declarations ---- */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+/* ---- code starts here ---- */
+
+/* Count every malloc in the process, zlib's and pcre2's included, by
+ * standing in front of glibc's.  free() is glibc's own. */
+void *malloc(size_t size) {
+	mbench_mallocs++;
+	return(__libc_malloc(size));
+}
+
+void *calloc(size_t nmemb, size_t size) {
+	mbench_mallocs++;
+	return(__libc_calloc(nmemb,size));
+}
+
+void *realloc(void *ptr, size_t size) {
+	mbench_mallocs++;
+	return(__libc_realloc(ptr,size));
+}
+
+long int mbench_nsec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return(ts.tv_sec * 1000000000L + ts.tv_nsec);
+}
+
+/* read the whole corpus file into memory. */
+char *mbench_load(char *filename, size_t *size) {
+	FILE *f;
+	char *buf;
+	long len;
+
+	if(!(f = fopen(filename,"r"))) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+	fseek(f,0,SEEK_END);
+	len = ftell(f);
+	fseek(f,0,SEEK_SET);
+	buf = (char *)malloc(len);
+	if(fread(buf,1,len,f) != len) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+	fclose(f);
+	*size = len;
+	return(buf);
+}
+
+/* make up size bytes of MUD output.  iac is 0 for none, 1 for a GA after
+ * each prompt, 2 for telnet all over the place. */
+char *mbench_synth(size_t size, int iac) {
+
+	char *mobs[] = { "the orc", "a large rat", "the cityguard", "Malakai", "a hungry ghoul" };
+	char *hits[] = { "hits", "misses", "MASSACRES", "scratches", "DEVASTATES" };
+	char gmcp[] = "Char.Vitals {\"hp\":412,\"maxhp\":500,\"mp\":120,\"maxmp\":300}";
+	char *buf, *s, *eos;
+	int i = 0;
+
+	buf = (char *)malloc(size + 1024);
+	s = buf;
+	eos = buf + size;
+	srandom(1);
+
+	while(s < eos) {
+		switch(random() % 8) {
+			case 0:
+				s += sprintf(s,"\033[1;36mThe Temple Square\033[0m\r\n"
+					"   You are standing in the temple square.  Huge marble steps lead up\r\n"
+					"to the temple gate.  The entrance to the Clerics Guild is to the west,\r\n"
+					"and the old Grunting Boar Inn is to the east.\r\n"
+					"\033[0;32m[Exits: north east south west up]\033[0m\r\n");
+				break;
+			case 1:
+				s += sprintf(s,"\r\n<%dhp %dm %dmv> ",
+					(int)(random() % 500), (int)(random() % 300), (int)(random() % 200)
+				);
+				if(iac) {
+					*s++ = IAC;
+					*s++ = GA;
+				}
+				break;
+			default:
+				s += sprintf(s,"\033[1;31m%s %s you.\033[0m  You hit %s for %d damage! (%d)\r\n",
+					mobs[random() % 5], hits[random() % 5], mobs[random() % 5],
+					(int)(random() % 100), i++
+				);
+				break;
+		}
+		if(iac < 2) continue;
+		switch(random() % 4) {
+			case 0:
+				/* options nobody here cares about. */
+				*s++ = IAC;
+				*s++ = (random() % 2)?WILL:DO;
+				*s++ = (random() % 2)?TELOPT_EOR:TELOPT_NAWS;
+				break;
+			case 1:
+				/* a gold piece costs 255 */
+				s += sprintf(s,"It costs %c%c gold.\r\n",IAC,IAC);
+				break;
+			case 2:
+				/* GMCP, option 201 */
+				*s++ = IAC;
+				*s++ = SB;
+				*s++ = (char)201;
+				memcpy(s,gmcp,sizeof(gmcp)-1);
+				s += sizeof(gmcp)-1;
+				*s++ = IAC;
+				*s++ = SE;
+				break;
+			default:
+				break;
+		}
+	}
+	return(buf);
+}
+
+/* print one case. */
+void mbench_report(char *bench, struct mbench_corpus *c, size_t chunk, struct mbench_result *r) {
+
+	double calls = MAX(1,r->calls);
+
+	if(mbench_json) {
+		printf("{\"bench\":\"%s\",\"corpus\":\"%s\",\"read\":%zu,\"calls\":%ld,\"bytes\":%ld,"
+			"\"ns_per_call\":%.1f,\"ns_per_byte\":%.3f,\"MB_per_s\":%.1f,"
+			"\"mallocs_per_call\":%.3f,\"moved_per_call\":%.1f}\n",
+			bench, c->name, chunk, r->calls, r->bytes,
+			r->nsec / calls, (double)r->nsec / MAX(1,r->bytes),
+			r->bytes / (r->nsec / 1000000000.0) / (1<<20),
+			r->mallocs / calls, r->moved / calls
+		);
+	} else {
+		printf("%s\t%s\t%zu\t%ld\t%ld\t%.1f\t%.3f\t%.1f\t%.3f\t%.1f\n",
+			bench, c->name, chunk, r->calls, r->bytes,
+			r->nsec / calls, (double)r->nsec / MAX(1,r->bytes),
+			r->bytes / (r->nsec / 1000000000.0) / (1<<20),
+			r->mallocs / calls, r->moved / calls
+		);
+	}
+	fflush(stdout);
+}
+
+/* the counters and the malloc count, before and after a case. */
+void mbench_start(struct mbench_result *r) {
+	memset(r,0,sizeof(struct mbench_result));
+	r->mallocs = mbench_mallocs;
+	r->moved = counters.moved;
+}
+
+void mbench_stop(struct mbench_result *r) {
+	r->mallocs = mbench_mallocs - r->mallocs;
+	r->moved = counters.moved - r->moved;
+}
+
+/* a read's worth into iob, then all of it back out, like a pass through
+ * match_flow() that finds nothing. */
+void mbench_iobuf_popall(struct mbench_corpus *c, size_t chunk) {
+
+	struct mbench_result r;
+	Iobuf *iob = new_iobuf(EP_BUFSIZE);
+	size_t off, n;
+	long int start;
+
+	mbench_start(&r);
+	while(r.nsec < mbench_min_nsec) {
+		start = mbench_nsec();
+		for(off = 0; off < c->size; off += n) {
+			n = MIN(chunk,c->size - off);
+			memcpy(tail_iobuf(iob),c->buf + off,n);
+			push_iobuf(iob,n);
+			popall_iobuf(iob);
+			r.calls++;
+		}
+		r.nsec += mbench_nsec() - start;
+		r.bytes += c->size;
+	}
+	mbench_stop(&r);
+	mbench_report("iobuf_popall",c,chunk,&r);
+	free_iobuf(iob);
+}
+
+/* a read's worth into iob, then popped off up to and past each IAC, like
+ * match_flow() shipping the bytes ahead of each match and then the match. */
+void mbench_iobuf_pop(struct mbench_corpus *c, size_t chunk) {
+
+	struct mbench_result r;
+	Iobuf *iob = new_iobuf(EP_BUFSIZE);
+	size_t off, n;
+	char *iac;
+	long int start;
+
+	mbench_start(&r);
+	while(r.nsec < mbench_min_nsec) {
+		start = mbench_nsec();
+		for(off = 0; off < c->size; off += n) {
+			n = MIN(chunk,c->size - off);
+			memcpy(tail_iobuf(iob),c->buf + off,n);
+			push_iobuf(iob,n);
+			while( (iac = memchr(head_iobuf(iob),IAC,len_iobuf(iob))) ) {
+				pop_iobuf(iob,iac - head_iobuf(iob));
+				pop_iobuf(iob,MIN(3,len_iobuf(iob)));
+				r.calls += 2;
+			}
+			popall_iobuf(iob);
+			r.calls++;
+		}
+		r.nsec += mbench_nsec() - start;
+		r.bytes += c->size;
+	}
+	mbench_stop(&r);
+	mbench_report("iobuf_pop",c,chunk,&r);
+	free_iobuf(iob);
+}
+
+/* the matcher loop out of match_flow(), minus the handlers and the write.
+ * Each read is added to whatever a partial match held back. */
+void mbench_match(char *bench, Endpoint *ep, struct mbench_corpus *c, size_t chunk) {
+
+	struct mbench_result r;
+	Iobuf *iob = ep->iobuf[EP_INPUT];
+	PCRE2_SIZE *ovector;
+	size_t off, n;
+	long int start;
+	int ret;
+
+	popall_iobuf(iob);
+	mbench_start(&r);
+	while(r.nsec < mbench_min_nsec) {
+		start = mbench_nsec();
+		for(off = 0; off < c->size; off += n) {
+			n = MIN(MIN(chunk,avail_iobuf(iob)),c->size - off);
+			memcpy(tail_iobuf(iob),c->buf + off,n);
+			push_iobuf(iob,n);
+			while(len_iobuf(iob) > 0) {
+				r.calls++;
+				ret = pcre2_match(ep->re,
+					(PCRE2_SPTR)head_iobuf(iob), len_iobuf(iob),
+					0,
+					PCRE2_PARTIAL_HARD,
+					ep->match_data,
+					NULL
+				);
+				if(ret == PCRE2_ERROR_NOMATCH) {
+					popall_iobuf(iob);
+				} else if(ret == PCRE2_ERROR_PARTIAL) {
+					break;
+				} else {
+					ovector = pcre2_get_ovector_pointer(ep->match_data);
+					pop_iobuf(iob,ovector[1]);
+				}
+			}
+		}
+		r.nsec += mbench_nsec() - start;
+		r.bytes += c->size;
+	}
+	popall_iobuf(iob);
+	mbench_stop(&r);
+	mbench_report(bench,c,chunk,&r);
+}
+
+/* write each read's worth into one end of a socketpair, with
+ * write_endpoint_compressed() if compress is set, and read it back out of
+ * the other end, timing each half on its own. */
+void mbench_mccp(struct mbench_corpus *c, size_t chunk, int compress, struct mccp_tune_data *tune) {
+
+	struct mbench_result w, r;
+	Endpoint *out, *in;
+	Zstream *z;
+	char *got;
+	size_t off, n, have;
+	ssize_t ret;
+	long int start, mid;
+	int sv[2], size = 4<<20;
+
+	if(socketpair(AF_UNIX,SOCK_STREAM,0,sv) < 0) {
+		perror("socketpair");
+		exit(EXIT_FAILURE);
+	}
+	setsockopt(sv[0],SOL_SOCKET,SO_SNDBUF,&size,sizeof(size));
+	setsockopt(sv[1],SOL_SOCKET,SO_RCVBUF,&size,sizeof(size));
+
+	out = new_endpoint("Out");
+	out->socket = sv[0];
+	in = new_endpoint("In");
+	in->socket = sv[1];
+	got = (char *)malloc(EP_BUFSIZE);
+
+	if(compress) {
+		configure_deflate(out,tune);
+		mccp2_deflate_start(out,0);
+		z = new_zstream(zcodec_default);
+		init_inflate_zstream(z);
+		in->mccp[EP_INPUT] = z;
+	}
+
+	mbench_start(&w);
+	mbench_start(&r);
+	while(w.nsec + r.nsec < 2 * mbench_min_nsec) {
+		for(off = 0; off < c->size; off += n) {
+			n = MIN(chunk,c->size - off);
+			start = mbench_nsec();
+			if( (ret = write_endpoint(out,c->buf + off,n)) != n ) {
+				fprintf(stderr,"write_endpoint returned %zd of %zu\n",ret,n);
+				exit(EXIT_FAILURE);
+			}
+			mid = mbench_nsec();
+			w.nsec += mid - start;
+			w.calls++;
+			for(have = 0; have < n; have += ret) {
+				if( (ret = read_endpoint(in,got + have,EP_BUFSIZE - have)) <= 0) {
+					fprintf(stderr,"read_endpoint returned %zd\n",ret);
+					exit(EXIT_FAILURE);
+				}
+				r.calls++;
+			}
+			r.nsec += mbench_nsec() - mid;
+			if( (have != n) || memcmp(got,c->buf + off,n) ) {
+				fprintf(stderr,"%s round trip doesn't match!\n",c->name);
+				exit(EXIT_FAILURE);
+			}
+		}
+		w.bytes += c->size;
+		r.bytes += c->size;
+	}
+	/* the mallocs and moves of both halves get counted in both. */
+	mbench_stop(&w);
+	mbench_stop(&r);
+	mbench_report(compress?"mccp_write":"sock_write",c,chunk,&w);
+	mbench_report(compress?"mccp_read":"sock_read",c,chunk,&r);
+
+	free(got);
+	free_endpoint(out);
+	free_endpoint(in);
+}
+
+int main(int argc, char **argv) {
+
+	struct mbench_corpus corpus[MBENCH_CORPORA];
+	struct mccp_tune_data *tune;
+	Endpoint *game, *client;
+	GKeyFile *gkf;
+	GError *error = NULL;
+	size_t reads[MBENCH_READS] = { 61, 509, 4093, EP_BUFSIZE };
+	size_t size = 1<<20;
+	int nreads = 4;
+	int ncorpora = 0;
+	char *configfile = NULL;
+	char *s;
+	int opt, i, j;
+
+	while( (opt = getopt(argc,argv,"c:s:t:r:jh")) != -1) {
+		switch(opt) {
+			case 'c':
+				configfile = optarg;
+				break;
+			case 's':
+				size = MAX(1,atoi(optarg)) * 1024;
+				break;
+			case 't':
+				mbench_min_nsec = MAX(1,atol(optarg)) * 1000000L;
+				break;
+			case 'r':
+				for(nreads = 0, s = strtok(optarg,","); s && nreads < MBENCH_READS; s = strtok(NULL,",")) {
+					reads[nreads++] = CLAMP(atoi(s),1,EP_BUFSIZE);
+				}
+				break;
+			case 'j':
+				mbench_json = 1;
+				break;
+			case 'h':
+			default:
+				fprintf(stdout,"Usage: %s [-c configfile] [-s KiB] [-t ms] [-r readsizes] [-j] [corpusfile]\n",argv[0]);
+				exit(EXIT_SUCCESS);
+		}
+	}
+
+	gkf = g_key_file_new();
+	if(configfile && !g_key_file_load_from_file(gkf,configfile,G_KEY_FILE_NONE,&error)) {
+		fprintf(stderr,"%s: %s\n",configfile,error->message);
+		exit(EXIT_FAILURE);
+	}
+	tune = parse_deflate(gkf,"game");
+	/* every write has to come out the other end before the next one. */
+	tune->flush_ms = 0;
+
+	corpus[ncorpora].name = "plain";
+	corpus[ncorpora].buf = mbench_synth(size,0);
+	corpus[ncorpora++].size = size;
+	corpus[ncorpora].name = "prompts";
+	corpus[ncorpora].buf = mbench_synth(size,1);
+	corpus[ncorpora++].size = size;
+	corpus[ncorpora].name = "dense";
+	corpus[ncorpora].buf = mbench_synth(size,2);
+	corpus[ncorpora++].size = size;
+	if(optind < argc) {
+		corpus[ncorpora].name = argv[optind];
+		corpus[ncorpora].buf = mbench_load(argv[optind],&(corpus[ncorpora].size));
+		ncorpora++;
+	}
+
+	/* the pattern sets a session with compression turned on gets. */
+	game = new_endpoint("Game");
+	configure_compression(game,"enable");
+	add_game_patterns(game);
+	client = new_endpoint("Client");
+	configure_compression(client,"enable");
+	add_client_patterns(client);
+
+	if(!mbench_json) {
+		printf("bench\tcorpus\tread\tcalls\tbytes\tns/call\tns/byte\tMB/s\tmallocs/call\tmoved/call\n");
+	}
+	for(i=0; i<ncorpora; i++) {
+		for(j=0; j<nreads; j++) {
+			mbench_iobuf_popall(&(corpus[i]),reads[j]);
+			mbench_iobuf_pop(&(corpus[i]),reads[j]);
+			mbench_match("match_game",game,&(corpus[i]),reads[j]);
+			mbench_match("match_client",client,&(corpus[i]),reads[j]);
+			mbench_mccp(&(corpus[i]),reads[j],0,tune);
+			mbench_mccp(&(corpus[i]),reads[j],1,tune);
+		}
+	}
+
+	free_endpoint(game);
+	free_endpoint(client);
+	for(i=0; i<ncorpora; i++) {
+		free(corpus[i].buf);
+	}
+	free(tune);
+	g_key_file_free(gkf);
+	return(0);
+}
@@ -21,12 +21,15 @@
  */
 
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <glib.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <openssl/err.h>
 #include <openssl/ssl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
@@ -37,12 +40,24 @@
 #include "debug.h"
 #include "proxy.h"
 #include "mccp.h"
+#include "zcodec.h"
+#include "sslcache.h"
+#include "handshake.h"
+#include "stats.h"
+#include "admin.h"
+#include "counters.h"
+#include "capture.h"
+#include "trace.h"
+#include "upgrade.h"
+#include "backend.h"
+#include "affinity.h"
+#include "sockopt.h"
+#include "config.h"
 
 #include "muditm.h"
 
 #define CONFIG_FILE "/etc/muditm.conf"
 
-void configure_context(SSL_CTX * ctx,char *cert, char *key, char *chain);
 void log_endpoint_stats(Endpoint *ep);
 
 char *muditm_proxy_name;
@@ -85,7 +100,9 @@ int new_mommie(int port) {
 		exit(EXIT_FAILURE);
 	}
 
-	if(listen(s,1) < 0) {
+	/* a backlog of 1 makes a crowd of players arriving at once wait out SYN
+	 * retries, a second or more each. */
+	if(listen(s,SOMAXCONN) < 0) {
 		muditm_log("I said 'Now you listen to me...' and he said: %s",strerror(errno));
 		exit(EXIT_FAILURE);
 	}
@@ -96,120 +113,37 @@ int new_mommie(int port) {
 }
 
 
-void configure_context(SSL_CTX * ctx,char *cert, char *key, char *chain)
-{
-	SSL_CTX_set_ecdh_auto(ctx, 1);
-
-	/* Set the key and cert */
-	if (SSL_CTX_use_certificate_file(ctx, cert, SSL_FILETYPE_PEM) <= 0) {
-		muditm_sslerr("using cert file");
-		exit(EXIT_FAILURE);
-	}
-
-	if (SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) <= 0) {
-		muditm_sslerr("using private key");
-		exit(EXIT_FAILURE);
-	}
-
-	if(*chain) {
-		if (SSL_CTX_use_certificate_chain_file(ctx, chain) <= 0) {
-			muditm_sslerr("using chain cert");
-			exit(EXIT_FAILURE);
-		}
-	}
-
-	if (SSL_CTX_set_default_verify_paths(ctx) <= 0) {
-		muditm_sslerr("default paths");
-		exit(EXIT_FAILURE);
-	}
+/* sessions forked and not yet reaped, so an old muditm that handed its
+ * listener over knows when it can go.  Atomic, because zombie_killer
+ * changes it too. */
+static int sessions_running = 0;
 
-}
-
-int game_connect(char *host, char *service) {
-	
-	struct addrinfo hints;
-	struct addrinfo *result, *rp;
-	int server_sock;
-	int ret;
-
-	/* get the possible addresses from the host and service port */
-	memset(&hints,0,sizeof(struct addrinfo));
-	hints.ai_family = AF_UNSPEC;		/* doesn't matter, I can take IPv4 or IPv6 */
-	hints.ai_socktype = SOCK_STREAM;	/* tcp please */
-	hints.ai_flags = 0;	
-	hints.ai_protocol = 0;
-
-	ret = getaddrinfo(host,service,&hints,&result);
-	if(ret != 0) {
-		muditm_log("Dingos ate my game server! %s",gai_strerror(ret));
-		return(-1);
-	}
-
-	/* loop through the list until one of them works. */
-	for(rp = result; rp != NULL; rp=rp->ai_next) {
-		server_sock = socket(rp->ai_family,rp->ai_socktype,rp->ai_protocol);
-		if(server_sock == -1) continue;
-		if(connect(server_sock,rp->ai_addr,rp->ai_addrlen) == 0) {
-			/* connected! */
-			break;
+/* Does what it says on the tin. */
+void zombie_killer(int s) {
+	int saved_errno = errno;
+	pid_t pid;
+	while((pid = waitpid(-1,NULL,WNOHANG)) > 0) {
+		/* a session that died mid handshake still has its slot. */
+		handshake_reap(pid);
+		stats_reap(pid);
+		if(!muditm_log_reap(pid) && !backend_reap(pid)) {
+			__atomic_sub_fetch(&sessions_running,1,__ATOMIC_RELAXED);
 		}
-		close(server_sock);
 	}
-	freeaddrinfo(result);
-
-	if( rp == NULL ) {
-		muditm_log("Couldn't connect to game server, %s",strerror(errno));
-		return(-1);
-	}
-
-	return(server_sock);
-}
-
-/* keyfile parsing simplified. */
-char *get_conf_string(GKeyFile * gkf, gchar * group, gchar * key, gchar * def) {
-	gchar *gs = NULL;
-
-	if ((gs = g_key_file_get_string(gkf, group, key, NULL))) {
-		return (gs);
-	} else {
-		return (strdup(def));
-	}
-
-}
-
-/* keyfile parsing simplified. */
-int get_conf_int(GKeyFile * gkf, gchar * group, gchar * key, int def) {
-	gint gs;
-	GError *error = NULL;
-
-	gs = g_key_file_get_integer(gkf, group, key, &error);
-	if (error == NULL) {
-		return (gs);
-	} else {
-		return (def);
-	}
-
+	errno = saved_errno;
 }
 
-/* keyfile parsing simplified. */
-int get_conf_boolean(GKeyFile * gkf, gchar * group, gchar * key, int def) {
-	gint gs;
-	GError *error = NULL;
+/* The listener has been handed off.  No more accepting, just wait for the
+ * sessions here to finish.  Returns -1, for no client. */
+int retire(void) {
 
-	gs = g_key_file_get_boolean(gkf, group, key, &error);
-	if (error == NULL) {
-		return (gs);
-	} else {
-		return (def);
+	muditm_log("Waiting for %d sessions to end.",__atomic_load_n(&sessions_running,__ATOMIC_RELAXED));
+	while(__atomic_load_n(&sessions_running,__ATOMIC_RELAXED) > 0) {
+		poll(NULL,0,1000);
+		stats_publish();
 	}
-
-}
-
-/* Does what it says on the tin. */
-void zombie_killer(int s) {
-	int saved_errno = errno;
-	while(waitpid(-1,NULL,WNOHANG) > 0);
-	errno = saved_errno;
+	muditm_log("The last session has ended.");
+	return(-1);
 }
 
 int demonize(int mother_sock, int forking) {
@@ -219,6 +153,25 @@ int demonize(int mother_sock, int forking) {
 	char addrstr[INET6_ADDRSTRLEN];
 	int client_sock;
 	struct sigaction sa;
+	struct pollfd pollster[1+ADMIN_MAX_LISTEN];
+	int pollster_count, i;
+	int cpu = -1;
+	pid_t pid;
+
+	if(forking) {
+		admin_listen(muditm_config->gkf);
+	}
+
+	/* the listeners all go in one poll(), so accept() shouldn't block on
+	 * a connection that went away in between. */
+	fcntl(mother_sock,F_SETFL,O_NONBLOCK);
+	pollster[0].fd = mother_sock;
+	pollster[0].events = POLLIN;
+	for(i=0; i<admin_sock_count; i++) {
+		pollster[1+i].fd = admin_sock[i];
+		pollster[1+i].events = POLLIN;
+	}
+	pollster_count = 1+admin_sock_count;
 
 	muditm_log("Accepting Client Connections.");
 
@@ -230,31 +183,115 @@ int demonize(int mother_sock, int forking) {
 			muditm_log("Failed to set the zombie_killer sigaction: %s",strerror(errno));
 			return(-1);
 		}
+
+		/* no SA_RESTART, so that accept() comes back to do the reload. */
+		sa.sa_handler = config_sighup;
+		sigemptyset(&sa.sa_mask);
+		sa.sa_flags = 0;
+		if(sigaction(SIGHUP,&sa,NULL) == -1) {
+			muditm_log("Failed to set the SIGHUP sigaction: %s",strerror(errno));
+			return(-1);
+		}
+
+		sa.sa_handler = upgrade_sigusr2;
+		if(sigaction(SIGUSR2,&sa,NULL) == -1) {
+			muditm_log("Failed to set the SIGUSR2 sigaction: %s",strerror(errno));
+			return(-1);
+		}
+
+		/* if an older muditm handed us the listener, it can stop now. */
+		upgrade_ready();
 	}
 
 	while(1) {
 
+		if(config_reload_pending) {
+			reload_config();
+		}
+
+		if(upgrade_pending) {
+			upgrade_pending = 0;
+			/* the new one needs the admin ports.  They come back if it
+			 * doesn't work out. */
+			admin_close();
+			if(upgrade_start(mother_sock)) {
+				close(mother_sock);
+				return(retire());
+			}
+			admin_listen(muditm_config->gkf);
+			for(i=0; i<admin_sock_count; i++) {
+				pollster[1+i].fd = admin_sock[i];
+				pollster[1+i].events = POLLIN;
+			}
+			pollster_count = 1+admin_sock_count;
+		}
+
+		/* wake up now and then to add up the session stats, even if
+		 * nobody connects. */
+		if(poll(pollster,pollster_count,stats?(stats->interval*1000):-1) == -1) {
+			if(errno == EINTR) {
+				continue;
+			}
+			muditm_log("Polling error: %s",strerror(errno));
+			return(-1);
+		}
+		stats_publish();
+
+		for(i=1; i<pollster_count; i++) {
+			if(pollster[i].revents & POLLIN) {
+				admin_serve(pollster[i].fd);
+			}
+		}
+		if(!(pollster[0].revents & POLLIN)) {
+			continue;
+		}
+
 		addrlen = sizeof(addr);
 
 		client_sock = accept(mother_sock,(struct sockaddr*)&addr,&addrlen);
+
+		if( (client_sock < 0) &&
+			((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK))
+		) {
+			continue;
+		}
+
 		if(client_sock <0) {
 			muditm_log("I can't accept that from the likes of you! %s",strerror(errno));
 			return(-1);
 		}
 
-		if(forking && fork()) {
+		stats_accepted();
+		cpu = affinity_pick(muditm_config,client_sock);
+
+		if(forking && (pid = fork())) {
+			if(pid > 0) {
+				__atomic_add_fetch(&sessions_running,1,__ATOMIC_RELAXED);
+			}
 			close(client_sock);
 			client_sock = -1;
 			continue;
 		} else {
 			close(mother_sock);
 			mother_sock = -1;
+			admin_close();
+			/* a reload is none of the session's business, and a signal
+			 * would only interrupt its poll(). */
+			signal(SIGHUP,SIG_IGN);
+			signal(SIGUSR2,SIG_IGN);
+			/* a write to a side that hung up is an EPIPE to handle,
+			 * not the end of the session's stats. */
+			signal(SIGPIPE,SIG_IGN);
+			affinity_pin(cpu);
 			break;
 		}
 	}
 
 	inet_ntop(addr.sin6_family,&addr.sin6_addr,addrstr,sizeof(addrstr));
+	muditm_log_tag(addrstr);
 	muditm_log("Connect from %s",addrstr);
+	TRACE2(session__accept,client_sock,addrstr);
+	stats_session_start(addrstr);
 	return(client_sock);
 
 }
@@ -274,28 +311,16 @@ int main(int argc, char **argv)
 
 	/* local variables. */
 	char *configfilename = NULL;
-	GKeyFile *gkf;
+	Config *conf;
 	int debug = 0;
+	int demon;
 	int mother_sock;
-	SSL_CTX *ctx = NULL;
 	Endpoint *client;
 	Endpoint *game;
 	int count;
 	Iobuf *iob;
-
-	/* configuration setable variables */
-	int listening_port = 4143;  /* PARAM */
-	char *client_security;
-	char *client_compression;
-	char *game_host;
-	char *game_service;
-	char *game_security;
-	char *game_compression;
-	char *cert_file;
-	char *key_file;
-	char *chain_file;
-	char *log_file;
-	int demon = 1;
+	struct backend *b;
+	char addrbuf[INET6_ADDRSTRLEN];
 
 	muditm_proxy_name = get_proxy_name();
 
@@ -335,108 +360,160 @@ int main(int argc, char **argv)
 	if(configfilename == NULL) {
 		configfilename = CONFIG_FILE;
 	}
-	gkf = g_key_file_new();
-
-	if(!g_key_file_load_from_file(gkf,configfilename,G_KEY_FILE_NONE,NULL)){
-		fprintf(stderr,"Couldn't read config file %s\n",CONFIG_FILE);
+	/* everything gets read and checked once, here.  SIGHUP reads it again. */
+	if( !(conf = load_config(configfilename,1)) ) {
 		exit(EXIT_FAILURE);
 	}
+	muditm_config = conf;
 
-	listening_port = get_conf_int(gkf,"muditm","listen",4143);
-	demon = get_conf_boolean(gkf,"muditm","demon",1);
-	client_security = get_conf_string(gkf,"client","security","none");
-	game_security = get_conf_string(gkf,"game","security","none");
-	game_host = get_conf_string(gkf,"game","host","::");
-	game_service = get_conf_string(gkf,"game","service","4000");
-	cert_file = get_conf_string(gkf,"ssl","cert","cert.pem");
-	key_file = get_conf_string(gkf,"ssl","key","key.pem");
-	chain_file = get_conf_string(gkf,"ssl","chain","");
-	log_file = g_key_file_get_string(gkf, "muditm", "log-file", NULL);
-	client_compression = get_conf_string(gkf,"client","compression","enable");
-	game_compression = get_conf_string(gkf,"game","compression","enable");
-
+	demon = conf->demon;
 	if(debug) {
 		demon = 0;
 	}
 
-	muditm_log_init(log_file);
+	muditm_log_init(conf->log_file);
+	/* before anything else forks, so they all log through it. */
+	muditm_log_start(conf->log_ring,conf->log_format);
 
 	muditm_log("Starting %s", muditm_proxy_name);
 
-	SSL_load_error_strings();
-	OpenSSL_add_ssl_algorithms();
-	/* start listening for the client end */
-	mother_sock = new_mommie(listening_port);
+	apply_config(conf);
+
+	/* start listening for the client end, unless an older muditm or systemd
+	 * already is. */
+	if( (mother_sock = upgrade_listener(argv)) == -1) {
+		mother_sock = new_mommie(conf->listen);
+	}
+	/* the sessions' sockets get these from the listener, which is the only
+	 * place the buffer sizes count for the window scaling. */
+	sockopt_apply(mother_sock,conf->client_sockopt,"listener");
+	affinity_busy_poll(conf,mother_sock,"listener");
+
+	/* the ticket keys and session caches have to exist before the first fork
+	 * for all of the sessions to share them. */
+	if( (!strcasecmp(conf->client_security,"SSL")) ||
+		(!strcasecmp(conf->game_security,"SSL"))
+	) {
+		sslcache_init(conf->gkf);
+	}
+	if(!strcasecmp(conf->client_security,"SSL")) {
+		sslcache_attach(conf->ctx);
+		handshake_init(conf->gkf);
+	}
+	stats_init(conf->gkf);
+	/* the game server list is shared the same way, and its health checker
+	 * forks off here. */
+	if(!backend_init(conf)) {
+		exit(EXIT_FAILURE);
+	}
 
 	client = new_endpoint("Client");
 
-	if( (client->socket = demonize(mother_sock,demon)) == -1) {
-		goto cleanup_client;
-	}
+	client->socket = demonize(mother_sock,demon);
 
-	/* load ssl data after the fork, so that each new client connect will read
-	 * the keys again, in case they have been updated. */
-	if( (!strcasecmp(client_security,"SSL")) ||
-		(!strcasecmp(game_security,"SSL"))
-	) {
-		ctx = SSL_CTX_new(TLS_method());
-		configure_context(ctx,cert_file,key_file,chain_file);
+	/* this session sticks with whatever config was current when it forked. */
+	conf = muditm_config;
+
+	if(client->socket == -1) {
+		goto cleanup_client;
 	}
+	stats_session_attach(client,STATS_CLIENT);
+	/* again, in case a reload changed them. */
+	sockopt_apply(client->socket,conf->client_sockopt,"client side");
+	client->quickack = conf->client_sockopt->quickack;
 
-	if(!strcasecmp(client_security,"SSL")) {
-		if( ssl_start_endpoint(client, ctx,0) <= 0) {
+	if(!strcasecmp(conf->client_security,"SSL")) {
+		if( ssl_start_endpoint(client, conf->ctx,0) <= 0) {
 			goto cleanup_client;
 		} 
+		sslcache_count(client->ssl);
 	}
 
-	configure_compression(client,client_compression);
+	configure_compression(client,conf->client_compression);
+	configure_deflate(client,conf->client_tune);
 
 	/* open up the game end. */
 	game = new_endpoint("Game");
+	stats_session_attach(game,STATS_GAME);
 
-
-	if ( (game->socket = game_connect(game_host,game_service)) == -1) {
+	addr_endpoint(client,addrbuf,sizeof(addrbuf));
+	if ( (game->socket = backend_connect(addrbuf,conf->game_sockopt,&b)) == -1) {
 		char reply[] = "Couldn't connect to server!\r\n";
 		write_endpoint(client,reply,strlen(reply));
 		goto cleanup_game;
 	}
+	affinity_busy_poll(conf,game->socket,"game side");
+	game->quickack = conf->game_sockopt->quickack;
 	
-	if(!strcasecmp(game_security,"SSL")) {
-		configure_context(ctx,cert_file,key_file,chain_file);
-		if( ssl_start_endpoint(game, ctx,1) <= 0) {
+	if(!strcasecmp(conf->game_security,"SSL")) {
+		if( ssl_connect_endpoint(game, conf->game_ctx,
+			(*(conf->game_ssl_servername))?conf->game_ssl_servername:b->host,
+			b->name) <= 0
+		) {
 			char reply[] = "Couldn't ssl to to server!\r\n";
 			write_endpoint(client,reply,strlen(reply));
 			goto cleanup_game;
 		}
 	}
 
+	TRACE3(game__connect,game->socket,b->host,b->service);
+
 	/* perhaps send the PROXY header. */
-	if(get_conf_boolean(gkf,"muditm","stunnelproxy",0)) {
+	if(conf->stunnelproxy) {
 		iob = game->iobuf[EP_OUTPUT];
 		count = stunnel_proxy_header1(client,tail_iobuf(iob),avail_iobuf(iob));
 		muditm_log("Sent %.*s to %s",count-2,tail_iobuf(iob),game->name);
 		push_iobuf(iob,count);
 		flush_endpoint(game);
 	}
-	configure_compression(game,game_compression);
+	configure_compression(game,conf->game_compression);
+	configure_deflate(game,conf->game_tune);
+
+	capture_start(conf,client,game);
 
 	/* start proxying */
-	if (muditm_proxy(client,game,gkf) == -1) {
+	if (muditm_proxy(client,game,conf) == -1) {
 		muditm_log("Proxy ended abnormaly.");
 	}
 
+	capture_end();
+	TRACE2(session__close,client->sockstats.lifetime.in,client->sockstats.lifetime.out);
+
+	stats_session_end(client,game);
+
 	/* LOG THE iostats here. */
 	log_endpoint_stats(client);
 	log_endpoint_stats(game);
+	if(counters.reads) {
+		char cbuf[512];
+		counters_printstats(cbuf,sizeof(cbuf),&counters);
+		muditm_log("Hot path %s",cbuf);
+	}
+	if(zarena.mallocs) {
+		char zbuf[256];
+		zcodec_printstats(zbuf,sizeof(zbuf));
+		muditm_log("%s",zbuf);
+	}
+	if(sslcache) {
+		char sbuf[256];
+		sslcache_printstats(sbuf,sizeof(sbuf));
+		muditm_log("%s",sbuf);
+	}
+	if(handshake) {
+		char hbuf[256];
+		handshake_printstats(hbuf,sizeof(hbuf));
+		muditm_log("%s",hbuf);
+	}
 
 	/*cleanup_game: */
 	cleanup_game:
+	backend_release();
 	free_endpoint(game);
 
 	cleanup_client:
 	free_endpoint(client);
 
-	if(ctx) SSL_CTX_free(ctx);
+	free_config(conf);
 	EVP_cleanup();
 
 	free(muditm_proxy_name);
@@ -481,4 +558,20 @@ void log_endpoint_stats(Endpoint *ep) {
 		}
 		muditm_log("%s",buf);
 	}
+
+	/* how long we sat on what came in from this side. */
+	if( ep->latency.count > 0 ) {
+		s=buf;
+		s += g_snprintf(s,eos-s,"%s forwarding latency ",ep->name);
+		s += hist_printstats(s,eos-s,&(ep->latency));
+		muditm_log("%s",buf);
+	}
+
+	/* and what deflate was set to, if we did any compressing. */
+	if( ep->mccpstats.lifetime.out >0 ) {
+		s=buf;
+		s += g_snprintf(s,eos-s,"%s deflate ",ep->name);
+		s += mccp_printtune(s,eos-s,ep);
+		muditm_log("%s",buf);
+	}
 }
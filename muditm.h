@@ -36,6 +36,8 @@
 extern char *muditm_proxy_name;
 
 /* exported function declarations */
-
+char *get_conf_string(GKeyFile * gkf, gchar * group, gchar * key, gchar * def);
+int get_conf_int(GKeyFile * gkf, gchar * group, gchar * key, int def);
+int get_conf_boolean(GKeyFile * gkf, gchar * group, gchar * key, int def);
 
 #endif /* MUDITM_MUDITM_H */
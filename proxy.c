@@ -32,6 +32,7 @@
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <unistd.h>
 #include <glib.h>
 
@@ -42,6 +43,13 @@
 #include "proxy.h"
 #include "mccp.h"
 #include "handlers.h"
+#include "handshake.h"
+#include "sslcache.h"
+#include "stats.h"
+#include "counters.h"
+#include "capture.h"
+#include "trace.h"
+#include "sockopt.h"
 
 Endpoint *new_endpoint(char *name) {
 	Endpoint *ep;
@@ -55,6 +63,9 @@ Endpoint *new_endpoint(char *name) {
 		ep->name = strdup("unnamed");
 	}
 	ep->socket = -1;
+	ep->quickack = 0;
+	ep->unsent = 0;
+	ep->wants = POLLOUT;
 	ep->ssl = NULL;
 	ep->mnes_state = 0;
 	ep->matching_enabled = 0;
@@ -62,10 +73,14 @@ Endpoint *new_endpoint(char *name) {
 	ep->re = NULL;
 	ep->match_data = NULL;
 	ep->mccp_mode = MCCP_DISABLE;
+	ep->mccp_tune = NULL;
+	ep->mccp_relay = NULL;
+	ep->mccp_relay_src = NULL;
 
-	/* alloc the iobuf for each available direction */
+	/* alloc the iobuf for each available direction.  The output side is
+	 * also where writes wait for the socket, so it gets more. */
 	for(e=0;e<EP_MAX;e++) {
-		ep->iobuf[e] = new_iobuf(EP_BUFSIZE);
+		ep->iobuf[e] = new_iobuf((e == EP_OUTPUT)?EP_OUTQUEUE:EP_BUFSIZE);
 	}
 
 	/* NULL the mccp zlib state in each direction. State will be allocated when
@@ -74,8 +89,13 @@ Endpoint *new_endpoint(char *name) {
 		ep->mccp[e] = NULL;
 		ep->ziobuf[e] = new_iobuf(EP_BUFSIZE);
 	}
+	ep->sockstats.shared = NULL;
+	ep->mccpstats.shared = NULL;
 	iostat_init(&(ep->sockstats));
 	iostat_init(&(ep->mccpstats));
+	hist_init(&(ep->latency));
+	ep->latency_ts.tv_sec = 0;
+	ep->latency_ts.tv_nsec = 0;
 
 	return(ep);
 
@@ -83,7 +103,7 @@ Endpoint *new_endpoint(char *name) {
 
 void free_endpoint(Endpoint *ep) {
 	GList *l;
-	z_stream *z;
+	Zstream *z;
 	int e;
 
 	if(!ep) return;
@@ -109,14 +129,16 @@ void free_endpoint(Endpoint *ep) {
 		z = ep->mccp[e];
 		if(z) { 
 			if(e == EP_OUTPUT) {
-				deflateEnd(z);
+				end_deflate_zstream(z);
 			} else {
-				inflateEnd(z);
+				end_inflate_zstream(z);
 			}
-			free(z);
+			free_zstream(z);
 		}
 		if(ep->ziobuf[e]) free_iobuf(ep->ziobuf[e]);
 	}
+	if(ep->mccp_relay) free_relay(ep->mccp_relay);
+	if(ep->mccp_tune) free(ep->mccp_tune);
 
 	free(ep);
 }
@@ -226,57 +248,197 @@ ssize_t read_endpoint_sock(Endpoint *ep, void *buf, size_t count) {
 	} else {
 		readsize = read(ep->socket,buf,count);
 	}
+	TRACE3(read,ep->name,ep->socket,readsize);
+	counters.reads++;
+	counters.read_bytes += MAX(0,readsize);
 	iostat_incr(&(ep->sockstats),readsize,0);
 	return(readsize);
 }
 
 ssize_t read_endpoint(Endpoint *ep, void *buf, size_t count) {
 
-	if(ep->mccp[EP_INPUT]) {
-		return(read_endpoint_compressed(ep,buf,count));
-	}
-	return(read_endpoint_sock(ep,buf,count));
+	ssize_t ret;
 
+	/* inflating, or holding plain bytes from after a stream ended. */
+	if(ep->mccp[EP_INPUT] || ep->mccp_relay || len_iobuf(ep->ziobuf[EP_INPUT])) {
+		ret = read_endpoint_compressed(ep,buf,count);
+	} else {
+		ret = read_endpoint_sock(ep,buf,count);
+	}
+	/* the kernel goes back to delayed ACKs on its own.  The line or prompt
+	 * is looked for here, after inflate, since deflate output can end in
+	 * anything. */
+	if(ep->quickack && (ret > 0)) {
+		counters.quickacks += sockopt_quickack(ep->socket,buf,ret);
+	}
+	return(ret);
 }
 
+/* Sends what a handler put in iobuf[EP_OUTPUT].  It sits behind anything
+ * still waiting for the socket, and has to go through deflate first, so
+ * it's taken out and written like anything else. */
 ssize_t flush_endpoint(Endpoint *ep) {
-	int ret;
-	ret = write_endpoint(ep,head_iobuf(ep->iobuf[EP_OUTPUT]),len_iobuf(ep->iobuf[EP_OUTPUT]));
-	if(ret > 0) {
-		pop_iobuf(ep->iobuf[EP_OUTPUT],ret);
+
+	Iobuf *out = ep->iobuf[EP_OUTPUT];
+	size_t staged = len_iobuf(out) - ep->unsent;
+	char *copy;
+	ssize_t ret;
+
+	if(staged == 0) {
+		return(0);
 	}
+	copy = (char *)malloc(staged);
+	memcpy(copy,head_iobuf(out)+ep->unsent,staged);
+	popall_iobuf(out);
+	push_iobuf(out,ep->unsent);
+
+	ret = write_endpoint(ep,copy,staged);
+	free(copy);
 	return(ret);
 }
 
-ssize_t write_endpoint_sock(Endpoint *ep, void *buf, size_t count) {
+/* As much of buf as the socket takes right now.  Returns the bytes
+ * written, 0 if there's no room, or -1 on an error.  Sets ep->wants to what
+ * poll() has to wait on before trying again. */
+ssize_t send_endpoint_sock(Endpoint *ep, char *buf, size_t count) {
+
+	ssize_t writesize;
+	size_t done = 0;
+	int err;
+
+	ep->wants = POLLOUT;
+	while(done < count) {
+		/* if socket is ssl, use SSL_write. */
+		if(ep->ssl) {
+			writesize = SSL_write(ep->ssl,buf+done,count-done);
+		} else {
+			writesize = write(ep->socket,buf+done,count-done);
+		}
+		TRACE3(write,ep->name,ep->socket,writesize);
+		counters.writes++;
+		counters.write_bytes += MAX(0,writesize);
+		iostat_incr(&(ep->sockstats),0,writesize);
 
-	int writesize, err;
-	
-	/* if socket is ssl, use SSL_write. */
-	if(ep->ssl) {
-		while(1) {
-			writesize = SSL_write(ep->ssl,buf,count);
-			if(writesize == -1) {
-				err = SSL_get_error(ep->ssl,writesize);
-				if(err == SSL_ERROR_WANT_WRITE) {
-					continue;
-				}
+		if(writesize > 0) {
+			done += writesize;
+			continue;
+		}
+		if(ep->ssl) {
+			err = SSL_get_error(ep->ssl,writesize);
+			if(err == SSL_ERROR_WANT_WRITE) {
+				break;
 			}
+			if(err == SSL_ERROR_WANT_READ) {
+				ep->wants = POLLIN;
+				break;
+			}
+		} else if(writesize == -1) {
+			if(errno == EINTR) {
+				continue;
+			}
+			if( (errno == EAGAIN) || (errno == EWOULDBLOCK) ) {
+				break;
+			}
+		}
+		/* a real error.  If some went out first, the next try will
+		 * get it. */
+		if(done) {
 			break;
 		}
-	} else {
-		/* fixme... ewouldblock, eagain... */
-		writesize = write(ep->socket,buf,count);
+		return(-1);
+	}
+	return(done);
+}
+
+/* Nothing here waits for the socket.  With a low TCP_NOTSENT_LOWAT the
+ * kernel takes only a little at a time, and one slow reader can't be
+ * allowed to hold up the whole session.  What doesn't fit goes on the
+ * queue at the head of iobuf[EP_OUTPUT], and muditm_proxy() sends it when
+ * poll() says there's room.  Returns count once it's all written or
+ * queued, or -1. */
+ssize_t write_endpoint_sock(Endpoint *ep, void *buf, size_t count) {
+
+	Iobuf *out = ep->iobuf[EP_OUTPUT];
+	ssize_t writesize = 0;
+	size_t left, staged;
+
+	/* anything already waiting goes first. */
+	if( ep->unsent && (drain_endpoint(ep) == -1) ) {
+		return(-1);
+	}
+	if( !ep->unsent && ((writesize = send_endpoint_sock(ep,buf,count)) == -1) ) {
+		return(-1);
+	}
+	if( (left = count - writesize) == 0) {
+		return(count);
+	}
+
+	if(left > avail_iobuf(out)) {
+		/* the far side hasn't taken anything in a long while.  Dropping
+		 * some of the stream would garble it, so hang up instead. */
+		muditm_log("%s isn't taking its output, %zu B waiting.  Hanging up.",ep->name,ep->unsent);
+		shutdown(ep->socket,SHUT_RDWR);
+		errno = ENOBUFS;
+		return(-1);
+	}
+	/* in front of anything a handler has put there since. */
+	staged = len_iobuf(out) - ep->unsent;
+	if(staged) {
+		memmove(head_iobuf(out)+ep->unsent+left,head_iobuf(out)+ep->unsent,staged);
+	}
+	memcpy(head_iobuf(out)+ep->unsent,(char *)buf+writesize,left);
+	push_iobuf(out,left);
+	ep->unsent += left;
+	return(count);
+}
+
+/* the socket has room.  Send what's been waiting for it.  Returns the bytes
+ * sent, or -1. */
+ssize_t drain_endpoint(Endpoint *ep) {
+
+	ssize_t ret;
+
+	if(ep->unsent == 0) {
+		return(0);
+	}
+	if( (ret = send_endpoint_sock(ep,head_iobuf(ep->iobuf[EP_OUTPUT]),ep->unsent)) > 0) {
+		pop_iobuf(ep->iobuf[EP_OUTPUT],ret);
+		ep->unsent -= ret;
+	}
+	return(ret);
+}
+
+/* The session is over, but what was sent last, like the game's goodbye,
+ * gets up to ms to go out. */
+void linger_endpoint(Endpoint *ep, int ms) {
+
+	struct pollfd pfd;
+	struct timespec start, now;
+	int left;
+
+	clock_gettime(CLOCK_MONOTONIC,&start);
+	while( ep->unsent && (ep->socket >= 0) ) {
+		clock_gettime(CLOCK_MONOTONIC,&now);
+		left = ms - ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
+		if(left <= 0) {
+			muditm_log("%s hung up with %zu B still waiting.",ep->name,ep->unsent);
+			return;
+		}
+		pfd.fd = ep->socket;
+		pfd.events = ep->wants;
+		if( (poll(&pfd,1,left) == -1) && (errno != EINTR) ) {
+			return;
+		}
+		if(drain_endpoint(ep) == -1) {
+			return;
+		}
 	}
-		
-	iostat_incr(&(ep->sockstats),0,writesize);
-	return(writesize);
 }
 
 ssize_t write_endpoint(Endpoint *ep, void *buf, size_t count) {
 
-	/* if compression active... */
-	if(ep->mccp[EP_OUTPUT]) {
+	/* if compression active, or relaying another side's compressed stream... */
+	if(ep->mccp[EP_OUTPUT] || ep->mccp_relay_src) {
 		return(write_endpoint_compressed(ep,buf,count));
 	}
 	return(write_endpoint_sock(ep,buf,count));
@@ -294,6 +456,8 @@ int ssl_start_endpoint(Endpoint *ep, SSL_CTX *ctx, int connect) {
 
 	ep->ssl = SSL_new(ctx);
 	SSL_set_fd(ep->ssl,ep->socket);
+	/* writes that don't fit get retried later from the output queue. */
+	SSL_set_mode(ep->ssl,SSL_MODE_ENABLE_PARTIAL_WRITE|SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 
 	muditm_log("%s SSL start on socket %d",ep->name,ep->socket);
 	if(connect) {
@@ -302,34 +466,257 @@ int ssl_start_endpoint(Endpoint *ep, SSL_CTX *ctx, int connect) {
 			return(ret);
 		} 
 		muditm_log("%s SSL connected on socket %d",ep->name,ep->socket);
+		TRACE3(handshake__done,ep->name,ep->socket,SSL_session_reused(ep->ssl));
 	} else {
-		if ( (ret=SSL_accept(ep->ssl)) <= 0) {
+		if ( (ret=handshake_accept(ep->ssl,ep->socket)) <= 0) {
 			muditm_sslerr("%s SSL_accept",ep->name);
 			return(ret);
 		} 
 		muditm_log("%s SSL accepted on socket %d",ep->name,ep->socket);
+		TRACE3(handshake__done,ep->name,ep->socket,SSL_session_reused(ep->ssl));
 	}
 
 	return(ret);
 }
 
 
-int muditm_proxy(Endpoint *client, Endpoint *game, GKeyFile *gkf) {
+/* the game side, as an SSL client.  servername goes out as SNI and is what
+ * the cert has to match if the context verifies.  session_name is what the
+ * game's sessions get saved under, so the next connection can resume. */
+int ssl_connect_endpoint(Endpoint *ep, SSL_CTX *ctx, char *servername, char *session_name) {
 
-	struct pollfd pollster[2];
-	struct flow_data flow[2];
-	int pollster_count = 2;
-	int polltimeout = 1000;
-	int ready;
-	ssize_t bytes_recv, bytes_sent;
+	struct in6_addr addr;
+	int ret;
+
+	if (!ctx) {
+		muditm_log("Missing SSL context!");
+		muditm_sslerr("Missing SSL context!");
+		exit(EXIT_FAILURE);
+	}
+
+	ep->ssl = SSL_new(ctx);
+	SSL_set_fd(ep->ssl,ep->socket);
+	/* writes that don't fit get retried later from the output queue. */
+	SSL_set_mode(ep->ssl,SSL_MODE_ENABLE_PARTIAL_WRITE|SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+	/* SNI is only for names, not addresses. */
+	if( *servername &&
+		(inet_pton(AF_INET,servername,&addr) != 1) &&
+		(inet_pton(AF_INET6,servername,&addr) != 1)
+	) {
+		SSL_set_tlsext_host_name(ep->ssl,servername);
+	}
+	if(SSL_CTX_get_verify_mode(ctx) & SSL_VERIFY_PEER) {
+		SSL_set1_host(ep->ssl,servername);
+	}
+	sslcache_upstream_resume(ep->ssl,session_name);
+
+	muditm_log("%s SSL start on socket %d",ep->name,ep->socket);
+	if ( (ret=SSL_connect(ep->ssl)) <= 0) {
+		if(SSL_get_verify_result(ep->ssl) != X509_V_OK) {
+			muditm_log("%s SSL cert for %s didn't verify: %s",ep->name,servername,
+				X509_verify_cert_error_string(SSL_get_verify_result(ep->ssl))
+			);
+		}
+		muditm_sslerr("%s SSL_connect",ep->name);
+		return(ret);
+	} 
+	sslcache_upstream_count(ep->ssl);
+	muditm_log("%s SSL connected on socket %d",ep->name,ep->socket);
+	TRACE3(handshake__done,ep->name,ep->socket,SSL_session_reused(ep->ssl));
+
+	return(ret);
+}
+
+/* true if ep is holding input that was already taken off the socket, by
+ * TLS or by inflate, so there is work to do even if poll() doesn't say so.
+ * If there's no room to put it, there's nothing to be done yet either. */
+int endpoint_pending(Endpoint *ep) {
+
+	if(avail_iobuf(ep->iobuf[EP_INPUT]) == 0) {
+		return(0);
+	}
+	if(ep->ssl && (SSL_pending(ep->ssl) > 0)) {
+		return(1);
+	}
+	return(mccp_pending(ep));
+}
+
+/* The read stage.  socket, TLS, and inflate, into the input iobuf, as much
+ * as the flow's rate limit and quantum allow.  Returns
+ * the bytes added, 0 if nothing came in this time, -1 on an error, or -2 if
+ * the other end hung up.  polled is set if poll() said there was something to read, rather
+ * than the loop coming back for pending work. */
+ssize_t pull_flow(struct flow_data *f, int polled) {
+
+	Iobuf *iob;
+	ssize_t bytes_recv;
+	size_t count;
+	int compressed;
+	struct timespec start;
+
+	iob = (f->in->iobuf[EP_INPUT]);
+	if( (count = shape_allow(&(f->shape),avail_iobuf(iob))) == 0) {
+		return(0);
+	}
+
+	/* the forwarding latency counts TLS and inflate too, so the clock
+	 * starts before the read, and only sticks if something came of it. */
+	clock_gettime(CLOCK_MONOTONIC,&start);
+
+	compressed = (f->in->mccp[EP_INPUT] != NULL);
+	bytes_recv = read_endpoint(f->in,tail_iobuf(iob),count);
+	if(bytes_recv == -1) {
+		if( (errno == EAGAIN) || 
+			(errno == EWOULDBLOCK)
+		) {
+			/* If compression is enabled, read_endpoint may need to do
+			 * multiple read()'s before it can return data, and only
+			 * the first read() is guarenteed to return some bytes.  And
+			 * pending work might not have been enough for a whole
+			 * read. */
+			if(polled) {
+				muditm_log("%s wasn't really ready.",f->in->name);
+			}
+			return(0);
+		}
+		muditm_log("%s errno %d %s",f->in->name, errno, strerror(errno));
+		return(-1);
+	}	
+	if(bytes_recv == 0) {
+		/* He hung up. */
+		muditm_log("%s has closed the connection.",f->in->name);
+		return(-2);
+	}	
+	if(!f->in->latency_ts.tv_sec) {
+		f->in->latency_ts = start;
+	}
+	capture_frame(f->in,tail_iobuf(iob),bytes_recv,compressed?CAPTURE_MCCP:0);
+	push_iobuf(iob,bytes_recv);
+	shape_charge(&(f->shape),bytes_recv);
+	return(bytes_recv);
+}
+
+/* The match stage.  Run the patterns and handlers over the input iobuf, and
+ * write out whatever is done with to the other side, which takes care of
+ * deflate, TLS and the socket. */
+void match_flow(struct flow_data *f, Config *conf) {
+
+	Iobuf *iob;
+	ssize_t bytes_sent;
 	size_t match_len;
 	int ret;
 	struct pattern_data *p;
 	PCRE2_SIZE *ovector;
 	int handled;
+	struct timespec start, end;
 
+	iob = (f->in->iobuf[EP_INPUT]);
 
-	Iobuf *iob;
+	/* This is the creamy filling in the middle.  (The pcre2
+	 * pattern matching loop.)  */
+	while(1) {
+
+		/* matching_enabled is a flag to tell if any matching
+		 * should be tried at all, and without checking for or
+		 * getting rid of any of the configured patterns that might
+		 * exist.  Bascially allows the endpoint to simply go
+		 * transparent, should that be needed, as is the case when
+		 * the stream leaves telnet mode for mccp zlib compression
+		 * mode. */
+		if( f->in->matching_enabled ) {
+			counters.matches++;
+			counters.match_bytes += len_iobuf(iob);
+			/* run pcre2. */
+			ret = pcre2_match( f->in->re,
+				(PCRE2_SPTR)head_iobuf(iob), len_iobuf(iob),
+				0,
+				PCRE2_PARTIAL_HARD,
+				f->in->match_data,
+				NULL
+			);
+		} else {
+			/* A small lie. Not really an error, matches are just
+			 * disabled.*/
+			ret = PCRE2_ERROR_NOMATCH;
+		}
+
+		if (ret == PCRE2_ERROR_NOMATCH ) {
+			/* write the whole buffer */
+			bytes_sent = write_endpoint(f->out,head_iobuf(iob),len_iobuf(iob));
+			popall_iobuf(iob);
+			/* done, all available input is processed! */
+			break;
+		} else if (ret == PCRE2_ERROR_PARTIAL) {
+			/* still needing to add more input. */
+			counters.partials++;
+			muditm_log("partial match...");
+			break;
+		} else {
+			/* we've got a match to handle. */
+			ovector = pcre2_get_ovector_pointer(f->in->match_data);
+
+			match_len = (ovector[1]-ovector[0]);
+			TRACE3(match,f->in->name,ret-2,match_len);
+
+			/* ship all of the bytes up to, but not including, the match. */
+			if(ovector[0]>0) {
+				bytes_sent = write_endpoint(f->out,
+					head_iobuf(iob), 
+					ovector[0]
+				);
+				pop_iobuf(iob,ovector[0]);
+			}
+
+			/* match is now at head_iobuf(iob) */
+
+			/* get a pointer to the pattern that matched. */
+			handled = 0;
+			if ( (p = g_list_nth_data(f->in->patterns,ret-2))) {
+				if(p->action) {
+					/* trigger(iobuf_of_match,match_len,fromendpoint,toendpoint) */
+					TRACE3(handler__entry,f->in->name,p->counter,match_len);
+					clock_gettime(CLOCK_MONOTONIC,&start);
+					handled = (p->action)(iob,match_len,f->in,f->out,conf);
+					clock_gettime(CLOCK_MONOTONIC,&end);
+					TRACE3(handler__return,f->in->name,p->counter,handled);
+					counters.action_calls[p->counter]++;
+					counters.action_nsec[p->counter] += (end.tv_sec - start.tv_sec) * 1000000000L +
+						(end.tv_nsec - start.tv_nsec);
+				} else {
+					muditm_log("null pattern handler?");
+				}
+			} else {
+				muditm_log("Couldn't find the pattern_data that matched?");
+			}
+
+			if(!handled) {
+				/* the trigger left the input buffer for us to copy over*/
+				bytes_sent = write_endpoint(f->out,
+					head_iobuf(iob), 
+					match_len
+				);
+				pop_iobuf(iob,match_len);
+			}
+
+			if(len_iobuf(iob)>0) {
+				continue;
+			} else {
+				break;
+			}
+		}	/* end of match to handle */
+	}	/* end of pcre2 matching loop */
+}
+
+int muditm_proxy(Endpoint *client, Endpoint *game, Config *conf) {
+
+	struct pollfd pollster[2];
+	struct flow_data flow[2];
+	int pollster_count = 2;
+	int polltimeout = 1000;
+	int ready, pending, reading[2];
+	ssize_t bytes_recv;
+	int ret;
 
 	/* set up the game side filters */
 	add_game_patterns(game);
@@ -343,11 +730,18 @@ int muditm_proxy(Endpoint *client, Endpoint *game, GKeyFile *gkf) {
 
 	/* if mccp is enabled, send WILL MCCP2 to the client side. */
 	offer_compression(client);
-	
-	pollster[0].fd = client->socket;
-	pollster[0].events = POLLIN;
+
+	/* the player's typing comes first in every pass, and neither side gets
+	 * more than its quantum of the pass. */
 	flow[0].in = client;
 	flow[0].out = game;
+	shape_init(&(flow[0].shape),conf->client_rate,conf->client_burst,conf->io_quantum);
+	flow[1].in = game;
+	flow[1].out = client;
+	shape_init(&(flow[1].shape),conf->game_rate,conf->game_burst,conf->io_quantum);
+
+	pollster[0].fd = client->socket;
+	pollster[0].events = POLLIN;
 
 	if(fcntl(client->socket,F_SETFL, O_NONBLOCK) == -1) {
 		muditm_log("Couldn't set client side to non-blocking io mode: ",strerror(errno));
@@ -357,8 +751,6 @@ int muditm_proxy(Endpoint *client, Endpoint *game, GKeyFile *gkf) {
 
 	pollster[1].fd = game->socket;
 	pollster[1].events = POLLIN;
-	flow[1].in = game;
-	flow[1].out = client;
 
 	if(fcntl(game->socket,F_SETFL, O_NONBLOCK) == -1) {
 		muditm_log("Couldn't set server side to non-blocking io mode: ",strerror(errno));
@@ -369,6 +761,50 @@ int muditm_proxy(Endpoint *client, Endpoint *game, GKeyFile *gkf) {
 
 	while(1) {
 
+		/* now and then, let the admin socket see how we're doing. */
+		stats_session_update(client,game);
+
+		/* don't sleep past a deflate stream's flush deadline. */
+		polltimeout = 1000;
+		for(int i=0;i<pollster_count;i++) {
+			int wait = mccp_flush_wait(flow[i].out);
+			if( (wait >= 0) && (wait < polltimeout) ) {
+				polltimeout = wait;
+			}
+		}
+
+		/* a side that's used up its rate limit doesn't get polled until
+		 * there's some more, and TCP holds up whoever is sending.  Same for
+		 * one whose output is still waiting on the other side's socket.
+		 * The player's commands still go through while the game's output
+		 * waits on them, unless the replies to those are piling up too. */
+		for(int i=0;i<pollster_count;i++) {
+			int wait = shape_wait(&(flow[i].shape));
+			reading[i] = !wait && !flow[i].out->unsent &&
+				(flow[i].in->unsent <= EP_OUTQUEUE/2);
+			pollster[i].events = (reading[i])?POLLIN:0;
+			if( wait && (wait < polltimeout) ) {
+				polltimeout = wait;
+			}
+			/* and this socket's own output, waiting for room. */
+			if(flow[i].in->unsent) {
+				pollster[i].events |= flow[i].in->wants;
+			}
+			/* a socket that hung up is always ready, so one that isn't
+			 * wanted for anything stays out of the poll. */
+			pollster[i].fd = (pollster[i].events)?flow[i].in->socket:-1;
+		}
+
+		/* and don't sleep at all if some stage is still holding input.  The
+		 * socket may never get readable again to come back for it. */
+		pending = 0;
+		for(int i=0;i<pollster_count;i++) {
+			if(reading[i] && endpoint_pending(flow[i].in)) {
+				pending = 1;
+				polltimeout = 0;
+			}
+		}
+
 		/* poll for input */
 		ready = poll(pollster,pollster_count,polltimeout);
 
@@ -378,124 +814,68 @@ int muditm_proxy(Endpoint *client, Endpoint *game, GKeyFile *gkf) {
 			goto cleanup;
 		}
 
-		if(ready == 0) {
+		if(ready == 0 && !pending) {
 			//muditm_log("Idle Tick...");
+			for(int i=0;i<pollster_count;i++) {
+				mccp_flush_check(flow[i].out);
+			}
 			continue;
 		}
 
+		/* send what's been waiting first, so new output goes behind it. */
 		for(int i=0;i<pollster_count;i++) {
-			if(pollster[i].revents & POLLIN) {
-				iob = (flow[i].in->iobuf[EP_INPUT]);
-				bytes_recv = read_endpoint(flow[i].in,tail_iobuf(iob),avail_iobuf(iob));
-				if(bytes_recv == -1) {
-					/* If compression is enabled, read_endpoint may need to do
-					 * multiple read()'s before it can return data, and only
-					 * the first read() is guarenteed to return some bytes. */
+			if( (ready > 0) && flow[i].in->unsent &&
+				(pollster[i].revents & (flow[i].in->wants|POLLERR|POLLHUP))
+			) {
+				if(drain_endpoint(flow[i].in) == -1) {
 					muditm_log("%s errno %d %s",flow[i].in->name, errno, strerror(errno));
-					if( (errno == EAGAIN) || 
-						(errno == EWOULDBLOCK)
-					) {
-						muditm_log("%s wasn't really ready.",flow[i].in->name);
-						/* so skip processing this one. */
-						continue;
-					}
 					ret=-1;
 					goto cleanup;
-				}	
-				if(bytes_recv == 0) {
-					/* He hung up. */
-					muditm_log("%s has closed the connection.",flow[i].in->name);
-					ret=1;
+				}
+			}
+		}
+
+		/* run each flow that has new input or pending input through its
+		 * stages.  Whatever is still pending after that gets picked up on
+		 * the next pass without waiting. */
+		for(int i=0;i<pollster_count;i++) {
+			int polled = reading[i] && (ready > 0) && (pollster[i].revents & POLLIN);
+			if( polled || (reading[i] && endpoint_pending(flow[i].in)) ) {
+				bytes_recv = pull_flow(&(flow[i]),polled);
+				if(bytes_recv < 0) {
+					ret = (bytes_recv == -2)?1:-1;
 					goto cleanup;
-				}	
-				push_iobuf(iob,bytes_recv);
-
-				/* This is the creamy filling in the middle.  (The pcre2
-				 * pattern matching loop.)  */
-				while(1) {
-
-					/* matching_enabled is a flag to tell if any matching
-					 * should be tried at all, and without checking for or
-					 * getting rid of any of the configured patterns that might
-					 * exist.  Bascially allows the endpoint to simply go
-					 * transparent, should that be needed, as is the case when
-					 * the stream leaves telnet mode for mccp zlib compression
-					 * mode. */
-					if( flow[i].in->matching_enabled ) {
-						/* run pcre2. */
-						ret = pcre2_match( flow[i].in->re,
-							(PCRE2_SPTR)head_iobuf(iob), len_iobuf(iob),
-							0,
-							PCRE2_PARTIAL_HARD,
-							flow[i].in->match_data,
-							NULL
-						);
-					} else {
-						/* A small lie. Not really an error, matches are just
-						 * disabled.*/
-						ret = PCRE2_ERROR_NOMATCH;
-					}
-
-					if (ret == PCRE2_ERROR_NOMATCH ) {
-						/* write the whole buffer */
-						bytes_sent = write_endpoint(flow[i].out,head_iobuf(iob),len_iobuf(iob));
-						popall_iobuf(iob);
-						/* done, all available input is processed! */
-						break;
-					} else if (ret == PCRE2_ERROR_PARTIAL) {
-						/* still needing to add more input. */
-						muditm_log("partial match...");
-						break;
-					} else {
-						/* we've got a match to handle. */
-						ovector = pcre2_get_ovector_pointer(flow[i].in->match_data);
-
-						match_len = (ovector[1]-ovector[0]);
-
-						/* ship all of the bytes up to, but not including, the match. */
-						if(ovector[0]>0) {
-							bytes_sent = write_endpoint(flow[i].out,
-								head_iobuf(iob), 
-								ovector[0]
-							);
-							pop_iobuf(iob,ovector[0]);
-						}
-
-						/* match is now at head_iobuf(iob) */
-
-						/* get a pointer to the pattern that matched. */
-						handled = 0;
-						if ( (p = g_list_nth_data(flow[i].in->patterns,ret-2))) {
-							if(p->action) {
-								/* trigger(iobuf_of_match,match_len,fromendpoint,toendpoint) */
-								handled = (p->action)(iob,match_len,flow[i].in,flow[i].out,gkf);
-							} else {
-								muditm_log("null pattern handler?");
-							}
-						} else {
-							muditm_log("Couldn't find the pattern_data that matched?");
-						}
-
-						if(!handled) {
-							/* the trigger left the input buffer for us to copy over*/
-							bytes_sent = write_endpoint(flow[i].out,
-								head_iobuf(iob), 
-								match_len
-							);
-							pop_iobuf(iob,match_len);
-						}
-
-						if(len_iobuf(iob)>0) {
-							continue;
-						} else {
-							break;
-						}
-					}	/* end of match to handle */
-				}	/* end of pcre2 matching loop */
-			}	/* end of polling loop */
+				}
+				if(bytes_recv > 0) {
+					match_flow(&(flow[i]),conf);
+				}
+				/* once everything read has been passed along, that's how
+				 * long we held it up.  Input held for a partial match
+				 * counts from when it was read. */
+				if( flow[i].in->latency_ts.tv_sec &&
+					(len_iobuf(flow[i].in->iobuf[EP_INPUT]) == 0)
+				) {
+					hist_since(&(flow[i].in->latency),&(flow[i].in->latency_ts));
+					flow[i].in->latency_ts.tv_sec = 0;
+				}
+			}
 		} /* end of pollster loop */
+
+		for(int i=0;i<pollster_count;i++) {
+			mccp_flush_check(flow[i].out);
+		}
 	}
 	cleanup:
+	for(int i=0;i<pollster_count;i++) {
+		linger_endpoint(flow[i].out,EP_LINGER_MS);
+	}
+	for(int i=0;i<pollster_count;i++) {
+		if(flow[i].shape.rate) {
+			char sbuf[128];
+			shape_printstats(sbuf,sizeof(sbuf),&(flow[i].shape));
+			muditm_log("%s %s",flow[i].in->name,sbuf);
+		}
+	}
 	return(ret);
 }
 
@@ -25,9 +25,12 @@
 
 #define PCRE2_CODE_UNIT_WIDTH 8
 #include <pcre2.h>
-#include <zlib.h>
 #include "iobuf.h"
+#include "zcodec.h"
+#include "config.h"
 #include "iostats.h"
+#include "histogram.h"
+#include "shape.h"
 
 /* global #defines */
 #define EP_INPUT 0
@@ -35,6 +38,8 @@
 #define EP_MAX 2
 
 #define EP_BUFSIZE (1<<16)
+#define EP_OUTQUEUE (EP_BUFSIZE*4)	/* iobuf[EP_OUTPUT], with room for a pass on top of what's waiting */
+#define EP_LINGER_MS 2000	/* how long what's still queued gets to go out at hangup */
 
 /* structs and typedefs */
 
@@ -47,8 +52,11 @@ struct buffer_data {
 struct endpoint_data {
 	char *name;
 	int socket;
+	int quickack;			/* set TCP_QUICKACK again after lines and prompts */
 	SSL *ssl;
 	Iobuf *iobuf[EP_MAX];
+	size_t unsent;			/* head of iobuf[EP_OUTPUT] that's ready for the socket, waiting for room */
+	short wants;			/* what poll() waits on to send it, POLLIN if TLS has to read first */
 
 	int matching_enabled;
 	GList *patterns;
@@ -58,10 +66,15 @@ struct endpoint_data {
 	int mnes_state;
 
 	int mccp_mode;
-	z_stream *mccp[EP_MAX];
+	Zstream *mccp[EP_MAX];
 	Iobuf *ziobuf[EP_MAX];
+	struct mccp_tune_data *mccp_tune;
+	struct mccp_relay_data *mccp_relay;
+	struct endpoint_data *mccp_relay_src;
 	struct iostat_data sockstats;
 	struct iostat_data mccpstats;
+	Histogram latency;		/* ns from reading bytes here to writing them out */
+	struct timespec latency_ts;	/* when the oldest unwritten input was read */
 
 };
 
@@ -70,6 +83,7 @@ typedef struct endpoint_data Endpoint;
 struct flow_data {
 	Endpoint *in;
 	Endpoint *out;
+	struct shape_data shape;	/* how fast and how much at a time in gets read */
 };
 
 
@@ -78,8 +92,11 @@ struct flow_data {
 /* exported function declarations */
 Endpoint *new_endpoint(char *name);
 int ssl_start_endpoint(Endpoint *ep, SSL_CTX *ctx, int connect);
+int ssl_connect_endpoint(Endpoint *ep, SSL_CTX *ctx, char *servername, char *session_name);
 ssize_t write_endpoint(Endpoint *ep, void *buf, size_t count);
 ssize_t write_endpoint_sock(Endpoint *ep, void *buf, size_t count);
+ssize_t drain_endpoint(Endpoint *ep);
+void linger_endpoint(Endpoint *ep, int ms);
 ssize_t flush_endpoint(Endpoint *ep);
 ssize_t read_endpoint(Endpoint *ep, void *buf, size_t count);
 ssize_t read_endpoint_sock(Endpoint *ep, void *buf, size_t count);
@@ -87,7 +104,10 @@ int close_endpoint(Endpoint *ep);
 void free_endpoint(Endpoint *ep);
 char *addr_endpoint(Endpoint *ep, char *buf, size_t size);
 
-int muditm_proxy(Endpoint *client, Endpoint *game, GKeyFile *gkf);
+int endpoint_pending(Endpoint *ep);
+ssize_t pull_flow(struct flow_data *f, int polled);
+void match_flow(struct flow_data *f, Config *conf);
+int muditm_proxy(Endpoint *client, Endpoint *game, Config *conf);
 size_t stunnel_proxy_header1(Endpoint *ep, char *buf, size_t size);
 
 #endif /* MUDITM_PROXY_H */
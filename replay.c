@@ -0,0 +1,398 @@
+/* replay.c - play a captured session back through the proxy */
+/* Created: Mon Oct 19 17:58:14 PM EDT 2026 malakai */
+/* $Id: replay.c,v 1.1 2026/10/19 21:58:14 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Takes a capture file made with capture-dir set, and runs it through
+ * muditm_proxy() the way it happened.  A driver process plays both the
+ * client and the game over loopback TCP, sending each captured frame as one
+ * write, compressed again if it arrived compressed, and soaking up whatever
+ * the proxy sends back.  The frames go out at their original times, or
+ * back to back with -f.  The proxy's time, CPU, latencies and hot path
+ * counters get printed at the end.
+ *
+ * 	mudreplay [-c configfile] [-f] capturefile
+ *
+ * Only the compression, pattern and proxy settings of the config file
+ * matter here.  There's no SSL, since captures are taken inside of it.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <glib.h>
+
+#include "debug.h"
+#include "muditm.h"
+#include "config.h"
+#include "proxy.h"
+#include "mccp.h"
+#include "counters.h"
+#include "histogram.h"
+#include "capture.h"
+
+/* ---- local #defines ---- */
+#define REPLAY_LINGER 200	/* ms of quiet after the last frame before hanging up */
+
+/* ---- structs and typedefs ---- */
+
+/* one side the driver plays. */
+struct replay_side {
+	int fd;
+	z_stream *z;		/* set while this side is sending compressed */
+	long int frames;
+	long int plain;		/* captured bytes sent */
+	long int wire;		/* bytes actually written, after deflate */
+	long int got;		/* bytes the proxy sent us */
+	int gone;		/* the proxy hung up on this side */
+};
+
+/* ---- local variable declarations ---- */
+char *muditm_proxy_name = "mudreplay";
+
+static char *replay_side_name[] = { "client", "game" };
+
+/* ---- local function declarations ---- */
+
+/* ---- code starts here ---- */
+
+double replay_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return(ts.tv_sec + ts.tv_nsec / 1000000000.0);
+}
+
+/* a connected pair of loopback TCP sockets, so the proxy sees what it would
+ * in real life. */
+int replay_pair(int *ours, int *theirs) {
+
+	struct sockaddr_in6 sa;
+	socklen_t len = sizeof(sa);
+	int ls, one = 1;
+
+	memset(&sa,0,sizeof(sa));
+	sa.sin6_family = AF_INET6;
+	sa.sin6_addr = in6addr_loopback;
+
+	if( ((ls = socket(AF_INET6,SOCK_STREAM,0)) < 0) ||
+		(bind(ls,(struct sockaddr *)&sa,sizeof(sa)) < 0) ||
+		(listen(ls,1) < 0) ||
+		(getsockname(ls,(struct sockaddr *)&sa,&len) < 0) ||
+		((*theirs = socket(AF_INET6,SOCK_STREAM,0)) < 0) ||
+		(connect(*theirs,(struct sockaddr *)&sa,sizeof(sa)) < 0) ||
+		((*ours = accept(ls,NULL,NULL)) < 0)
+	) {
+		perror("loopback socket");
+		return(0);
+	}
+	close(ls);
+	setsockopt(*theirs,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+	return(1);
+}
+
+/* turn one captured frame back into what went over the wire. */
+size_t replay_encode(struct replay_side *rs, struct capture_frame *frame,
+	char *in, char *out, size_t outlen
+) {
+
+	size_t len = 0;
+
+	if(!(frame->flags & CAPTURE_MCCP)) {
+		if(rs->z) {
+			/* the sender ended its stream before this. */
+			rs->z->next_in = NULL;
+			rs->z->avail_in = 0;
+			rs->z->next_out = (unsigned char *)out;
+			rs->z->avail_out = outlen;
+			deflate(rs->z,Z_FINISH);
+			len = outlen - rs->z->avail_out;
+			deflateEnd(rs->z);
+			free(rs->z);
+			rs->z = NULL;
+		}
+		memcpy(out+len,in,frame->len);
+		return(len + frame->len);
+	}
+
+	if(!rs->z) {
+		rs->z = (z_stream *)calloc(1,sizeof(z_stream));
+		deflateInit(rs->z,Z_DEFAULT_COMPRESSION);
+	}
+	rs->z->next_in = (unsigned char *)in;
+	rs->z->avail_in = frame->len;
+	rs->z->next_out = (unsigned char *)out;
+	rs->z->avail_out = outlen;
+	deflate(rs->z,Z_SYNC_FLUSH);
+	return(outlen - rs->z->avail_out);
+}
+
+/* read whatever the proxy has sent, without waiting.  0 if it hung up. */
+int replay_soak(struct replay_side *rs, char *scratch, double *quiet) {
+
+	ssize_t n;
+
+	while((n = read(rs->fd,scratch,EP_BUFSIZE)) > 0) {
+		rs->got += n;
+		*quiet = replay_now();
+	}
+	return(n != 0);
+}
+
+/* The driver.  Plays the frames into the proxy from both ends, and reads
+ * everything it sends back so it never blocks on us. */
+int replay_drive(FILE *f, struct replay_side *side, int fast) {
+
+	struct capture_frame frame;
+	struct pollfd pollster[2];
+	char *in, *out, *scratch;
+	size_t outlen = 0, outoff = 0;
+	size_t outmax = 2 * EP_BUFSIZE;
+	double start, due = 0, now, quiet = 0;
+	int s, ret, timeout, more = 1, have = 0, pending_side = 0;
+	ssize_t n;
+
+	in = (char *)malloc(EP_BUFSIZE);
+	out = (char *)malloc(outmax);
+	scratch = (char *)malloc(EP_BUFSIZE);
+
+	for(s=0; s<2; s++) {
+		fcntl(side[s].fd,F_SETFL,O_NONBLOCK);
+		pollster[s].fd = side[s].fd;
+	}
+
+	start = replay_now();
+	while(1) {
+
+		/* keep the proxy's output moving, or it could end up waiting on us
+		 * while we wait on it. */
+		for(s=0; s<2; s++) {
+			if(!side[s].gone && !replay_soak(&(side[s]),scratch,&quiet)) {
+				side[s].gone = 1;
+				fprintf(stderr,"The proxy hung up on the %s.\n",replay_side_name[s]);
+				more = have = 0;
+				outlen = 0;
+			}
+		}
+
+		/* get the next frame ready to go. */
+		if(more && !have && (outlen == 0)) {
+			ret = capture_read(f,&frame,in,EP_BUFSIZE);
+			if(ret < 0) {
+				fprintf(stderr,"Capture file is broken.\n");
+				return(0);
+			}
+			if(ret == 0) {
+				more = 0;
+				quiet = replay_now();
+			} else {
+				have = 1;
+				due = fast?0:(start + frame.nsec / 1000000000.0);
+			}
+		}
+
+		now = replay_now();
+		if(have && (now >= due)) {
+			pending_side = frame.side;
+			outlen = replay_encode(&(side[frame.side]),&frame,in,out,outmax);
+			outoff = 0;
+			side[frame.side].frames++;
+			side[frame.side].plain += frame.len;
+			side[frame.side].wire += outlen;
+			have = 0;
+		}
+
+		if(outlen > 0) {
+			n = write(side[pending_side].fd,out+outoff,outlen-outoff);
+			if(n > 0) {
+				outoff += n;
+				if(outoff == outlen) {
+					outlen = outoff = 0;
+				}
+				continue;
+			}
+			if( (n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) ) {
+				perror("replay write");
+				return(0);
+			}
+		}
+
+		if(!more && !have && (outlen == 0) &&
+			((now - quiet) * 1000 >= REPLAY_LINGER)
+		) {
+			break;
+		}
+
+		for(s=0; s<2; s++) {
+			pollster[s].events = POLLIN;
+			if((outlen > 0) && (s == pending_side)) {
+				pollster[s].events |= POLLOUT;
+			}
+		}
+		if(outlen > 0) {
+			timeout = -1;
+		} else if(have) {
+			timeout = MAX(0,(int)((due - now) * 1000));
+		} else {
+			timeout = REPLAY_LINGER;
+		}
+		if( (poll(pollster,2,timeout) < 0) && (errno != EINTR) ) {
+			perror("replay poll");
+			return(0);
+		}
+	}
+
+	/* the game hangs up, the proxy ends the session. */
+	close(side[CAPTURE_GAME].fd);
+	fcntl(side[CAPTURE_CLIENT].fd,F_SETFL,0);
+	while((n = read(side[CAPTURE_CLIENT].fd,scratch,EP_BUFSIZE)) > 0) {
+		side[CAPTURE_CLIENT].got += n;
+	}
+
+	printf("driver\t%.3f s\n",replay_now() - start);
+	for(s=0; s<2; s++) {
+		printf("%s\t%ld frames, %ld B captured, %ld B sent, %ld B back from the proxy\n",
+			replay_side_name[s],side[s].frames,side[s].plain,side[s].wire,side[s].got
+		);
+	}
+	fflush(stdout);
+	return(1);
+}
+
+int main(int argc, char **argv) {
+
+	struct capture_header h;
+	struct replay_side side[2];
+	struct rusage before, after;
+	Endpoint *client, *game;
+	Config *conf;
+	FILE *f;
+	char *configfilename = "muditm.conf";
+	char buf[512];
+	double start, wall, user, sys, mb;
+	time_t started;
+	int fast = 0;
+	int opt, status;
+	pid_t driver;
+
+	while( (opt = getopt(argc,argv,"c:fh")) != -1) {
+		switch(opt) {
+			case 'c':
+				configfilename = optarg;
+				break;
+			case 'f':
+				fast = 1;
+				break;
+			case 'h':
+			default:
+				fprintf(stdout,"Usage: %s [-c configfile] [-f] capturefile\n",argv[0]);
+				exit(EXIT_SUCCESS);
+		}
+	}
+	if(optind >= argc) {
+		fprintf(stderr,"Usage: %s [-c configfile] [-f] capturefile\n",argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	muditm_log_init(NULL);
+	if(!(conf = load_config(configfilename,1))) {
+		exit(EXIT_FAILURE);
+	}
+	muditm_config = conf;
+	apply_config(conf);
+
+	if(!(f = capture_open(argv[optind],&h))) {
+		fprintf(stderr,"%s: %s\n",argv[optind],strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	started = h.started;
+	printf("capture\t%s, %s to %s, started %s",argv[optind],h.addr,h.game,ctime(&started));
+
+	memset(side,0,sizeof(side));
+	client = new_endpoint("Client");
+	game = new_endpoint("Game");
+	if( !replay_pair(&(client->socket),&(side[CAPTURE_CLIENT].fd)) ||
+		!replay_pair(&(game->socket),&(side[CAPTURE_GAME].fd))
+	) {
+		exit(EXIT_FAILURE);
+	}
+	signal(SIGPIPE,SIG_IGN);
+	fflush(stdout);
+
+	if((driver = fork()) < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+	if(driver == 0) {
+		close(client->socket);
+		close(game->socket);
+		exit(replay_drive(f,side,fast)?EXIT_SUCCESS:EXIT_FAILURE);
+	}
+	close(side[CAPTURE_CLIENT].fd);
+	close(side[CAPTURE_GAME].fd);
+	fclose(f);
+
+	configure_compression(client,conf->client_compression);
+	configure_deflate(client,conf->client_tune);
+	configure_compression(game,conf->game_compression);
+	configure_deflate(game,conf->game_tune);
+
+	getrusage(RUSAGE_SELF,&before);
+	start = replay_now();
+	muditm_proxy(client,game,conf);
+	wall = replay_now() - start;
+	getrusage(RUSAGE_SELF,&after);
+
+	/* so the driver sees the client end close too. */
+	close_endpoint(client);
+	close_endpoint(game);
+	waitpid(driver,&status,0);
+
+	user = (after.ru_utime.tv_sec - before.ru_utime.tv_sec) +
+		(after.ru_utime.tv_usec - before.ru_utime.tv_usec) / 1000000.0;
+	sys = (after.ru_stime.tv_sec - before.ru_stime.tv_sec) +
+		(after.ru_stime.tv_usec - before.ru_stime.tv_usec) / 1000000.0;
+	mb = (client->sockstats.lifetime.in + client->sockstats.lifetime.out +
+		game->sockstats.lifetime.in + game->sockstats.lifetime.out) / 1048576.0;
+
+	printf("proxy\t%.3f s wall, %.3f s user, %.3f s sys, %.2f MB on the sockets, %.3f CPU s/MB\n",
+		wall,user,sys,mb,(mb > 0)?((user+sys)/mb):0.0
+	);
+	hist_printstats(buf,sizeof(buf),&(client->latency));
+	printf("to_game\t%s\n",buf);
+	hist_printstats(buf,sizeof(buf),&(game->latency));
+	printf("to_client\t%s\n",buf);
+	counters_printstats(buf,sizeof(buf),&counters);
+	printf("hot\t%s\n",buf);
+
+	return( (WIFEXITED(status) && WEXITSTATUS(status) == 0)?EXIT_SUCCESS:EXIT_FAILURE );
+}
@@ -0,0 +1,148 @@
+/* shape.c - token bucket rate limits and read budgets for a flow */
+/* Created: Mon Oct 19 22:14:52 PM EDT 2026 malakai */
+/* $Id: shape.c,v 1.1 2026/10/20 02:14:52 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* One player's map dump or trigger loop shouldn't be able to hog their own
+ * session, or the uplink everyone shares.  So each direction of a session gets two limits on reading:
+ *
+ * A token bucket.  Tokens come in at rate bytes per second and pile up to
+ * burst.  A read can happen whenever there are any, and takes as many as
+ * it got, so the count can go negative.  Then nothing more is read from
+ * that side until it's paid back, and the sender is held up by TCP instead
+ * of by our buffers.  A room description or a prompt fits in the burst and
+ * goes right through; only sustained output is slowed down.
+ *
+ * A quantum.  No more than that many bytes are read from a side per pass
+ * through the proxy loop, so a flood from the game gets matched and sent
+ * in slices, with the player's typing going the other way in between.
+ * That's deficit round robin over the session's two flows, where the
+ * deficit never carries because a read can be cut to fit exactly. */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "counters.h"
+#include "shape.h"
+
+/* ---- local #defines ---- */
+
+/* ---- structs and typedefs ---- */
+
+/* ---- local variable declarations ---- */
+
+/* ---- local function declarations ---- */
+void shape_refill(struct shape_data *s);
+
+/* ---- code starts here ---- */
+
+void shape_init(struct shape_data *s, int rate_kb, int burst_kb, int quantum) {
+
+	s->rate = (rate_kb > 0)?(rate_kb * 1024L):0;
+	s->burst = (burst_kb > 0)?(burst_kb * 1024L):s->rate;
+	s->tokens = s->burst;
+	clock_gettime(CLOCK_MONOTONIC,&(s->last));
+	s->quantum = (quantum > 0)?quantum:0;
+	s->waits = 0;
+	s->bytes = 0;
+}
+
+void shape_refill(struct shape_data *s) {
+
+	struct timespec now;
+	long int ns, add;
+
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	if(s->tokens >= s->burst) {
+		s->last = now;
+		return;
+	}
+	ns = (now.tv_sec - s->last.tv_sec) * 1000000000L + (now.tv_nsec - s->last.tv_nsec);
+	add = (long int)((double)s->rate * ns / 1000000000.0);
+	if(add <= 0) {
+		/* not a whole byte yet.  Leave last alone so it adds up. */
+		return;
+	}
+	s->tokens += add;
+	if(s->tokens >= s->burst) {
+		s->tokens = s->burst;
+		s->last = now;
+		return;
+	}
+	/* only as far as the bytes that were added, so the fraction of a
+	 * byte left over isn't lost. */
+	ns = (long int)(add * 1000000000.0 / s->rate);
+	s->last.tv_sec += ns / 1000000000L;
+	s->last.tv_nsec += ns % 1000000000L;
+	if(s->last.tv_nsec >= 1000000000L) {
+		s->last.tv_sec++;
+		s->last.tv_nsec -= 1000000000L;
+	}
+}
+
+/* How much can be read this pass, out of want.  0 if the bucket is dry. */
+size_t shape_allow(struct shape_data *s, size_t want) {
+
+	if(s->rate) {
+		shape_refill(s);
+		if(s->tokens <= 0) {
+			return(0);
+		}
+	}
+	if(s->quantum && (want > s->quantum)) {
+		want = s->quantum;
+	}
+	return(want);
+}
+
+void shape_charge(struct shape_data *s, ssize_t bytes) {
+
+	if(bytes <= 0) {
+		return;
+	}
+	s->bytes += bytes;
+	if(!s->rate) {
+		return;
+	}
+	s->tokens -= bytes;
+	if(s->tokens <= 0) {
+		s->waits++;
+		counters.shaped++;
+	}
+}
+
+/* ms until the bucket has something in it again, 0 if it does now. */
+int shape_wait(struct shape_data *s) {
+
+	if(!s->rate) {
+		return(0);
+	}
+	shape_refill(s);
+	if(s->tokens > 0) {
+		return(0);
+	}
+	return( (int)((1 - s->tokens) * 1000 / s->rate) + 1 );
+}
+
+int shape_printstats(char *buf, size_t len, struct shape_data *s) {
+	return(snprintf(buf,len,"rate limit %ld KB/s, burst %ld KB, ran dry %ld times over %ld B",
+		s->rate / 1024, s->burst / 1024, s->waits, s->bytes
+	));
+}
@@ -0,0 +1,54 @@
+/* shape.h - token bucket rate limits and read budgets for a flow */
+/* Created: Mon Oct 19 22:14:52 PM EDT 2026 malakai */
+/* $Id: shape.h,v 1.1 2026/10/20 02:14:52 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUDITM_SHAPE_H
+#define MUDITM_SHAPE_H
+
+#include <sys/types.h>
+#include <time.h>
+
+/* global #defines */
+
+/* structs and typedefs */
+
+/* One direction of a session.  Bytes are counted as they come off the
+ * input side, after TLS and inflate, before the patterns see them. */
+struct shape_data {
+	long int rate;		/* bytes per second, 0 for no limit */
+	long int burst;		/* most the bucket holds */
+	long int tokens;	/* goes below 0 by up to one read */
+	struct timespec last;	/* when tokens were last added */
+	long int quantum;	/* most bytes read per pass, 0 for no limit */
+	long int waits;		/* times the bucket ran dry */
+	long int bytes;
+};
+
+/* exported global variable declarations */
+
+/* exported function declarations */
+void shape_init(struct shape_data *s, int rate_kb, int burst_kb, int quantum);
+size_t shape_allow(struct shape_data *s, size_t want);
+void shape_charge(struct shape_data *s, ssize_t bytes);
+int shape_wait(struct shape_data *s);
+int shape_printstats(char *buf, size_t len, struct shape_data *s);
+
+#endif /* MUDITM_SHAPE_H */
@@ -0,0 +1,149 @@
+/* sockopt.c - TCP settings for each side's sockets */
+/* Created: Mon Oct 19 23:20:44 PM EDT 2026 malakai */
+/* $Id: sockopt.c,v 1.1 2026/10/20 03:20:44 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The kernel's TCP defaults are made for bulk transfers.  A MUD is a
+ * stream of little prompts and commands, where what matters is that each
+ * one goes right away, and that a player whose connection died without a
+ * word gets noticed.  So each side gets its own set of socket options out
+ * of the config file, with defaults for that:
+ *
+ * Nagle off, so a prompt isn't held waiting for the last one's ACK.
+ * Quick ACKs if asked for, so a peer that does have Nagle on isn't kept
+ * waiting on our delayed ones.  The kernel drops out of quick ACK mode on
+ * its own, so it gets set again, but only after a read that ends a line or
+ * a prompt, when the peer is waiting to hear back.  A low TCP_NOTSENT_LOWAT, so that a
+ * flood of output waits in the sender instead of piling up in our send
+ * queue where nothing can get ahead of it.  Keepalives and a user timeout,
+ * so that dead peers are found and their sessions end. */
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <arpa/telnet.h>
+#include <glib.h>
+
+#include "debug.h"
+#include "muditm.h"
+#include "sockopt.h"
+
+/* ---- local #defines ---- */
+#ifndef TCP_NOTSENT_LOWAT
+#define TCP_NOTSENT_LOWAT 25
+#endif
+
+/* ---- structs and typedefs ---- */
+
+/* ---- local variable declarations ---- */
+
+/* ---- local function declarations ---- */
+void sockopt_set(int sock, int level, int opt, int value, char *optname, char *name);
+
+/* ---- code starts here ---- */
+
+/* read the socket settings for one side out of the config file. */
+struct sockopt_data *parse_sockopt(GKeyFile *gkf, char *group) {
+
+	struct sockopt_data *so;
+
+	so = (struct sockopt_data *)malloc(sizeof(struct sockopt_data));
+	memset(so,0,sizeof(struct sockopt_data));
+
+	so->nodelay = get_conf_boolean(gkf,group,"socket-nodelay",1);
+	so->quickack = get_conf_boolean(gkf,group,"socket-quickack",0);
+	so->sndbuf = get_conf_int(gkf,group,"socket-sndbuf",0);
+	so->rcvbuf = get_conf_int(gkf,group,"socket-rcvbuf",0);
+	so->notsent_lowat = get_conf_int(gkf,group,"socket-notsent-lowat",16384);
+	so->keepalive = get_conf_boolean(gkf,group,"socket-keepalive",1);
+	so->keepidle = get_conf_int(gkf,group,"socket-keepalive-idle",60);
+	so->keepintvl = get_conf_int(gkf,group,"socket-keepalive-interval",10);
+	so->keepcnt = get_conf_int(gkf,group,"socket-keepalive-count",6);
+	so->user_timeout = get_conf_int(gkf,group,"socket-user-timeout",120000);
+
+	return(so);
+}
+
+void sockopt_set(int sock, int level, int opt, int value, char *optname, char *name) {
+
+	if(setsockopt(sock,level,opt,&value,sizeof(value)) == -1) {
+		muditm_log("Couldn't set %s on the %s socket: %s",optname,name,strerror(errno));
+	}
+}
+
+/* Everything but the buffer sizes can be changed any time.  Those should
+ * be set before connect() or listen(), for the window scaling to match. */
+void sockopt_apply(int sock, struct sockopt_data *so, char *name) {
+
+	if(!so) {
+		return;
+	}
+	if(so->sndbuf > 0) {
+		sockopt_set(sock,SOL_SOCKET,SO_SNDBUF,so->sndbuf,"SO_SNDBUF",name);
+	}
+	if(so->rcvbuf > 0) {
+		sockopt_set(sock,SOL_SOCKET,SO_RCVBUF,so->rcvbuf,"SO_RCVBUF",name);
+	}
+	sockopt_set(sock,IPPROTO_TCP,TCP_NODELAY,so->nodelay,"TCP_NODELAY",name);
+	if(so->quickack) {
+		sockopt_set(sock,IPPROTO_TCP,TCP_QUICKACK,1,"TCP_QUICKACK",name);
+	}
+	if(so->notsent_lowat > 0) {
+		sockopt_set(sock,IPPROTO_TCP,TCP_NOTSENT_LOWAT,so->notsent_lowat,"TCP_NOTSENT_LOWAT",name);
+	}
+	sockopt_set(sock,SOL_SOCKET,SO_KEEPALIVE,so->keepalive,"SO_KEEPALIVE",name);
+	if(so->keepalive) {
+		if(so->keepidle > 0) {
+			sockopt_set(sock,IPPROTO_TCP,TCP_KEEPIDLE,so->keepidle,"TCP_KEEPIDLE",name);
+		}
+		if(so->keepintvl > 0) {
+			sockopt_set(sock,IPPROTO_TCP,TCP_KEEPINTVL,so->keepintvl,"TCP_KEEPINTVL",name);
+		}
+		if(so->keepcnt > 0) {
+			sockopt_set(sock,IPPROTO_TCP,TCP_KEEPCNT,so->keepcnt,"TCP_KEEPCNT",name);
+		}
+	}
+	if(so->user_timeout > 0) {
+		sockopt_set(sock,IPPROTO_TCP,TCP_USER_TIMEOUT,so->user_timeout,"TCP_USER_TIMEOUT",name);
+	}
+}
+
+/* after a read of len bytes into buf.  A setsockopt() every read adds up,
+ * so only when it ends a line, or a prompt with GA or EOR.  Returns 1 if
+ * it made the call.  Quiet, since it's on the hot path and the socket may
+ * not even be TCP. */
+int sockopt_quickack(int sock, char *buf, size_t len) {
+
+	unsigned char *end = (unsigned char *)buf + len;
+	int on = 1;
+
+	if( (len < 1) ||
+		!( (end[-1] == '\n') ||
+			((len >= 2) && (end[-2] == IAC) && ((end[-1] == GA) || (end[-1] == EOR))) )
+	) {
+		return(0);
+	}
+	setsockopt(sock,IPPROTO_TCP,TCP_QUICKACK,&on,sizeof(on));
+	return(1);
+}
@@ -0,0 +1,54 @@
+/* sockopt.h - TCP settings for each side's sockets */
+/* Created: Mon Oct 19 23:20:44 PM EDT 2026 malakai */
+/* $Id: sockopt.h,v 1.1 2026/10/20 03:20:44 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUDITM_SOCKOPT_H
+#define MUDITM_SOCKOPT_H
+
+#include <glib.h>
+
+/* global #defines */
+
+/* structs and typedefs */
+
+/* one side's settings, out of [client] or [game].  0 leaves the kernel's
+ * default alone for the numbers. */
+struct sockopt_data {
+	int nodelay;		/* TCP_NODELAY, no Nagle */
+	int quickack;		/* TCP_QUICKACK, set again after lines and prompts */
+	int sndbuf;		/* SO_SNDBUF, bytes */
+	int rcvbuf;		/* SO_RCVBUF, bytes */
+	int notsent_lowat;	/* TCP_NOTSENT_LOWAT, bytes */
+	int keepalive;		/* SO_KEEPALIVE */
+	int keepidle;		/* TCP_KEEPIDLE, seconds */
+	int keepintvl;		/* TCP_KEEPINTVL, seconds */
+	int keepcnt;		/* TCP_KEEPCNT */
+	int user_timeout;	/* TCP_USER_TIMEOUT, ms */
+};
+
+/* exported global variable declarations */
+
+/* exported function declarations */
+struct sockopt_data *parse_sockopt(GKeyFile *gkf, char *group);
+void sockopt_apply(int sock, struct sockopt_data *so, char *name);
+int sockopt_quickack(int sock, char *buf, size_t len);
+
+#endif /* MUDITM_SOCKOPT_H */
@@ -0,0 +1,551 @@
+/* sslcache.c - TLS session resumption shared by all of the forked sessions */
+/* Created: Mon Oct 19 12:10:37 PM EDT 2026 malakai */
+/* $Id: sslcache.c,v 1.1 2026/10/19 16:10:37 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Each session is its own forked process, and used to build its own SSL_CTX,
+ * so whatever session cache and ticket keys OpenSSL made up went away with
+ * it.  A reconnecting client always got a full handshake.  Here the parent
+ * sets up the ticket keys and an optional session cache in shared memory
+ * before it starts forking, and every session's SSL_CTX uses those. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#else
+#include <openssl/hmac.h>
+#endif
+#include <glib.h>
+
+#include "debug.h"
+#include "muditm.h"
+#include "sslcache.h"
+
+/* ---- local #defines ---- */
+
+/* ---- structs and typedefs ---- */
+
+/* ---- local variable declarations ---- */
+struct sslcache_data *sslcache = NULL;
+
+/* ---- local function declarations ---- */
+void sslcache_lock(void);
+int sslcache_load_key(char *file, struct sslcache_key *key);
+int sslcache_new_key(struct sslcache_key *key);
+void sslcache_encrypt_key(struct sslcache_key *key);
+int sslcache_find_key(unsigned char *name, struct sslcache_key *key);
+unsigned int sslcache_hash(const unsigned char *id, unsigned int len);
+int sslcache_new_session(SSL *ssl, SSL_SESSION *sess);
+SSL_SESSION *sslcache_get_session(SSL *ssl, const unsigned char *id, int len, int *copy);
+void sslcache_remove_session(SSL_CTX *ctx, SSL_SESSION *sess);
+struct sslcache_upstream *sslcache_upstream_find(char *name, int create);
+int sslcache_upstream_new(SSL *ssl, SSL_SESSION *sess);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+int sslcache_ticket_cb(SSL *ssl, unsigned char *name, unsigned char *iv,
+	EVP_CIPHER_CTX *cctx, EVP_MAC_CTX *hctx, int enc);
+#else
+int sslcache_ticket_cb(SSL *ssl, unsigned char *name, unsigned char *iv,
+	EVP_CIPHER_CTX *cctx, HMAC_CTX *hctx, int enc);
+#endif
+
+/* ---- code starts here ---- */
+
+/* Called once in the parent, before any forking.  0 if it couldn't. */
+int sslcache_init(GKeyFile *gkf) {
+
+	pthread_mutexattr_t attr;
+	char *keyfile;
+	int slots;
+	size_t size;
+
+	slots = get_conf_int(gkf,"ssl","session-cache",0);
+	if(slots < 0) slots = 0;
+
+	size = sizeof(struct sslcache_data) + (slots * sizeof(struct sslcache_slot));
+	sslcache = (struct sslcache_data *)mmap(NULL,size,
+		PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0
+	);
+	if(sslcache == MAP_FAILED) {
+		muditm_log("Couldn't map %zu bytes for the ssl session cache: %s",
+			size,strerror(errno)
+		);
+		sslcache = NULL;
+		return(0);
+	}
+	memset(sslcache,0,size);
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr,PTHREAD_PROCESS_SHARED);
+	/* a session that dies holding it mustn't take every other one with it. */
+	pthread_mutexattr_setrobust(&attr,PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&(sslcache->lock),&attr);
+	pthread_mutexattr_destroy(&attr);
+
+	sslcache->slots = slots;
+	sslcache->tickets = get_conf_boolean(gkf,"ssl","session-tickets",1);
+	sslcache->timeout = get_conf_int(gkf,"ssl","session-timeout",3600);
+	sslcache->current = 0;
+
+	/* a key file is for sharing tickets with other MUDitMs, so it
+	 * shouldn't get rotated away unless that's asked for. */
+	keyfile = get_conf_string(gkf,"ssl","ticket-key-file","");
+	if(*keyfile) {
+		sslcache->rotate = get_conf_int(gkf,"ssl","ticket-key-rotate",0);
+		if(!sslcache_load_key(keyfile,&(sslcache->keys[0]))) {
+			free(keyfile);
+			return(0);
+		}
+	} else {
+		sslcache->rotate = get_conf_int(gkf,"ssl","ticket-key-rotate",3600);
+		if(!sslcache_new_key(&(sslcache->keys[0]))) {
+			free(keyfile);
+			return(0);
+		}
+	}
+	free(keyfile);
+
+	muditm_log("SSL session tickets %s, key rotation %ds, %d shared cache slots.",
+		sslcache->tickets?"on":"off", sslcache->rotate, sslcache->slots
+	);
+	return(1);
+}
+
+/* read a ticket key from a file.  It's 80 bytes: a 16 byte name, then 32
+ * bytes each of AES and HMAC key.  'openssl rand 80 > file' makes one. */
+int sslcache_load_key(char *file, struct sslcache_key *key) {
+
+	unsigned char buf[80];
+	int fd, got;
+
+	if( (fd = open(file,O_RDONLY)) == -1) {
+		muditm_log("Couldn't open ticket key file %s: %s",file,strerror(errno));
+		return(0);
+	}
+	got = read(fd,buf,sizeof(buf));
+	close(fd);
+	if(got != sizeof(buf)) {
+		muditm_log("Ticket key file %s needs to be %d bytes.",file,(int)sizeof(buf));
+		return(0);
+	}
+	memcpy(key->name,buf,16);
+	memcpy(key->aes,buf+16,32);
+	memcpy(key->hmac,buf+48,32);
+	key->created = time(NULL);
+	OPENSSL_cleanse(buf,sizeof(buf));
+	return(1);
+}
+
+int sslcache_new_key(struct sslcache_key *key) {
+
+	if( (RAND_bytes(key->name,sizeof(key->name)) <= 0) ||
+		(RAND_bytes(key->aes,sizeof(key->aes)) <= 0) ||
+		(RAND_bytes(key->hmac,sizeof(key->hmac)) <= 0)
+	) {
+		muditm_sslerr("making a ticket key");
+		return(0);
+	}
+	key->created = time(NULL);
+	return(1);
+}
+
+/* If the last session to hold the lock died with it, whatever it was in the
+ * middle of could be half done.  The keys are left alone, a bad one only
+ * costs a full handshake, but the cached sessions are thrown out. */
+void sslcache_lock(void) {
+
+	if(pthread_mutex_lock(&(sslcache->lock)) == EOWNERDEAD) {
+		muditm_log("A session died holding the ssl cache lock, emptying the cache.");
+		memset(sslcache->upstream,0,sizeof(sslcache->upstream));
+		memset(sslcache->slot,0,sslcache->slots * sizeof(struct sslcache_slot));
+		pthread_mutex_consistent(&(sslcache->lock));
+	}
+}
+
+/* the key to make new tickets with.  If it's due for a change, whichever
+ * session notices first makes the new one, so the parent doesn't have to
+ * wake up for it.  The old ones stick around to open existing tickets. */
+void sslcache_encrypt_key(struct sslcache_key *key) {
+
+	struct sslcache_key *cur;
+	int next;
+
+	sslcache_lock();
+	cur = &(sslcache->keys[sslcache->current]);
+	if( sslcache->rotate && (time(NULL) - cur->created >= sslcache->rotate) ) {
+		next = (sslcache->current + 1) % SSLCACHE_KEYS;
+		if(sslcache_new_key(&(sslcache->keys[next]))) {
+			sslcache->current = next;
+			sslcache->rotations++;
+			cur = &(sslcache->keys[next]);
+			muditm_log("New SSL ticket key.");
+		}
+	}
+	/* a copy, since a later rotation writes over the slot. */
+	*key = *cur;
+	pthread_mutex_unlock(&(sslcache->lock));
+}
+
+/* copies the key with this name into key.  0 if none of them has it, 1 if
+ * it's the current one, or 2 if it's an older one. */
+int sslcache_find_key(unsigned char *name, struct sslcache_key *key) {
+
+	int i, found = 0;
+
+	sslcache_lock();
+	for(i=0; i<SSLCACHE_KEYS; i++) {
+		if(sslcache->keys[i].created &&
+			!memcmp(sslcache->keys[i].name,name,16)
+		) {
+			*key = sslcache->keys[i];
+			found = (i == sslcache->current)?1:2;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&(sslcache->lock));
+	return(found);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+int sslcache_ticket_cb(SSL *ssl, unsigned char *name, unsigned char *iv,
+	EVP_CIPHER_CTX *cctx, EVP_MAC_CTX *hctx, int enc)
+#else
+int sslcache_ticket_cb(SSL *ssl, unsigned char *name, unsigned char *iv,
+	EVP_CIPHER_CTX *cctx, HMAC_CTX *hctx, int enc)
+#endif
+{
+	struct sslcache_key key;
+	int found = 1;
+
+	if(enc) {
+		sslcache_encrypt_key(&key);
+		memcpy(name,key.name,16);
+		if(RAND_bytes(iv,EVP_MAX_IV_LENGTH) <= 0) {
+			return(-1);
+		}
+		if(!EVP_EncryptInit_ex(cctx,EVP_aes_256_cbc(),NULL,key.aes,iv)) {
+			return(-1);
+		}
+	} else {
+		if( (found = sslcache_find_key(name,&key)) == 0 ) {
+			/* not one of ours, or too old.  full handshake. */
+			return(0);
+		}
+		if(!EVP_DecryptInit_ex(cctx,EVP_aes_256_cbc(),NULL,key.aes,iv)) {
+			return(-1);
+		}
+	}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	OSSL_PARAM params[3];
+	params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,key.hmac,32);
+	params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,"SHA256",0);
+	params[2] = OSSL_PARAM_construct_end();
+	if(!EVP_MAC_CTX_set_params(hctx,params)) {
+		return(-1);
+	}
+#else
+	if(!HMAC_Init_ex(hctx,key.hmac,32,EVP_sha256(),NULL)) {
+		return(-1);
+	}
+#endif
+
+	if(enc) {
+		return(1);
+	}
+	__atomic_add_fetch(&(sslcache->ticket_hits),1,__ATOMIC_RELAXED);
+
+	/* 2 tells OpenSSL to hand out a fresh ticket under the current key. */
+	return(found);
+}
+
+/* FNV-1a, good enough to spread session ids over the slots. */
+unsigned int sslcache_hash(const unsigned char *id, unsigned int len) {
+	unsigned int h = 2166136261u;
+	while(len--) {
+		h ^= *id++;
+		h *= 16777619u;
+	}
+	return(h);
+}
+
+int sslcache_new_session(SSL *ssl, SSL_SESSION *sess) {
+
+	struct sslcache_slot *slot;
+	const unsigned char *id;
+	unsigned int idlen;
+	unsigned char *p;
+	int derlen;
+
+	id = SSL_SESSION_get_id(sess,&idlen);
+	derlen = i2d_SSL_SESSION(sess,NULL);
+	if( (idlen == 0) || (derlen <= 0) || (derlen > SSLCACHE_SESSION_MAX) ) {
+		return(0);
+	}
+
+	slot = &(sslcache->slot[sslcache_hash(id,idlen) % sslcache->slots]);
+
+	sslcache_lock();
+	memcpy(slot->id,id,idlen);
+	slot->idlen = idlen;
+	slot->expires = time(NULL) + sslcache->timeout;
+	p = slot->der;
+	slot->derlen = i2d_SSL_SESSION(sess,&p);
+	pthread_mutex_unlock(&(sslcache->lock));
+
+	/* 0 means OpenSSL keeps its own reference to sess. */
+	return(0);
+}
+
+SSL_SESSION *sslcache_get_session(SSL *ssl, const unsigned char *id, int len, int *copy) {
+
+	struct sslcache_slot *slot;
+	SSL_SESSION *sess = NULL;
+	const unsigned char *p;
+
+	*copy = 0;
+	slot = &(sslcache->slot[sslcache_hash(id,len) % sslcache->slots]);
+
+	sslcache_lock();
+	if( (slot->idlen == len) && !memcmp(slot->id,id,len) &&
+		(slot->expires > time(NULL))
+	) {
+		p = slot->der;
+		sess = d2i_SSL_SESSION(NULL,&p,slot->derlen);
+	}
+	pthread_mutex_unlock(&(sslcache->lock));
+
+	if(sess) {
+		__atomic_add_fetch(&(sslcache->cache_hits),1,__ATOMIC_RELAXED);
+	} else {
+		__atomic_add_fetch(&(sslcache->cache_misses),1,__ATOMIC_RELAXED);
+	}
+	return(sess);
+}
+
+void sslcache_remove_session(SSL_CTX *ctx, SSL_SESSION *sess) {
+
+	struct sslcache_slot *slot;
+	const unsigned char *id;
+	unsigned int idlen;
+
+	id = SSL_SESSION_get_id(sess,&idlen);
+	if(idlen == 0) return;
+	slot = &(sslcache->slot[sslcache_hash(id,idlen) % sslcache->slots]);
+
+	sslcache_lock();
+	if( (slot->idlen == idlen) && !memcmp(slot->id,id,idlen) ) {
+		slot->idlen = 0;
+		slot->derlen = 0;
+	}
+	pthread_mutex_unlock(&(sslcache->lock));
+}
+
+/* point a session's SSL_CTX at the shared keys and cache. */
+void sslcache_attach(SSL_CTX *ctx) {
+
+	static const unsigned char sid_ctx[] = MUDITM_SHORTNAME;
+
+	if(!sslcache) return;
+
+	SSL_CTX_set_session_id_context(ctx,sid_ctx,sizeof(sid_ctx)-1);
+	SSL_CTX_set_timeout(ctx,sslcache->timeout);
+
+	if(sslcache->tickets) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx,sslcache_ticket_cb);
+#else
+		SSL_CTX_set_tlsext_ticket_key_cb(ctx,sslcache_ticket_cb);
+#endif
+	} else {
+		SSL_CTX_set_options(ctx,SSL_OP_NO_TICKET);
+	}
+
+	/* the per process cache is no use to anybody, so only the shared one. */
+	if(sslcache->slots) {
+		SSL_CTX_set_session_cache_mode(ctx,
+			SSL_SESS_CACHE_SERVER|SSL_SESS_CACHE_NO_INTERNAL
+		);
+		SSL_CTX_sess_set_new_cb(ctx,sslcache_new_session);
+		SSL_CTX_sess_set_get_cb(ctx,sslcache_get_session);
+		SSL_CTX_sess_set_remove_cb(ctx,sslcache_remove_session);
+	} else {
+		SSL_CTX_set_session_cache_mode(ctx,SSL_SESS_CACHE_OFF);
+	}
+}
+
+/* count a finished client handshake, and whether it got resumed. */
+void sslcache_count(SSL *ssl) {
+
+	if(!sslcache) return;
+
+	__atomic_add_fetch(&(sslcache->handshakes),1,__ATOMIC_RELAXED);
+	if(SSL_session_reused(ssl)) {
+		__atomic_add_fetch(&(sslcache->resumed),1,__ATOMIC_RELAXED);
+		muditm_log("SSL session resumed.");
+	}
+}
+
+/* the slot for this game server.  If create, and it doesn't have one, it
+ * takes over the one closest to expiring.  Call with the lock held. */
+struct sslcache_upstream *sslcache_upstream_find(char *name, int create) {
+
+	struct sslcache_upstream *up, *oldest = NULL;
+	int i;
+
+	for(i=0; i<SSLCACHE_UPSTREAM; i++) {
+		up = &(sslcache->upstream[i]);
+		if(!strncmp(up->name,name,SSLCACHE_NAME_MAX)) {
+			return(up);
+		}
+		if(!oldest || up->expires < oldest->expires) {
+			oldest = up;
+		}
+	}
+	if(!create) {
+		return(NULL);
+	}
+	snprintf(oldest->name,sizeof(oldest->name),"%s",name);
+	oldest->derlen = 0;
+	oldest->expires = 0;
+	return(oldest);
+}
+
+/* OpenSSL hands us each session or ticket the game server gives out.  For
+ * TLS 1.3 that's after the handshake, whenever the ticket shows up. */
+int sslcache_upstream_new(SSL *ssl, SSL_SESSION *sess) {
+
+	struct sslcache_upstream *up;
+	char *name;
+	unsigned char *p;
+	int derlen;
+
+	if(!sslcache || !(name = SSL_get_app_data(ssl))) {
+		return(0);
+	}
+	if(!SSL_SESSION_is_resumable(sess)) {
+		return(0);
+	}
+	derlen = i2d_SSL_SESSION(sess,NULL);
+	if( (derlen <= 0) || (derlen > SSLCACHE_SESSION_MAX) ) {
+		return(0);
+	}
+
+	sslcache_lock();
+	up = sslcache_upstream_find(name,1);
+	p = up->der;
+	up->derlen = i2d_SSL_SESSION(sess,&p);
+	up->expires = SSL_SESSION_get_time(sess) + SSL_SESSION_get_timeout(sess);
+	pthread_mutex_unlock(&(sslcache->lock));
+
+	__atomic_add_fetch(&(sslcache->upstream_saved),1,__ATOMIC_RELAXED);
+	return(0);
+}
+
+/* set up the game side SSL_CTX to hand its sessions to the shared store.
+ * Works before sslcache_init(), the callback checks. */
+void sslcache_upstream_attach(SSL_CTX *ctx, int reuse) {
+
+	if(!reuse) {
+		SSL_CTX_set_session_cache_mode(ctx,SSL_SESS_CACHE_OFF);
+		SSL_CTX_set_options(ctx,SSL_OP_NO_TICKET);
+		return;
+	}
+	SSL_CTX_set_session_cache_mode(ctx,
+		SSL_SESS_CACHE_CLIENT|SSL_SESS_CACHE_NO_INTERNAL_STORE
+	);
+	SSL_CTX_sess_set_new_cb(ctx,sslcache_upstream_new);
+}
+
+/* before SSL_connect(), offer the last session this game server gave out.
+ * name has to stay put for as long as ssl does. */
+void sslcache_upstream_resume(SSL *ssl, char *name) {
+
+	struct sslcache_upstream *up;
+	SSL_SESSION *sess = NULL;
+	const unsigned char *p;
+
+	SSL_set_app_data(ssl,name);
+	if(!sslcache) return;
+
+	sslcache_lock();
+	up = sslcache_upstream_find(name,0);
+	if(up && up->derlen && (up->expires > time(NULL))) {
+		p = up->der;
+		sess = d2i_SSL_SESSION(NULL,&p,up->derlen);
+	}
+	pthread_mutex_unlock(&(sslcache->lock));
+
+	if(sess) {
+		SSL_set_session(ssl,sess);
+		SSL_SESSION_free(sess);
+	}
+}
+
+/* count a finished handshake to the game, and whether it got resumed. */
+void sslcache_upstream_count(SSL *ssl) {
+
+	if(!sslcache) return;
+
+	__atomic_add_fetch(&(sslcache->upstream_handshakes),1,__ATOMIC_RELAXED);
+	if(SSL_session_reused(ssl)) {
+		__atomic_add_fetch(&(sslcache->upstream_resumed),1,__ATOMIC_RELAXED);
+		muditm_log("Game SSL session resumed.");
+	}
+}
+
+int sslcache_printstats(char *buf, size_t len) {
+
+	long int handshakes, resumed, up_handshakes, up_resumed;
+
+	if(!sslcache) {
+		return(snprintf(buf,len,"no ssl session sharing"));
+	}
+
+	handshakes = __atomic_load_n(&(sslcache->handshakes),__ATOMIC_RELAXED);
+	resumed = __atomic_load_n(&(sslcache->resumed),__ATOMIC_RELAXED);
+	up_handshakes = __atomic_load_n(&(sslcache->upstream_handshakes),__ATOMIC_RELAXED);
+	up_resumed = __atomic_load_n(&(sslcache->upstream_resumed),__ATOMIC_RELAXED);
+
+	return(snprintf(buf,len,
+		"SSL resumed %ld of %ld handshakes (%3.2f%%), %ld tickets accepted, cache %ld hits %ld misses, %ld key rotations, "
+		"game resumed %ld of %ld (%3.2f%%), %ld sessions saved",
+		resumed, handshakes,
+		handshakes?(100.0 * resumed / handshakes):0.0,
+		__atomic_load_n(&(sslcache->ticket_hits),__ATOMIC_RELAXED),
+		__atomic_load_n(&(sslcache->cache_hits),__ATOMIC_RELAXED),
+		__atomic_load_n(&(sslcache->cache_misses),__ATOMIC_RELAXED),
+		__atomic_load_n(&(sslcache->rotations),__ATOMIC_RELAXED),
+		up_resumed, up_handshakes,
+		up_handshakes?(100.0 * up_resumed / up_handshakes):0.0,
+		__atomic_load_n(&(sslcache->upstream_saved),__ATOMIC_RELAXED)
+	));
+}
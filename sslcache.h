@@ -0,0 +1,100 @@
+/* sslcache.h - TLS session resumption shared by all of the forked sessions */
+/* Created: Mon Oct 19 12:10:37 PM EDT 2026 malakai */
+/* $Id: sslcache.h,v 1.1 2026/10/19 16:10:37 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUDITM_SSLCACHE_H
+#define MUDITM_SSLCACHE_H
+
+#include <pthread.h>
+#include <time.h>
+#include <openssl/ssl.h>
+
+/* global #defines */
+#define SSLCACHE_KEYS 3			/* current ticket key, and the ones before it */
+#define SSLCACHE_SESSION_MAX 2048	/* biggest DER encoded session a slot holds */
+#define SSLCACHE_UPSTREAM 8		/* game servers to remember a session for */
+#define SSLCACHE_NAME_MAX 128
+
+/* structs and typedefs */
+
+struct sslcache_key {
+	unsigned char name[16];
+	unsigned char aes[32];
+	unsigned char hmac[32];
+	time_t created;
+};
+
+struct sslcache_slot {
+	unsigned int idlen;
+	unsigned char id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+	time_t expires;
+	unsigned int derlen;
+	unsigned char der[SSLCACHE_SESSION_MAX];
+};
+
+/* the last session we got from a game server, so the next player's
+ * connection there can resume it. */
+struct sslcache_upstream {
+	char name[SSLCACHE_NAME_MAX];	/* host:service */
+	time_t expires;
+	unsigned int derlen;
+	unsigned char der[SSLCACHE_SESSION_MAX];
+};
+
+/* This lives in a shared mapping made by the parent before it starts
+ * forking, so every session sees the same keys, cache and counters. */
+struct sslcache_data {
+	pthread_mutex_t lock;
+	int tickets;		/* hand out session tickets at all */
+	int rotate;		/* seconds between new ticket keys, 0 for never */
+	int timeout;		/* session lifetime in seconds */
+	int current;		/* index of the key new tickets get */
+	struct sslcache_key keys[SSLCACHE_KEYS];
+
+	long int handshakes;
+	long int resumed;
+	long int ticket_hits;
+	long int cache_hits;
+	long int cache_misses;
+	long int rotations;
+
+	long int upstream_handshakes;
+	long int upstream_resumed;
+	long int upstream_saved;
+	struct sslcache_upstream upstream[SSLCACHE_UPSTREAM];
+
+	int slots;		/* shared session cache size, 0 for none */
+	struct sslcache_slot slot[];
+};
+
+/* exported global variable declarations */
+extern struct sslcache_data *sslcache;
+
+/* exported function declarations */
+int sslcache_init(GKeyFile *gkf);
+void sslcache_attach(SSL_CTX *ctx);
+void sslcache_count(SSL *ssl);
+void sslcache_upstream_attach(SSL_CTX *ctx, int reuse);
+void sslcache_upstream_resume(SSL *ssl, char *name);
+void sslcache_upstream_count(SSL *ssl);
+int sslcache_printstats(char *buf, size_t len);
+
+#endif /* MUDITM_SSLCACHE_H */
@@ -0,0 +1,661 @@
+/* stats.c - live numbers from all of the sessions, for the admin socket */
+/* Created: Mon Oct 19 13:41:09 PM EDT 2026 malakai */
+/* $Id: stats.c,v 1.1 2026/10/19 17:41:09 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Sessions can't see each other's Endpoints, and neither can the parent
+ * that answers the admin socket.  So there's a table in shared memory with
+ * a slot per running session.  The session copies its iostats there at every
+ * checkpoint, and the admin socket in the parent reads them. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "debug.h"
+#include "muditm.h"
+#include "proxy.h"
+#include "config.h"
+#include "sslcache.h"
+#include "handshake.h"
+#include "backend.h"
+#include "handlers.h"
+#include "counters.h"
+#include "stats.h"
+
+/* ---- local #defines ---- */
+#define STATS_FAMILY_SOCK 0
+#define STATS_FAMILY_MCCP 1
+#define STATS_FAMILY_RATE 2
+
+/* ---- structs and typedefs ---- */
+
+/* ---- local variable declarations ---- */
+struct stats_data *stats = NULL;
+static int stats_me = -1;		/* this session's slot */
+static time_t stats_next = 0;		/* when the next checkpoint is due */
+static char *stats_side_name[STATS_SIDES] = { "client", "game" };
+static char *stats_latency_name[STATS_SIDES] = { "to_game", "to_client" };
+
+/* ---- local function declarations ---- */
+void stats_fold(struct stats_session *ss, pid_t pid);
+double stats_rate(long int bytes, struct timeval *ts);
+void stats_session_family(FILE *f, struct stats_session *copy, int count,
+	char *name, char *type, char *help, int which);
+void stats_side_family(FILE *f, char *name, char *type, char *help,
+	double *in, double *out, char *fmt);
+void stats_latency_lines(FILE *f, char *name, char *labels, Histogram *h);
+void stats_hot_family(FILE *f, struct counter_data *hot, struct stats_session *copy, int count);
+
+/* ---- code starts here ---- */
+
+/* Called once in the parent, before any forking.  0 if it couldn't. */
+int stats_init(GKeyFile *gkf) {
+
+	int slots;
+	size_t size;
+
+	slots = get_conf_int(gkf,"muditm","stats-sessions",256);
+	if(slots < 0) slots = 0;
+
+	size = sizeof(struct stats_data) + (slots * sizeof(struct stats_session));
+	stats = (struct stats_data *)mmap(NULL,size,
+		PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0
+	);
+	if(stats == MAP_FAILED) {
+		muditm_log("Couldn't map %zu bytes for the session stats: %s",
+			size,strerror(errno)
+		);
+		stats = NULL;
+		return(0);
+	}
+	memset(stats,0,size);
+
+	stats->started = time(NULL);
+	stats->slots = slots;
+	stats->interval = get_conf_int(gkf,"muditm","stats-interval",5);
+	if(stats->interval < 1) stats->interval = 1;
+
+	return(1);
+}
+
+void stats_accepted(void) {
+	if(!stats) return;
+	__atomic_add_fetch(&(stats->accepted),1,__ATOMIC_RELAXED);
+}
+
+/* a new session takes a slot. */
+void stats_session_start(char *addr) {
+
+	struct stats_session *ss;
+	pid_t none, me = getpid();
+	int i;
+
+	if(!stats) return;
+
+	for(i=0; i<stats->slots; i++) {
+		none = 0;
+		ss = &(stats->slot[i]);
+		if(__atomic_compare_exchange_n(&(ss->pid),&none,me,
+			0,__ATOMIC_ACQUIRE,__ATOMIC_RELAXED)) {
+			ss->started = time(NULL);
+			snprintf(ss->addr,sizeof(ss->addr),"%s",addr);
+			memset(ss->live,0,sizeof(ss->live));
+			memset(ss->side,0,sizeof(ss->side));
+			memset(ss->latency,0,sizeof(ss->latency));
+			memset(&(ss->hot),0,sizeof(ss->hot));
+			stats_me = i;
+			stats_next = ss->started + stats->interval;
+			return;
+		}
+	}
+	__atomic_add_fetch(&(stats->untracked),1,__ATOMIC_RELAXED);
+}
+
+/* from here on, the endpoint's byte counts go straight into the slot. */
+void stats_session_attach(Endpoint *ep, int side) {
+
+	struct stats_live *live;
+
+	if(!stats || (stats_me < 0) || !ep) return;
+
+	live = &(stats->slot[stats_me].live[side]);
+	iostat_share(&(ep->sockstats),&(live->sock));
+	iostat_share(&(ep->mccpstats),&(live->mccp));
+}
+
+/* called on every pass of the proxy loop, but only does anything once
+ * every stats-interval seconds. */
+void stats_session_update(Endpoint *client, Endpoint *game) {
+
+	struct stats_session *ss;
+	time_t now;
+
+	if(!stats || (stats_me < 0)) return;
+
+	now = time(NULL);
+	if(now < stats_next) return;
+	stats_next = now + stats->interval;
+
+	iostat_checkpoint(&(client->sockstats),STATS_RATE_WEIGHT);
+	iostat_checkpoint(&(client->mccpstats),STATS_RATE_WEIGHT);
+	iostat_checkpoint(&(game->sockstats),STATS_RATE_WEIGHT);
+	iostat_checkpoint(&(game->mccpstats),STATS_RATE_WEIGHT);
+
+	ss = &(stats->slot[stats_me]);
+	ss->side[STATS_CLIENT].sock = client->sockstats;
+	ss->side[STATS_CLIENT].mccp = client->mccpstats;
+	ss->side[STATS_GAME].sock = game->sockstats;
+	ss->side[STATS_GAME].mccp = game->mccpstats;
+	ss->latency[STATS_CLIENT] = client->latency;
+	ss->latency[STATS_GAME] = game->latency;
+	ss->hot = counters;
+}
+
+/* add the slot of session pid to the totals, and let the slot go.  Atomics
+ * only, since stats_reap() does it from the SIGCHLD handler.  The byte
+ * counts are up to the last read or write, even for a session that
+ * crashed.  They're taken out of the slot as they go into done, so
+ * stats_publish() can't count them twice.  The rest are plain adds, so
+ * whoever turns the pid into -pid first is the only one to fold it.  A
+ * session that dies while it's folding leaves the slot at -pid, and
+ * stats_reap() just lets it go. */
+void stats_fold(struct stats_session *ss, pid_t pid) {
+
+	struct stats_live *live = ss->live;
+	struct stats_done *d;
+	int s;
+
+	if(!__atomic_compare_exchange_n(&(ss->pid),&pid,-pid,
+		0,__ATOMIC_ACQUIRE,__ATOMIC_RELAXED)) {
+		return;
+	}
+	for(s=0; s<STATS_SIDES; s++) {
+		d = &(stats->done[s]);
+		__atomic_add_fetch(&(d->sock_in),__atomic_exchange_n(&(live[s].sock.in),0,__ATOMIC_RELAXED),__ATOMIC_RELAXED);
+		__atomic_add_fetch(&(d->sock_out),__atomic_exchange_n(&(live[s].sock.out),0,__ATOMIC_RELAXED),__ATOMIC_RELAXED);
+		__atomic_add_fetch(&(d->mccp_in),__atomic_exchange_n(&(live[s].mccp.in),0,__ATOMIC_RELAXED),__ATOMIC_RELAXED);
+		__atomic_add_fetch(&(d->mccp_out),__atomic_exchange_n(&(live[s].mccp.out),0,__ATOMIC_RELAXED),__ATOMIC_RELAXED);
+		hist_add_atomic(&(stats->latency[s]),&(ss->latency[s]));
+	}
+	counters_add_atomic(&(stats->hot),&(ss->hot));
+	__atomic_add_fetch(&(stats->finished),1,__ATOMIC_RELAXED);
+	__atomic_store_n(&(ss->pid),0,__ATOMIC_RELEASE);
+}
+
+/* the session is over, its final numbers go in the totals. */
+void stats_session_end(Endpoint *client, Endpoint *game) {
+
+	struct stats_session *ss;
+
+	if(!stats || (stats_me < 0)) return;
+
+	ss = &(stats->slot[stats_me]);
+	ss->side[STATS_CLIENT].sock = client->sockstats;
+	ss->side[STATS_CLIENT].mccp = client->mccpstats;
+	ss->side[STATS_GAME].sock = game->sockstats;
+	ss->side[STATS_GAME].mccp = game->mccpstats;
+	ss->latency[STATS_CLIENT] = client->latency;
+	ss->latency[STATS_GAME] = game->latency;
+	ss->hot = counters;
+	iostat_share(&(client->sockstats),NULL);
+	iostat_share(&(client->mccpstats),NULL);
+	iostat_share(&(game->sockstats),NULL);
+	iostat_share(&(game->mccpstats),NULL);
+	stats_fold(ss,getpid());
+	stats_me = -1;
+}
+
+/* The parent calls this for every session that exits.  One that didn't get
+ * to stats_session_end() still has a slot, with its last checkpoint in it.
+ * One that died halfway through folding its own can't be finished without
+ * counting some of it twice, so the rest of it is let go. */
+void stats_reap(pid_t pid) {
+
+	struct stats_session *ss;
+	pid_t found;
+	int i;
+
+	if(!stats) return;
+
+	for(i=0; i<stats->slots; i++) {
+		ss = &(stats->slot[i]);
+		found = __atomic_load_n(&(ss->pid),__ATOMIC_ACQUIRE);
+		if(found == pid) {
+			stats_fold(ss,pid);
+		} else if(found == -pid) {
+			__atomic_store_n(&(ss->pid),0,__ATOMIC_RELEASE);
+		}
+	}
+}
+
+/* The parent adds up the finished sessions and the running ones into
+ * stats->total.  It does this whenever it wakes up, which is at least
+ * every stats-interval, and before answering the admin socket. */
+void stats_publish(void) {
+
+	struct stats_total t;
+	struct stats_session *ss;
+	struct stats_live *live;
+	int i, s;
+
+	if(!stats) return;
+
+	memset(&t,0,sizeof(t));
+	for(s=0; s<STATS_SIDES; s++) {
+		t.side[s].sock_in = __atomic_load_n(&(stats->done[s].sock_in),__ATOMIC_RELAXED);
+		t.side[s].sock_out = __atomic_load_n(&(stats->done[s].sock_out),__ATOMIC_RELAXED);
+		t.side[s].mccp_in = __atomic_load_n(&(stats->done[s].mccp_in),__ATOMIC_RELAXED);
+		t.side[s].mccp_out = __atomic_load_n(&(stats->done[s].mccp_out),__ATOMIC_RELAXED);
+	}
+	for(i=0; i<stats->slots; i++) {
+		ss = &(stats->slot[i]);
+		if(__atomic_load_n(&(ss->pid),__ATOMIC_ACQUIRE) <= 0) continue;
+		t.active++;
+		for(s=0; s<STATS_SIDES; s++) {
+			live = &(ss->live[s]);
+			t.side[s].sock_in += __atomic_load_n(&(live->sock.in),__ATOMIC_RELAXED);
+			t.side[s].sock_out += __atomic_load_n(&(live->sock.out),__ATOMIC_RELAXED);
+			t.side[s].mccp_in += __atomic_load_n(&(live->mccp.in),__ATOMIC_RELAXED);
+			t.side[s].mccp_out += __atomic_load_n(&(live->mccp.out),__ATOMIC_RELAXED);
+		}
+	}
+	/* Bytes on their way from a slot to done aren't in either one for a
+	 * moment.  These are counters, and one that goes down looks like a
+	 * restart. */
+	for(s=0; s<STATS_SIDES; s++) {
+		t.side[s].sock_in = MAX(t.side[s].sock_in,stats->total.side[s].sock_in);
+		t.side[s].sock_out = MAX(t.side[s].sock_out,stats->total.side[s].sock_out);
+		t.side[s].mccp_in = MAX(t.side[s].mccp_in,stats->total.side[s].mccp_in);
+		t.side[s].mccp_out = MAX(t.side[s].mccp_out,stats->total.side[s].mccp_out);
+	}
+	t.when = time(NULL);
+	stats->total = t;
+}
+
+/* bytes per second over the last checkpoint interval. */
+double stats_rate(long int bytes, struct timeval *ts) {
+	double t = ts->tv_sec + (ts->tv_usec / 1000000.0);
+	return( (t > 0)?(bytes / t):0.0 );
+}
+
+/* one family of per session numbers.  Prometheus wants all of a family's
+ * lines together. */
+void stats_session_family(FILE *f, struct stats_session *copy, int count,
+	char *name, char *type, char *help, int which
+) {
+
+	struct iostat_data *ios;
+	struct iostat_counter *ioc;
+	int i, s;
+
+	fprintf(f,"# HELP %s %s\n",name,help);
+	fprintf(f,"# TYPE %s %s\n",name,type);
+	for(i=0; i<count; i++) {
+		for(s=0; s<STATS_SIDES; s++) {
+			if(which == STATS_FAMILY_RATE) {
+				ios = &(copy[i].side[s].sock);
+				fprintf(f,"%s{pid=\"%d\",side=\"%s\",direction=\"in\"} %.1f\n",
+					name,copy[i].pid,stats_side_name[s],stats_rate(ios->rate.in,&(ios->rate.ts)));
+				fprintf(f,"%s{pid=\"%d\",side=\"%s\",direction=\"out\"} %.1f\n",
+					name,copy[i].pid,stats_side_name[s],stats_rate(ios->rate.out,&(ios->rate.ts)));
+			} else {
+				ioc = (which == STATS_FAMILY_MCCP)?&(copy[i].live[s].mccp):&(copy[i].live[s].sock);
+				fprintf(f,"%s{pid=\"%d\",side=\"%s\",direction=\"in\"} %ld\n",
+					name,copy[i].pid,stats_side_name[s],ioc->in);
+				fprintf(f,"%s{pid=\"%d\",side=\"%s\",direction=\"out\"} %ld\n",
+					name,copy[i].pid,stats_side_name[s],ioc->out);
+			}
+		}
+	}
+}
+
+/* a per side total. */
+void stats_side_family(FILE *f, char *name, char *type, char *help,
+	double *in, double *out, char *fmt
+) {
+
+	char line[256];
+	int s;
+
+	fprintf(f,"# HELP %s %s\n",name,help);
+	fprintf(f,"# TYPE %s %s\n",name,type);
+	for(s=0; s<STATS_SIDES; s++) {
+		if(in[s] >= 0) {
+			snprintf(line,sizeof(line),"%s{side=\"%s\",direction=\"in\"} %s\n",name,stats_side_name[s],fmt);
+			fprintf(f,line,in[s]);
+		}
+		if(out[s] >= 0) {
+			snprintf(line,sizeof(line),"%s{side=\"%s\",direction=\"out\"} %s\n",name,stats_side_name[s],fmt);
+			fprintf(f,line,out[s]);
+		}
+	}
+}
+
+/* a summary's worth of lines for one latency histogram, in seconds. */
+void stats_latency_lines(FILE *f, char *name, char *labels, Histogram *h) {
+
+	static double q[] = { 0.5, 0.99, 0.999 };
+	int i;
+
+	for(i=0; i<sizeof(q)/sizeof(q[0]); i++) {
+		fprintf(f,"%s{%s,quantile=\"%g\"} %.9f\n",name,labels,q[i],
+			hist_percentile(h,q[i]) / 1000000000.0
+		);
+	}
+	fprintf(f,"%s_sum{%s} %.9f\n",name,labels,h->sum / 1000000000.0);
+	fprintf(f,"%s_count{%s} %ld\n",name,labels,h->count);
+}
+
+/* the hot path counters, added up, then per session. */
+void stats_hot_family(FILE *f, struct counter_data *hot, struct stats_session *copy, int count) {
+
+	struct counter_data total;
+	char *name;
+	int i, a;
+
+	total = *hot;
+	for(i=0; i<count; i++) {
+		counters_add_atomic(&total,&(copy[i].hot));
+	}
+
+	fprintf(f,"# HELP muditm_socket_calls_total Socket read and write calls, SSL_read and SSL_write included, and TCP_QUICKACK after reads.\n");
+	fprintf(f,"# TYPE muditm_socket_calls_total counter\n");
+	fprintf(f,"muditm_socket_calls_total{op=\"read\"} %ld\n",total.reads);
+	fprintf(f,"muditm_socket_calls_total{op=\"write\"} %ld\n",total.writes);
+	fprintf(f,"muditm_socket_calls_total{op=\"quickack\"} %ld\n",total.quickacks);
+	fprintf(f,"# HELP muditm_socket_call_bytes Average bytes per socket call.\n");
+	fprintf(f,"# TYPE muditm_socket_call_bytes gauge\n");
+	fprintf(f,"muditm_socket_call_bytes{op=\"read\"} %.1f\n",
+		total.reads?((double)total.read_bytes / total.reads):0.0);
+	fprintf(f,"muditm_socket_call_bytes{op=\"write\"} %.1f\n",
+		total.writes?((double)total.write_bytes / total.writes):0.0);
+	fprintf(f,"# HELP muditm_pcre2_match_calls_total pcre2_match() calls.\n");
+	fprintf(f,"# TYPE muditm_pcre2_match_calls_total counter\n");
+	fprintf(f,"muditm_pcre2_match_calls_total %ld\n",total.matches);
+	fprintf(f,"# HELP muditm_pcre2_match_bytes_total Bytes handed to pcre2_match().\n");
+	fprintf(f,"# TYPE muditm_pcre2_match_bytes_total counter\n");
+	fprintf(f,"muditm_pcre2_match_bytes_total %ld\n",total.match_bytes);
+	fprintf(f,"# HELP muditm_partial_match_holds_total Times input was held back for a partial match.\n");
+	fprintf(f,"# TYPE muditm_partial_match_holds_total counter\n");
+	fprintf(f,"muditm_partial_match_holds_total %ld\n",total.partials);
+	fprintf(f,"# HELP muditm_iobuf_moved_bytes_total Bytes that pop_iobuf() moved down its buffer.\n");
+	fprintf(f,"# TYPE muditm_iobuf_moved_bytes_total counter\n");
+	fprintf(f,"muditm_iobuf_moved_bytes_total %ld\n",total.moved);
+	fprintf(f,"# HELP muditm_zlib_calls_total deflate() and inflate() calls.\n");
+	fprintf(f,"# TYPE muditm_zlib_calls_total counter\n");
+	fprintf(f,"muditm_zlib_calls_total{op=\"deflate\"} %ld\n",total.deflates);
+	fprintf(f,"muditm_zlib_calls_total{op=\"inflate\"} %ld\n",total.inflates);
+	fprintf(f,"# HELP muditm_zlib_seconds_total Time spent in deflate() and inflate().\n");
+	fprintf(f,"# TYPE muditm_zlib_seconds_total counter\n");
+	fprintf(f,"muditm_zlib_seconds_total{op=\"deflate\"} %.9f\n",total.deflate_nsec / 1000000000.0);
+	fprintf(f,"muditm_zlib_seconds_total{op=\"inflate\"} %.9f\n",total.inflate_nsec / 1000000000.0);
+	fprintf(f,"# HELP muditm_rate_limit_waits_total Times a session used up its rate limit and had to wait.\n");
+	fprintf(f,"# TYPE muditm_rate_limit_waits_total counter\n");
+	fprintf(f,"muditm_rate_limit_waits_total %ld\n",total.shaped);
+
+	fprintf(f,"# HELP muditm_action_calls_total Pattern handler calls, by handler.\n");
+	fprintf(f,"# TYPE muditm_action_calls_total counter\n");
+	for(a=0; (a < COUNTER_ACTIONS) && (name = pattern_action_name(a)); a++) {
+		fprintf(f,"muditm_action_calls_total{action=\"%s\"} %ld\n",name,total.action_calls[a]);
+	}
+	fprintf(f,"# HELP muditm_action_seconds_total Time spent in pattern handlers, by handler.\n");
+	fprintf(f,"# TYPE muditm_action_seconds_total counter\n");
+	for(a=0; (a < COUNTER_ACTIONS) && (name = pattern_action_name(a)); a++) {
+		fprintf(f,"muditm_action_seconds_total{action=\"%s\"} %.9f\n",name,total.action_nsec[a] / 1000000000.0);
+	}
+
+	/* the main ones for each running session. */
+	fprintf(f,"# HELP muditm_session_hotpath Each running session's hot path counters, as of its last checkpoint.\n");
+	fprintf(f,"# TYPE muditm_session_hotpath gauge\n");
+	for(i=0; i<count; i++) {
+		struct counter_data *c = &(copy[i].hot);
+		fprintf(f,"muditm_session_hotpath{pid=\"%d\",counter=\"reads\"} %ld\n",copy[i].pid,c->reads);
+		fprintf(f,"muditm_session_hotpath{pid=\"%d\",counter=\"read_bytes\"} %ld\n",copy[i].pid,c->read_bytes);
+		fprintf(f,"muditm_session_hotpath{pid=\"%d\",counter=\"writes\"} %ld\n",copy[i].pid,c->writes);
+		fprintf(f,"muditm_session_hotpath{pid=\"%d\",counter=\"write_bytes\"} %ld\n",copy[i].pid,c->write_bytes);
+		fprintf(f,"muditm_session_hotpath{pid=\"%d\",counter=\"pcre2_calls\"} %ld\n",copy[i].pid,c->matches);
+		fprintf(f,"muditm_session_hotpath{pid=\"%d\",counter=\"pcre2_bytes\"} %ld\n",copy[i].pid,c->match_bytes);
+		fprintf(f,"muditm_session_hotpath{pid=\"%d\",counter=\"partial_holds\"} %ld\n",copy[i].pid,c->partials);
+		fprintf(f,"muditm_session_hotpath{pid=\"%d\",counter=\"moved_bytes\"} %ld\n",copy[i].pid,c->moved);
+		fprintf(f,"muditm_session_hotpath{pid=\"%d\",counter=\"deflate_nsec\"} %ld\n",copy[i].pid,c->deflate_nsec);
+		fprintf(f,"muditm_session_hotpath{pid=\"%d\",counter=\"inflate_nsec\"} %ld\n",copy[i].pid,c->inflate_nsec);
+		fprintf(f,"muditm_session_hotpath{pid=\"%d\",counter=\"rate_limit_waits\"} %ld\n",copy[i].pid,c->shaped);
+		fprintf(f,"muditm_session_hotpath{pid=\"%d\",counter=\"quickacks\"} %ld\n",copy[i].pid,c->quickacks);
+	}
+}
+
+/* everything, in the Prometheus text format.  0 if it couldn't. */
+int stats_prometheus(FILE *f) {
+
+	struct stats_session *copy;
+	struct stats_side *sd;
+	double sock_in[STATS_SIDES], sock_out[STATS_SIDES];
+	double mccp_in[STATS_SIDES], mccp_out[STATS_SIDES];
+	double rate_in[STATS_SIDES], rate_out[STATS_SIDES];
+	double ratio_in[STATS_SIDES], ratio_out[STATS_SIDES];
+	static Histogram latency[STATS_SIDES];	/* only the parent scrapes, one at a time */
+	struct counter_data hot;
+	long int finished;
+	char labels[128];
+	time_t now = time(NULL);
+	int i, s, active = 0;
+
+	if(!stats) return(1);
+
+	/* totals first.  A session that ends after this is still in the copy
+	 * and not in the totals yet, rather than in both. */
+	stats_publish();
+	for(s=0; s<STATS_SIDES; s++) {
+		hist_init(&(latency[s]));
+		hist_add_atomic(&(latency[s]),&(stats->latency[s]));
+	}
+	hot = stats->hot;
+	finished = __atomic_load_n(&(stats->finished),__ATOMIC_RELAXED);
+
+	/* a copy of the running sessions, so every family sees the same ones. */
+	if( !(copy = (struct stats_session *)malloc(sizeof(struct stats_session) * (stats->slots+1))) ) {
+		muditm_log("Couldn't copy the session stats: %s",strerror(errno));
+		return(0);
+	}
+	for(i=0; i<stats->slots; i++) {
+		if(__atomic_load_n(&(stats->slot[i].pid),__ATOMIC_ACQUIRE) > 0) {
+			copy[active++] = stats->slot[i];
+		}
+	}
+
+	for(s=0; s<STATS_SIDES; s++) {
+		sock_in[s] = stats->total.side[s].sock_in;
+		sock_out[s] = stats->total.side[s].sock_out;
+		mccp_in[s] = stats->total.side[s].mccp_in;
+		mccp_out[s] = stats->total.side[s].mccp_out;
+		rate_in[s] = rate_out[s] = 0.0;
+		for(i=0; i<active; i++) {
+			sd = &(copy[i].side[s]);
+			rate_in[s] += stats_rate(sd->sock.rate.in,&(sd->sock.rate.ts));
+			rate_out[s] += stats_rate(sd->sock.rate.out,&(sd->sock.rate.ts));
+		}
+		/* same sums as the end of session log line.  -1 leaves it out. */
+		ratio_in[s] = (mccp_in[s] > 0)?(1.0 - (sock_in[s] / mccp_in[s])):-1;
+		ratio_out[s] = (mccp_out[s] > 0)?(1.0 - (sock_out[s] / mccp_out[s])):-1;
+	}
+
+	fprintf(f,"# HELP muditm_info Which MUDitM this is.\n");
+	fprintf(f,"# TYPE muditm_info gauge\n");
+	fprintf(f,"muditm_info{version=\"%s\"} 1\n",muditm_proxy_name);
+	fprintf(f,"# HELP muditm_start_time_seconds When the main process started.\n");
+	fprintf(f,"# TYPE muditm_start_time_seconds gauge\n");
+	fprintf(f,"muditm_start_time_seconds %ld\n",(long int)stats->started);
+	if(muditm_config) {
+		fprintf(f,"# HELP muditm_config_generation How many times the config was loaded.\n");
+		fprintf(f,"# TYPE muditm_config_generation gauge\n");
+		fprintf(f,"muditm_config_generation %d\n",muditm_config->generation);
+	}
+
+	if(muditm_logring) {
+		fprintf(f,"# HELP muditm_log_lines_total Log lines that went through the log ring.\n");
+		fprintf(f,"# TYPE muditm_log_lines_total counter\n");
+		fprintf(f,"muditm_log_lines_total{result=\"written\"} %lu\n",
+			__atomic_load_n(&(muditm_logring->written),__ATOMIC_RELAXED));
+		fprintf(f,"muditm_log_lines_total{result=\"dropped\"} %lu\n",
+			__atomic_load_n(&(muditm_logring->dropped),__ATOMIC_RELAXED));
+	}
+
+	fprintf(f,"# HELP muditm_sessions_active Sessions running now.\n");
+	fprintf(f,"# TYPE muditm_sessions_active gauge\n");
+	fprintf(f,"muditm_sessions_active %d\n",active);
+	fprintf(f,"# HELP muditm_sessions_accepted_total Client connections accepted.\n");
+	fprintf(f,"# TYPE muditm_sessions_accepted_total counter\n");
+	fprintf(f,"muditm_sessions_accepted_total %ld\n",__atomic_load_n(&(stats->accepted),__ATOMIC_RELAXED));
+	fprintf(f,"# HELP muditm_sessions_finished_total Sessions that are over.\n");
+	fprintf(f,"# TYPE muditm_sessions_finished_total counter\n");
+	fprintf(f,"muditm_sessions_finished_total %ld\n",finished);
+	fprintf(f,"# HELP muditm_sessions_untracked_total Sessions that didn't fit in stats-sessions.\n");
+	fprintf(f,"# TYPE muditm_sessions_untracked_total counter\n");
+	fprintf(f,"muditm_sessions_untracked_total %ld\n",__atomic_load_n(&(stats->untracked),__ATOMIC_RELAXED));
+
+	stats_side_family(f,"muditm_socket_bytes_total","counter",
+		"Bytes read and written on the sockets, over all sessions.",sock_in,sock_out,"%.0f");
+	stats_side_family(f,"muditm_mccp_bytes_total","counter",
+		"Uncompressed bytes that went through MCCP, over all sessions.",mccp_in,mccp_out,"%.0f");
+	stats_side_family(f,"muditm_compression_ratio","gauge",
+		"Fraction of the bytes that MCCP saved.",ratio_in,ratio_out,"%.4f");
+	stats_side_family(f,"muditm_socket_rate_bytes","gauge",
+		"Socket bytes per second, summed over the running sessions.",rate_in,rate_out,"%.1f");
+
+	/* MUDitM's own delay, from reading bytes on one side to writing them
+	 * to the other. */
+	fprintf(f,"# HELP muditm_proxy_latency_seconds Time from reading bytes to writing them out the other side.\n");
+	fprintf(f,"# TYPE muditm_proxy_latency_seconds summary\n");
+	for(s=0; s<STATS_SIDES; s++) {
+		for(i=0; i<active; i++) {
+			hist_add(&(latency[s]),&(copy[i].latency[s]));
+		}
+		snprintf(labels,sizeof(labels),"direction=\"%s\"",stats_latency_name[s]);
+		stats_latency_lines(f,"muditm_proxy_latency_seconds",labels,&(latency[s]));
+	}
+
+	fprintf(f,"# HELP muditm_session_age_seconds How long each running session has been up.\n");
+	fprintf(f,"# TYPE muditm_session_age_seconds gauge\n");
+	for(i=0; i<active; i++) {
+		fprintf(f,"muditm_session_age_seconds{pid=\"%d\",addr=\"%s\"} %ld\n",
+			copy[i].pid,copy[i].addr,(long int)(now - copy[i].started)
+		);
+	}
+	stats_hot_family(f,&hot,copy,active);
+
+	stats_session_family(f,copy,active,"muditm_session_socket_bytes","gauge",
+		"Socket bytes of each running session.",STATS_FAMILY_SOCK);
+	stats_session_family(f,copy,active,"muditm_session_mccp_bytes","gauge",
+		"Uncompressed MCCP bytes of each running session.",STATS_FAMILY_MCCP);
+	stats_session_family(f,copy,active,"muditm_session_socket_rate_bytes","gauge",
+		"Socket bytes per second of each running session.",STATS_FAMILY_RATE);
+	fprintf(f,"# HELP muditm_session_latency_seconds Each running session's time from reading bytes to writing them out.\n");
+	fprintf(f,"# TYPE muditm_session_latency_seconds summary\n");
+	for(i=0; i<active; i++) {
+		for(s=0; s<STATS_SIDES; s++) {
+			snprintf(labels,sizeof(labels),"pid=\"%d\",direction=\"%s\"",copy[i].pid,stats_latency_name[s]);
+			stats_latency_lines(f,"muditm_session_latency_seconds",labels,&(copy[i].latency[s]));
+		}
+	}
+	free(copy);
+
+	if(sslcache) {
+		fprintf(f,"# HELP muditm_ssl_handshakes_total Finished SSL handshakes.\n");
+		fprintf(f,"# TYPE muditm_ssl_handshakes_total counter\n");
+		fprintf(f,"muditm_ssl_handshakes_total{side=\"client\"} %ld\n",
+			__atomic_load_n(&(sslcache->handshakes),__ATOMIC_RELAXED));
+		fprintf(f,"muditm_ssl_handshakes_total{side=\"game\"} %ld\n",
+			__atomic_load_n(&(sslcache->upstream_handshakes),__ATOMIC_RELAXED));
+		fprintf(f,"# HELP muditm_ssl_resumed_total SSL handshakes that resumed a session.\n");
+		fprintf(f,"# TYPE muditm_ssl_resumed_total counter\n");
+		fprintf(f,"muditm_ssl_resumed_total{side=\"client\"} %ld\n",
+			__atomic_load_n(&(sslcache->resumed),__ATOMIC_RELAXED));
+		fprintf(f,"muditm_ssl_resumed_total{side=\"game\"} %ld\n",
+			__atomic_load_n(&(sslcache->upstream_resumed),__ATOMIC_RELAXED));
+		fprintf(f,"# HELP muditm_ssl_ticket_key_rotations_total New session ticket keys made.\n");
+		fprintf(f,"# TYPE muditm_ssl_ticket_key_rotations_total counter\n");
+		fprintf(f,"muditm_ssl_ticket_key_rotations_total %ld\n",
+			__atomic_load_n(&(sslcache->rotations),__ATOMIC_RELAXED));
+	}
+
+	if(handshake) {
+		fprintf(f,"# HELP muditm_ssl_handshake_waiting Client handshakes waiting for a slot now.\n");
+		fprintf(f,"# TYPE muditm_ssl_handshake_waiting gauge\n");
+		fprintf(f,"muditm_ssl_handshake_waiting %ld\n",
+			__atomic_load_n(&(handshake->waiting),__ATOMIC_RELAXED));
+		fprintf(f,"# HELP muditm_ssl_handshake_waiting_peak Most client handshakes ever waiting at once.\n");
+		fprintf(f,"# TYPE muditm_ssl_handshake_waiting_peak gauge\n");
+		fprintf(f,"muditm_ssl_handshake_waiting_peak %ld\n",
+			__atomic_load_n(&(handshake->peak_waiting),__ATOMIC_RELAXED));
+		fprintf(f,"# HELP muditm_ssl_handshake_results_total Client handshakes by how they ended.\n");
+		fprintf(f,"# TYPE muditm_ssl_handshake_results_total counter\n");
+		fprintf(f,"muditm_ssl_handshake_results_total{result=\"done\"} %ld\n",
+			__atomic_load_n(&(handshake->completed),__ATOMIC_RELAXED));
+		fprintf(f,"muditm_ssl_handshake_results_total{result=\"failed\"} %ld\n",
+			__atomic_load_n(&(handshake->failed),__ATOMIC_RELAXED));
+		fprintf(f,"muditm_ssl_handshake_results_total{result=\"timeout\"} %ld\n",
+			__atomic_load_n(&(handshake->timeouts),__ATOMIC_RELAXED));
+		fprintf(f,"# HELP muditm_ssl_handshake_latency_seconds Client handshake time, start to finish.\n");
+		fprintf(f,"# TYPE muditm_ssl_handshake_latency_seconds summary\n");
+		fprintf(f,"muditm_ssl_handshake_latency_seconds{quantile=\"0.5\"} %.6f\n",
+			handshake_percentile(handshake->latency,0.50) / 1000000.0);
+		fprintf(f,"muditm_ssl_handshake_latency_seconds{quantile=\"0.9\"} %.6f\n",
+			handshake_percentile(handshake->latency,0.90) / 1000000.0);
+		fprintf(f,"muditm_ssl_handshake_latency_seconds{quantile=\"0.99\"} %.6f\n",
+			handshake_percentile(handshake->latency,0.99) / 1000000.0);
+		fprintf(f,"muditm_ssl_handshake_latency_seconds_sum %.6f\n",
+			__atomic_load_n(&(handshake->latency_usec),__ATOMIC_RELAXED) / 1000000.0);
+		fprintf(f,"muditm_ssl_handshake_latency_seconds_count %ld\n",
+			__atomic_load_n(&(handshake->completed),__ATOMIC_RELAXED));
+	}
+
+	if(backends) {
+		fprintf(f,"# HELP muditm_backend_up Whether the game server passed its last health check.\n");
+		fprintf(f,"# TYPE muditm_backend_up gauge\n");
+		for(i=0; i<backends->count; i++) {
+			fprintf(f,"muditm_backend_up{backend=\"%s\"} %d\n",backends->backend[i].name,
+				__atomic_load_n(&(backends->backend[i].up),__ATOMIC_RELAXED));
+		}
+		fprintf(f,"# HELP muditm_backend_sessions Sessions connected to the game server now.\n");
+		fprintf(f,"# TYPE muditm_backend_sessions gauge\n");
+		for(i=0; i<backends->count; i++) {
+			fprintf(f,"muditm_backend_sessions{backend=\"%s\"} %ld\n",backends->backend[i].name,
+				__atomic_load_n(&(backends->backend[i].active),__ATOMIC_RELAXED));
+		}
+		fprintf(f,"# HELP muditm_backend_connects_total Session connects to the game server, by how they went.\n");
+		fprintf(f,"# TYPE muditm_backend_connects_total counter\n");
+		for(i=0; i<backends->count; i++) {
+			fprintf(f,"muditm_backend_connects_total{backend=\"%s\",result=\"ok\"} %ld\n",
+				backends->backend[i].name,
+				__atomic_load_n(&(backends->backend[i].connects),__ATOMIC_RELAXED) -
+				__atomic_load_n(&(backends->backend[i].failures),__ATOMIC_RELAXED));
+			fprintf(f,"muditm_backend_connects_total{backend=\"%s\",result=\"failed\"} %ld\n",
+				backends->backend[i].name,
+				__atomic_load_n(&(backends->backend[i].failures),__ATOMIC_RELAXED));
+		}
+	}
+	return(1);
+}
@@ -0,0 +1,116 @@
+/* stats.h - live numbers from all of the sessions, for the admin socket */
+/* Created: Mon Oct 19 13:41:09 PM EDT 2026 malakai */
+/* $Id: stats.h,v 1.1 2026/10/19 17:41:09 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUDITM_STATS_H
+#define MUDITM_STATS_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "iostats.h"
+#include "histogram.h"
+#include "counters.h"
+#include "proxy.h"
+
+/* global #defines */
+#define STATS_RATE_WEIGHT 0.5	/* how much the newest interval counts in a rate */
+#define STATS_CACHELINE 64
+
+#define STATS_CLIENT 0
+#define STATS_GAME 1
+#define STATS_SIDES 2
+
+/* structs and typedefs */
+
+/* one side of a session, as of its last checkpoint. */
+struct stats_side {
+	struct iostat_data sock;
+	struct iostat_data mccp;
+};
+
+/* one side's byte counts, kept current by iostat_incr() as the session
+ * goes.  Each side gets a cache line to itself, so the parent reading a
+ * slot doesn't keep taking the line away from the session writing it, and
+ * neighboring slots don't share one. */
+struct stats_live {
+	struct iostat_counter sock;
+	struct iostat_counter mccp;
+} __attribute__((aligned(STATS_CACHELINE)));
+
+struct stats_session {
+	struct stats_live live[STATS_SIDES];
+	pid_t pid;		/* 0 for a free slot, -pid while it's being folded */
+	time_t started;
+	char addr[INET6_ADDRSTRLEN];
+	struct stats_side side[STATS_SIDES];
+	Histogram latency[STATS_SIDES];	/* by the side the bytes came from */
+	struct counter_data hot;
+};
+
+/* byte counts of sessions that are over. */
+struct stats_done {
+	long int sock_in, sock_out;
+	long int mccp_in, mccp_out;
+};
+
+/* everything so far, running sessions and finished ones, as last added up
+ * by the parent. */
+struct stats_total {
+	time_t when;		/* 0 until the first time */
+	long int active;
+	struct stats_done side[STATS_SIDES];
+};
+
+/* In a shared mapping made by the parent.  Each session keeps its byte
+ * counts in its own slot up to date, copies the rest of its numbers in
+ * every so often, and adds them to the done totals when it's over. */
+struct stats_data {
+	time_t started;
+	int interval;		/* seconds between session checkpoints */
+	long int accepted;
+	long int finished;
+	long int untracked;	/* sessions that didn't get a slot */
+	struct stats_done done[STATS_SIDES];
+	Histogram latency[STATS_SIDES];
+	struct counter_data hot;
+	struct stats_total total;	/* only the parent writes this */
+
+	int slots;
+	struct stats_session slot[];
+};
+
+/* exported global variable declarations */
+extern struct stats_data *stats;
+
+/* exported function declarations */
+int stats_init(GKeyFile *gkf);
+void stats_accepted(void);
+void stats_session_start(char *addr);
+void stats_session_attach(Endpoint *ep, int side);
+void stats_session_update(Endpoint *client, Endpoint *game);
+void stats_session_end(Endpoint *client, Endpoint *game);
+void stats_reap(pid_t pid);
+void stats_publish(void);
+int stats_prometheus(FILE *f);
+
+#endif /* MUDITM_STATS_H */
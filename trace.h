@@ -0,0 +1,70 @@
+/* trace.h - USDT tracepoints for bpftrace and friends */
+/* Created: Mon Oct 19 20:15:22 PM EDT 2026 malakai */
+/* $Id: trace.h,v 1.1 2026/10/20 00:15:22 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUDITM_TRACE_H
+#define MUDITM_TRACE_H
+
+/* Static tracepoints, so a live session can be looked at without turning on
+ * -d and restarting.  Built in when sys/sdt.h is around (the systemtap-sdt
+ * development package), or with 'make SDT=1', left out with 'make SDT=0'.
+ * Each one is a single nop until something attaches to it.  See them with
+ *
+ * 	bpftrace -l 'usdt:/usr/local/bin/muditm:*'
+ *
+ * and, for instance, watch one session's reads with
+ *
+ * 	bpftrace -p PID -e 'usdt:/usr/local/bin/muditm:muditm:read
+ * 		{ printf("%s %d\n", str(arg0), arg2); }'
+ *
+ * The probes, all in provider muditm, and their arguments:
+ *
+ * 	session__accept	fd, client address
+ * 	handshake__done	endpoint name, fd, 1 if the session was resumed
+ * 	game__connect	fd, game host, game service
+ * 	read		endpoint name, fd, bytes or error from read()/SSL_read()
+ * 	write		endpoint name, fd, bytes or error from write()/SSL_write()
+ * 	match		endpoint name, pattern number, match length
+ * 	handler__entry	endpoint name, action number, match length
+ * 	handler__return	endpoint name, action number, 1 if it ate the match
+ * 	mccp__start	endpoint name, EP_INPUT (inflate) or EP_OUTPUT (deflate)
+ * 	mccp__stop	endpoint name, EP_INPUT or EP_OUTPUT
+ * 	session__close	bytes from the client, bytes to the client
+ *
+ * Probe arguments are worked out even when nothing is attached, so they
+ * stay cheap.  The action number is where the handler sits in
+ * pattern_action_names[] in handlers.c, the same order the
+ * muditm_action_calls_total metric lists them in.
+ */
+
+/* global #defines */
+#ifdef HAVE_SYS_SDT
+#include <sys/sdt.h>
+#define TRACE1(name,a) DTRACE_PROBE1(muditm,name,a)
+#define TRACE2(name,a,b) DTRACE_PROBE2(muditm,name,a,b)
+#define TRACE3(name,a,b,c) DTRACE_PROBE3(muditm,name,a,b,c)
+#else
+#define TRACE1(name,a)
+#define TRACE2(name,a,b)
+#define TRACE3(name,a,b,c)
+#endif
+
+#endif /* MUDITM_TRACE_H */
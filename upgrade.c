@@ -0,0 +1,330 @@
+/* upgrade.c - handing the listener to a new muditm, or taking it from systemd */
+/* Created: Mon Oct 19 20:58:40 PM EDT 2026 malakai */
+/* $Id: upgrade.c,v 1.1 2026/10/20 00:58:40 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Getting a new build running without anybody's connect being refused.
+ *
+ * Send the main process a SIGUSR2, and it starts the muditm binary again,
+ * the same way it was started, and hands it the listening socket over a
+ * unix socketpair with SCM_RIGHTS.  Once the new one has its config read
+ * and is accepting, it says so, and the old one stops accepting and waits
+ * for its sessions to end before exiting.  If the new one dies or doesn't
+ * answer within UPGRADE_TIMEOUT, the old one carries on like nothing
+ * happened.  Connections that arrive in between wait in the listen queue,
+ * which both of them share.
+ *
+ * Under systemd, the socket can come from a .socket unit instead, with
+ * LISTEN_FDS and LISTEN_PID.  The listener then outlives the service, and
+ * with KillMode=process a restart leaves the running sessions be.
+ *
+ * With Type=notify, systemd hears READY=1 once we're accepting, and after
+ * a SIGUSR2 the old one tells it the new one's pid with MAINPID=, so that
+ * the old one retiring doesn't look like the service stopping, and a
+ * reload HUPs the right process. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "debug.h"
+#include "muditm.h"
+#include "upgrade.h"
+
+/* ---- local #defines ---- */
+
+/* ---- structs and typedefs ---- */
+
+/* ---- local variable declarations ---- */
+volatile sig_atomic_t upgrade_pending = 0;
+
+static char **upgrade_argv = NULL;
+static int upgrade_fd = -1;	/* back to the old muditm, until we're ready */
+
+/* ---- local function declarations ---- */
+int upgrade_receive(int channel);
+void upgrade_notify(char *state);
+
+/* ---- code starts here ---- */
+
+/* true if s is a socket something is listening on. */
+int upgrade_is_listener(int s) {
+
+	int on = 0;
+	socklen_t len = sizeof(on);
+
+	if(getsockopt(s,SOL_SOCKET,SO_ACCEPTCONN,&on,&len) == -1) {
+		return(0);
+	}
+	return(on);
+}
+
+/* the listening socket, sent over channel by the old muditm. */
+int upgrade_receive(int channel) {
+
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char byte;
+	char control[CMSG_SPACE(sizeof(int))];
+	int s = -1;
+
+	memset(&msg,0,sizeof(msg));
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	if(recvmsg(channel,&msg,MSG_CMSG_CLOEXEC) != 1) {
+		muditm_log("Couldn't get the listener from the old %s: %s",
+			muditm_proxy_name,strerror(errno)
+		);
+		return(-1);
+	}
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if( cmsg && (cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS) ) {
+		memcpy(&s,CMSG_DATA(cmsg),sizeof(int));
+	}
+	return(s);
+}
+
+/* Remembers how this process was started, for the next upgrade, and looks
+ * for a listening socket left for it by an older muditm or by systemd.
+ * Returns the socket, or -1 to make a new one. */
+int upgrade_listener(char **argv) {
+
+	char *env;
+	int s;
+
+	upgrade_argv = argv;
+
+	if( (env = getenv(UPGRADE_ENV)) ) {
+		upgrade_fd = atoi(env);
+		unsetenv(UPGRADE_ENV);
+		fcntl(upgrade_fd,F_SETFD,FD_CLOEXEC);
+		if( ((s = upgrade_receive(upgrade_fd)) != -1) && upgrade_is_listener(s) ) {
+			muditm_log("Took over the listener from the old %s.",muditm_proxy_name);
+			return(s);
+		}
+		muditm_log("The old %s didn't send a listener.",muditm_proxy_name);
+		close(upgrade_fd);
+		upgrade_fd = -1;
+		return(-1);
+	}
+
+	/* systemd socket activation.  Only the first socket is used. */
+	if( (env = getenv("LISTEN_PID")) && (atoi(env) == getpid()) &&
+		(env = getenv("LISTEN_FDS")) && (atoi(env) >= 1)
+	) {
+		unsetenv("LISTEN_PID");
+		unsetenv("LISTEN_FDS");
+		unsetenv("LISTEN_FDNAMES");
+		s = SD_LISTEN_FDS_START;
+		fcntl(s,F_SETFD,FD_CLOEXEC);
+		if(upgrade_is_listener(s)) {
+			muditm_log("Listening on the socket from systemd.");
+			return(s);
+		}
+		muditm_log("The socket from systemd isn't listening.");
+	}
+	return(-1);
+}
+
+/* sd_notify(), without needing libsystemd.  Nothing happens unless systemd
+ * gave us a NOTIFY_SOCKET. */
+void upgrade_notify(char *state) {
+
+	struct sockaddr_un addr;
+	socklen_t addrlen;
+	char *path;
+	int s;
+
+	if( !(path = getenv("NOTIFY_SOCKET")) || !path[0] || (strlen(path) >= sizeof(addr.sun_path)) ) {
+		return;
+	}
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path,path,strlen(path));
+	/* a leading @ is an abstract socket. */
+	if(addr.sun_path[0] == '@') {
+		addr.sun_path[0] = 0;
+	}
+	addrlen = offsetof(struct sockaddr_un,sun_path) + strlen(path);
+
+	if((s = socket(AF_UNIX,SOCK_DGRAM|SOCK_CLOEXEC,0)) == -1) {
+		muditm_log("Couldn't make the systemd notify socket: %s",strerror(errno));
+		return;
+	}
+	if(sendto(s,state,strlen(state),MSG_NOSIGNAL,(struct sockaddr *)&addr,addrlen) == -1) {
+		muditm_log("Couldn't tell systemd %s: %s",state,strerror(errno));
+	}
+	close(s);
+}
+
+/* SIGUSR2.  The accept loop starts the upgrade once poll() gets
+ * interrupted. */
+void upgrade_sigusr2(int s) {
+	upgrade_pending = 1;
+}
+
+/* tell the old muditm that this one is accepting now, with our pid for
+ * systemd, or tell systemd if we're the first. */
+void upgrade_ready(void) {
+
+	char ready[1+sizeof(pid_t)];
+	pid_t pid = getpid();
+
+	if(upgrade_fd == -1) {
+		upgrade_notify("READY=1");
+		return;
+	}
+	ready[0] = UPGRADE_READY;
+	memcpy(ready+1,&pid,sizeof(pid_t));
+	if(write(upgrade_fd,ready,sizeof(ready)) != sizeof(ready)) {
+		muditm_log("Couldn't tell the old %s we're ready: %s",muditm_proxy_name,strerror(errno));
+	}
+	close(upgrade_fd);
+	upgrade_fd = -1;
+}
+
+/* Starts the new muditm and hands it mother_sock.  Returns 1 once it says
+ * it is accepting, and this one should stop, or 0 if it didn't come up. */
+int upgrade_start(int mother_sock) {
+
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	struct pollfd pfd;
+	char control[CMSG_SPACE(sizeof(int))];
+	char byte = 0, fdstr[16], ready[1+sizeof(pid_t)], state[32];
+	sigset_t chld, old;
+	time_t deadline;
+	pid_t pid;
+	ssize_t n = 0;
+	int sv[2], ret;
+
+	if(!upgrade_argv) {
+		return(0);
+	}
+	if(socketpair(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0,sv) == -1) {
+		muditm_log("Upgrade socketpair failed: %s",strerror(errno));
+		return(0);
+	}
+
+	muditm_log("Starting a new %s to take over.",upgrade_argv[0]);
+
+	/* The new one is forked twice, so it isn't our child, and the sessions
+	 * are all that's left for us to wait on.  The zombie_killer mustn't
+	 * take the one in the middle. */
+	sigemptyset(&chld);
+	sigaddset(&chld,SIGCHLD);
+	sigprocmask(SIG_BLOCK,&chld,&old);
+	if((pid = fork()) == 0) {
+		if(fork() == 0) {
+			sigprocmask(SIG_SETMASK,&old,NULL);
+			signal(SIGHUP,SIG_DFL);
+			signal(SIGUSR2,SIG_DFL);
+			fcntl(mother_sock,F_SETFD,FD_CLOEXEC);
+			fcntl(sv[1],F_SETFD,0);
+			snprintf(fdstr,sizeof(fdstr),"%d",sv[1]);
+			setenv(UPGRADE_ENV,fdstr,1);
+			execvp(upgrade_argv[0],upgrade_argv);
+			muditm_log("Couldn't run %s: %s",upgrade_argv[0],strerror(errno));
+		}
+		_exit(0);
+	}
+	if(pid > 0) {
+		waitpid(pid,NULL,0);
+	}
+	sigprocmask(SIG_SETMASK,&old,NULL);
+	close(sv[1]);
+	if(pid == -1) {
+		muditm_log("Upgrade fork failed: %s",strerror(errno));
+		close(sv[0]);
+		return(0);
+	}
+
+	/* hand over the listener. */
+	memset(&msg,0,sizeof(msg));
+	memset(control,0,sizeof(control));
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg),&mother_sock,sizeof(int));
+	if(sendmsg(sv[0],&msg,MSG_NOSIGNAL) != 1) {
+		muditm_log("Couldn't hand the listener over: %s",strerror(errno));
+		close(sv[0]);
+		return(0);
+	}
+
+	/* and wait to hear that it's up.  Sessions ending will interrupt the
+	 * poll now and then. */
+	deadline = time(NULL) + UPGRADE_TIMEOUT;
+	pfd.fd = sv[0];
+	pfd.events = POLLIN;
+	byte = 0;
+	while(time(NULL) < deadline) {
+		ret = poll(&pfd,1,(deadline - time(NULL)) * 1000);
+		if( (ret == -1) && (errno == EINTR) ) {
+			continue;
+		}
+		if(ret == 1) {
+			/* an older build sends just the byte, without its pid. */
+			if((n = read(sv[0],ready,sizeof(ready))) >= 1) {
+				byte = ready[0];
+			}
+		}
+		break;
+	}
+	close(sv[0]);
+
+	if(byte != UPGRADE_READY) {
+		muditm_log("The new %s didn't come up, so this one carries on.",muditm_proxy_name);
+		return(0);
+	}
+	muditm_log("The new %s is accepting connections.",muditm_proxy_name);
+	/* it's the main process now, as far as systemd is concerned. */
+	if(n == sizeof(ready)) {
+		memcpy(&pid,ready+1,sizeof(pid_t));
+		snprintf(state,sizeof(state),"MAINPID=%d",(int)pid);
+		upgrade_notify(state);
+	}
+	return(1);
+}
@@ -0,0 +1,45 @@
+/* upgrade.h - handing the listener to a new muditm, or taking it from systemd */
+/* Created: Mon Oct 19 20:58:40 PM EDT 2026 malakai */
+/* $Id: upgrade.h,v 1.1 2026/10/20 00:58:40 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUDITM_UPGRADE_H
+#define MUDITM_UPGRADE_H
+
+#include <signal.h>
+
+/* global #defines */
+#define UPGRADE_ENV "MUDITM_UPGRADE_FD"
+#define UPGRADE_TIMEOUT 10	/* seconds the new muditm gets to start accepting */
+#define UPGRADE_READY 'R'
+#define SD_LISTEN_FDS_START 3	/* where systemd puts the first socket */
+
+/* structs and typedefs */
+
+/* exported global variable declarations */
+extern volatile sig_atomic_t upgrade_pending;
+
+/* exported function declarations */
+int upgrade_listener(char **argv);
+void upgrade_sigusr2(int s);
+void upgrade_ready(void);
+int upgrade_start(int mother_sock);
+
+#endif /* MUDITM_UPGRADE_H */
@@ -0,0 +1,238 @@
+/* zbench.c - compression backend benchmark */
+/* Created: Mon Oct 19 11:45:02 AM EDT 2026 malakai */
+/* $Id: zbench.c,v 1.1 2026/10/19 15:45:02 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Runs a MUD output corpus through every compression backend that got built
+ * in, the same way write_endpoint_compressed() and read_endpoint_compressed()
+ * do: deflate a chunk at a time with a sync flush, then inflate it all back
+ * and check it.  Feed it a file of recorded game output, or it will make up
+ * some combat spam and room descriptions of its own.
+ *
+ * 	zbench [-l level] [-c chunksize] [-n passes] [corpusfile]
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "zcodec.h"
+
+/* ---- local #defines ---- */
+#define ZBENCH_SYNTH_SIZE (4<<20)
+
+/* ---- structs and typedefs ---- */
+
+/* ---- local variable declarations ---- */
+
+/* ---- local function declarations ---- */
+
+/* ---- code starts here ---- */
+
+double zbench_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return(ts.tv_sec + ts.tv_nsec / 1000000000.0);
+}
+
+/* read the whole corpus file into memory. */
+char *zbench_load(char *filename, size_t *size) {
+	FILE *f;
+	char *buf;
+	long len;
+
+	if(!(f = fopen(filename,"r"))) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+	fseek(f,0,SEEK_END);
+	len = ftell(f);
+	fseek(f,0,SEEK_SET);
+	buf = (char *)malloc(len);
+	if(fread(buf,1,len,f) != len) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+	fclose(f);
+	*size = len;
+	return(buf);
+}
+
+/* make up something that looks enough like a MUD. */
+char *zbench_synth(size_t *size) {
+	char *mobs[] = { "the orc", "a large rat", "the cityguard", "Malakai", "a hungry ghoul" };
+	char *hits[] = { "hits", "misses", "MASSACRES", "scratches", "DEVASTATES" };
+	char *buf, *s, *eos;
+	int i = 0;
+
+	buf = (char *)malloc(ZBENCH_SYNTH_SIZE + 1024);
+	s = buf;
+	eos = buf + ZBENCH_SYNTH_SIZE;
+	srandom(1);
+
+	while(s < eos) {
+		switch(random() % 8) {
+			case 0:
+				s += sprintf(s,"\033[1;36mThe Temple Square\033[0m\r\n"
+					"   You are standing in the temple square.  Huge marble steps lead up\r\n"
+					"to the temple gate.  The entrance to the Clerics Guild is to the west,\r\n"
+					"and the old Grunting Boar Inn is to the east.\r\n"
+					"\033[0;32m[Exits: north east south west up]\033[0m\r\n");
+				break;
+			case 1:
+				s += sprintf(s,"\r\n<%dhp %dm %dmv> %c%c",
+					(int)(random() % 500), (int)(random() % 300), (int)(random() % 200),
+					(char)0xff, (char)0xf9
+				);
+				break;
+			default:
+				s += sprintf(s,"\033[1;31m%s %s you.\033[0m  You hit %s for %d damage! (%d)\r\n",
+					mobs[random() % 5], hits[random() % 5], mobs[random() % 5],
+					(int)(random() % 100), i++
+				);
+				break;
+		}
+	}
+	*size = s - buf;
+	return(buf);
+}
+
+/* one backend, one level.  prints a line of results. */
+void zbench_run(Zcodec *codec, char *corpus, size_t size, int level, size_t chunk, int passes) {
+
+	Zstream *zs;
+	unsigned char *zbuf, *pbuf;
+	size_t zsize, zmax, off, n;
+	double start, dtime, itime;
+	int pass, ret;
+
+	zmax = size + (size / 8) + 65536;
+	zbuf = (unsigned char *)malloc(zmax);
+	pbuf = (unsigned char *)malloc(size);
+	dtime = 0;
+	itime = 0;
+	zsize = 0;
+
+	for(pass = 0; pass < passes; pass++) {
+
+		zs = new_zstream(codec);
+		if( (ret = init_deflate_zstream(zs,level,MAX_WBITS,8,Z_DEFAULT_STRATEGY)) != Z_OK ) {
+			fprintf(stderr,"%s deflate init failed %d\n",codec->name,ret);
+			exit(EXIT_FAILURE);
+		}
+		zs->next_out = zbuf;
+		zs->avail_out = zmax;
+		start = zbench_now();
+		for(off = 0; off < size; off += n) {
+			n = MIN(chunk,size - off);
+			zs->next_in = (unsigned char *)corpus + off;
+			zs->avail_in = n;
+			deflate_zstream(zs,Z_SYNC_FLUSH);
+		}
+		dtime += zbench_now() - start;
+		zsize = zs->next_out - zbuf;
+		end_deflate_zstream(zs);
+		free_zstream(zs);
+
+		zs = new_zstream(codec);
+		init_inflate_zstream(zs);
+		zs->next_out = pbuf;
+		zs->avail_out = size;
+		start = zbench_now();
+		for(off = 0; off < zsize; off += n) {
+			n = MIN(chunk / 4,zsize - off);
+			zs->next_in = zbuf + off;
+			zs->avail_in = n;
+			if( ((ret = inflate_zstream(zs,Z_SYNC_FLUSH)) != Z_OK) && (ret != Z_BUF_ERROR) ) {
+				fprintf(stderr,"%s inflate failed %d\n",codec->name,ret);
+				exit(EXIT_FAILURE);
+			}
+		}
+		itime += zbench_now() - start;
+		if( (zs->next_out - pbuf != size) || memcmp(pbuf,corpus,size) ) {
+			fprintf(stderr,"%s round trip doesn't match!\n",codec->name);
+			exit(EXIT_FAILURE);
+		}
+		end_inflate_zstream(zs);
+		free_zstream(zs);
+	}
+
+	printf("%s\t%d\t%zu\t%zu\t%zu\t%0.2f%%\t%0.1f\t%0.1f\n",
+		codec->name, level, chunk, size, zsize,
+		100.0 * (1.0 - (double)zsize / size),
+		(double)size * passes / dtime / (1<<20),
+		(double)size * passes / itime / (1<<20)
+	);
+
+	free(zbuf);
+	free(pbuf);
+}
+
+int main(int argc, char **argv) {
+
+	char *corpus;
+	size_t size;
+	size_t chunk = 512;
+	int level = -1;
+	int passes = 3;
+	int opt, i, l;
+
+	while( (opt = getopt(argc,argv,"l:c:n:h")) != -1) {
+		switch(opt) {
+			case 'l':
+				level = atoi(optarg);
+				break;
+			case 'c':
+				chunk = MAX(16,atoi(optarg));
+				break;
+			case 'n':
+				passes = MAX(1,atoi(optarg));
+				break;
+			case 'h':
+			default:
+				fprintf(stdout,"Usage: %s [-l level] [-c chunksize] [-n passes] [corpusfile]\n",argv[0]);
+				exit(EXIT_SUCCESS);
+		}
+	}
+
+	if(optind < argc) {
+		corpus = zbench_load(argv[optind],&size);
+	} else {
+		corpus = zbench_synth(&size);
+	}
+
+	printf("backend\tlevel\tchunk\tin\tout\tsaved\tdeflate_MB/s\tinflate_MB/s\n");
+	for(i=0; zcodec_all[i]; i++) {
+		if(level >= 0) {
+			zbench_run(zcodec_all[i],corpus,size,level,chunk,passes);
+		} else {
+			for(l = 1; l <= 9; l += 2) {
+				zbench_run(zcodec_all[i],corpus,size,l,chunk,passes);
+			}
+		}
+	}
+
+	free(corpus);
+	return(0);
+}
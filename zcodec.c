@@ -0,0 +1,502 @@
+/* zcodec.c - pluggable zlib compatible compression backends */
+/* Created: Mon Oct 19 11:45:02 AM EDT 2026 malakai */
+/* $Id: zcodec.c,v 1.1 2026/10/19 15:45:02 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+
+#include "zcodec.h"
+
+/* ---- local #defines ---- */
+
+/* ---- structs and typedefs ---- */
+
+/* each arena block starts with one of these.  The union keeps what comes
+ * after it aligned for anything. */
+struct zarena_block {
+	union {
+		struct {
+			size_t size;
+			struct zarena_block *next;
+		} h;
+		max_align_t align;
+	} u;
+};
+
+/* ---- local variable declarations ---- */
+
+/* ---- local function declarations ---- */
+int zlib_deflate_init(Zstream *zs, int level, int window, int memlevel, int strategy);
+int zlib_deflate(Zstream *zs, int flush);
+int zlib_deflate_params(Zstream *zs, int level, int strategy);
+int zlib_deflate_reset(Zstream *zs);
+int zlib_deflate_end(Zstream *zs);
+int zlib_inflate_init(Zstream *zs);
+int zlib_inflate(Zstream *zs, int flush);
+int zlib_inflate_reset(Zstream *zs);
+int zlib_inflate_end(Zstream *zs);
+Zstream *zpool_take(Zcodec *codec, int mode, int window, int memlevel);
+int zpool_park(Zstream *zs);
+int zpool_evict(void);
+void zarena_trim(void);
+
+/* ---- code starts here ---- */
+
+Zcodec zcodec_zlib = {
+	"zlib",
+	zlib_deflate_init,
+	zlib_deflate,
+	zlib_deflate_params,
+	zlib_deflate_reset,
+	zlib_deflate_end,
+	zlib_inflate_init,
+	zlib_inflate,
+	zlib_inflate_reset,
+	zlib_inflate_end
+};
+
+/* every backend that got built in.  The first one is the default. */
+Zcodec *zcodec_all[] = {
+	&zcodec_zlib,
+#ifdef HAVE_ZLIB_NG
+	&zcodec_zlibng,
+#endif
+	NULL
+};
+
+Zcodec *zcodec_default = &zcodec_zlib;
+
+/* one per process, which with one process per session means one per
+ * session. */
+struct zarena_data zarena = { 0, 0, 0, 0, 0, 0, 0, NULL, 2, 0, 0, NULL };
+
+/* look up a backend by name, NULL if it wasn't built in. */
+Zcodec *zcodec_find(char *name) {
+	int i;
+	for(i=0; zcodec_all[i]; i++) {
+		if(!strcasecmp(name,zcodec_all[i]->name)) {
+			return(zcodec_all[i]);
+		}
+	}
+	return(NULL);
+}
+
+/* set how many idle streams to keep, and how much memory the backends may
+ * have between them. */
+void zcodec_configure(int pool_max, size_t limit) {
+	zarena.pool_max = pool_max<0?0:pool_max;
+	zarena.limit = limit;
+	while(zarena.pool_len > zarena.pool_max) {
+		zpool_evict();
+	}
+	zarena_trim();
+}
+
+int zcodec_printstats(char *buf, size_t len) {
+	return(snprintf(buf,len,
+		"zstream memory peak %zuk, %ld mallocs, %ld reused, %ld refused, %ld pooled streams reused",
+		zarena.peak/1024, zarena.mallocs, zarena.reuses, zarena.refused,
+		zarena.pool_reuses
+	));
+}
+
+/* ---- the arena the backends allocate from ---- */
+
+/* zalloc. zlib asks for the same handful of sizes every time, so an exact
+ * size match from the free list is good enough. */
+void *zarena_alloc(void *opaque, unsigned int items, unsigned int size) {
+
+	struct zarena_block *b, **bp;
+	size_t want;
+
+	want = (size_t)items * size;
+
+	for(bp = &(zarena.free); *bp; bp = &((*bp)->u.h.next)) {
+		if((*bp)->u.h.size == want) {
+			b = *bp;
+			*bp = b->u.h.next;
+			zarena.cached -= want;
+			zarena.inuse += want;
+			zarena.reuses++;
+			return(b+1);
+		}
+	}
+
+	/* nothing to reuse.  Make room if there's a limit. */
+	if(zarena.limit) {
+		if(zarena.inuse + zarena.cached + want > zarena.limit) {
+			zarena_trim();
+		}
+		while( (zarena.inuse + want > zarena.limit) && zpool_evict() ) {
+			zarena_trim();
+		}
+		if(zarena.inuse + want > zarena.limit) {
+			zarena.refused++;
+			return(NULL);
+		}
+	}
+
+	if( !(b = (struct zarena_block *)malloc(sizeof(struct zarena_block) + want)) ) {
+		zarena.refused++;
+		return(NULL);
+	}
+	b->u.h.size = want;
+	b->u.h.next = NULL;
+	zarena.mallocs++;
+	zarena.inuse += want;
+	if(zarena.inuse + zarena.cached > zarena.peak) {
+		zarena.peak = zarena.inuse + zarena.cached;
+	}
+	return(b+1);
+}
+
+/* zfree.  Keep the block for the next stream. */
+void zarena_free(void *opaque, void *ptr) {
+
+	struct zarena_block *b;
+
+	if(!ptr) return;
+	b = ((struct zarena_block *)ptr) - 1;
+	zarena.inuse -= b->u.h.size;
+	zarena.cached += b->u.h.size;
+	b->u.h.next = zarena.free;
+	zarena.free = b;
+}
+
+/* give the cached blocks back to malloc. */
+void zarena_trim(void) {
+
+	struct zarena_block *b;
+
+	while( (b = zarena.free) ) {
+		zarena.free = b->u.h.next;
+		zarena.cached -= b->u.h.size;
+		free(b);
+	}
+}
+
+/* ---- the pool of idle streams ---- */
+
+/* find an idle stream that was set up the same way, and reset it. */
+Zstream *zpool_take(Zcodec *codec, int mode, int window, int memlevel) {
+
+	Zstream *p, **pp;
+
+	for(pp = &(zarena.pool); *pp; pp = &((*pp)->next)) {
+		p = *pp;
+		if( p->codec != codec || p->mode != mode ) continue;
+		if( mode == ZSTREAM_DEFLATE &&
+			(p->window != window || p->memlevel != memlevel)
+		) {
+			continue;
+		}
+		*pp = p->next;
+		p->next = NULL;
+		zarena.pool_len--;
+		return(p);
+	}
+	return(NULL);
+}
+
+/* put a finished stream in the pool, if there's room.  0 if there wasn't. */
+int zpool_park(Zstream *zs) {
+
+	Zstream *p;
+
+	if(zarena.pool_len >= zarena.pool_max) {
+		return(0);
+	}
+	p = new_zstream(zs->codec);
+	p->impl = zs->impl;
+	p->mode = zs->mode;
+	p->window = zs->window;
+	p->memlevel = zs->memlevel;
+	p->next = zarena.pool;
+	zarena.pool = p;
+	zarena.pool_len++;
+
+	zs->impl = NULL;
+	zs->mode = ZSTREAM_IDLE;
+	return(1);
+}
+
+/* really end the oldest idle stream.  0 if the pool was empty. */
+int zpool_evict(void) {
+
+	Zstream *p, **pp;
+
+	if(!zarena.pool) return(0);
+
+	for(pp = &(zarena.pool); (*pp)->next; pp = &((*pp)->next));
+	p = *pp;
+	*pp = NULL;
+	zarena.pool_len--;
+
+	if(p->mode == ZSTREAM_DEFLATE) {
+		p->codec->deflate_end(p);
+	} else {
+		p->codec->inflate_end(p);
+	}
+	free_zstream(p);
+	return(1);
+}
+
+/* ---- the generic stream calls ---- */
+
+/* init a new stream for the given backend. */
+Zstream *new_zstream(Zcodec *codec) {
+
+	Zstream *zs;
+
+	zs = (Zstream *)malloc(sizeof(Zstream));
+	memset(zs,0,sizeof(Zstream));
+	zs->data_type = Z_ASCII;
+	zs->codec = codec?codec:zcodec_default;
+	zs->impl = NULL;
+	zs->mode = ZSTREAM_IDLE;
+	zs->next = NULL;
+
+	return(zs);
+}
+
+/* free a stream.  If nobody ended it first, end it here so the backend's
+ * state doesn't leak. */
+void free_zstream(Zstream *zs) {
+	if(!zs) return;
+	if(zs->impl) {
+		if(zs->mode == ZSTREAM_DEFLATE) {
+			zs->codec->deflate_end(zs);
+		} else if(zs->mode == ZSTREAM_INFLATE) {
+			zs->codec->inflate_end(zs);
+		} else {
+			free(zs->impl);
+		}
+	}
+	free(zs);
+}
+
+/* set up for deflate, reusing an idle stream from the pool if there's one
+ * with the same window and memlevel. */
+int init_deflate_zstream(Zstream *zs, int level, int window, int memlevel, int strategy) {
+
+	Zstream *p;
+	int ret;
+
+	zs->mode = ZSTREAM_DEFLATE;
+	zs->window = window;
+	zs->memlevel = memlevel;
+
+	if( (p = zpool_take(zs->codec,ZSTREAM_DEFLATE,window,memlevel)) ) {
+		zs->impl = p->impl;
+		p->impl = NULL;
+		free_zstream(p);
+		if( (ret = zs->codec->deflate_reset(zs)) == Z_OK &&
+			(ret = zs->codec->deflate_params(zs,level,strategy)) == Z_OK
+		) {
+			zarena.pool_reuses++;
+			return(ret);
+		}
+		/* that didn't go well.  start over from scratch. */
+		zs->codec->deflate_end(zs);
+	}
+
+	return(zs->codec->deflate_init(zs,level,window,memlevel,strategy));
+}
+
+int deflate_zstream(Zstream *zs, int flush) {
+	return(zs->codec->deflate(zs,flush));
+}
+
+int params_zstream(Zstream *zs, int level, int strategy) {
+	return(zs->codec->deflate_params(zs,level,strategy));
+}
+
+/* done deflating.  The backend's state goes to the pool if there's room. */
+int end_deflate_zstream(Zstream *zs) {
+	if(!zs->impl) return(Z_STREAM_ERROR);
+	if(zpool_park(zs)) return(Z_OK);
+	zs->mode = ZSTREAM_IDLE;
+	return(zs->codec->deflate_end(zs));
+}
+
+int init_inflate_zstream(Zstream *zs) {
+
+	Zstream *p;
+
+	zs->mode = ZSTREAM_INFLATE;
+	zs->window = MAX_WBITS;
+	zs->memlevel = 0;
+
+	if( (p = zpool_take(zs->codec,ZSTREAM_INFLATE,0,0)) ) {
+		zs->impl = p->impl;
+		p->impl = NULL;
+		free_zstream(p);
+		if(zs->codec->inflate_reset(zs) == Z_OK) {
+			zarena.pool_reuses++;
+			return(Z_OK);
+		}
+		zs->codec->inflate_end(zs);
+	}
+
+	return(zs->codec->inflate_init(zs));
+}
+
+int inflate_zstream(Zstream *zs, int flush) {
+	return(zs->codec->inflate(zs,flush));
+}
+
+int end_inflate_zstream(Zstream *zs) {
+	if(!zs->impl) return(Z_STREAM_ERROR);
+	if(zpool_park(zs)) return(Z_OK);
+	zs->mode = ZSTREAM_IDLE;
+	return(zs->codec->inflate_end(zs));
+}
+
+/* ---- the plain old zlib backend ---- */
+
+void zlib_copyin(Zstream *zs, z_stream *z) {
+	z->next_in = zs->next_in;
+	z->avail_in = zs->avail_in;
+	z->total_in = zs->total_in;
+	z->next_out = zs->next_out;
+	z->avail_out = zs->avail_out;
+	z->total_out = zs->total_out;
+}
+
+void zlib_copyout(Zstream *zs, z_stream *z) {
+	zs->next_in = z->next_in;
+	zs->avail_in = z->avail_in;
+	zs->total_in = z->total_in;
+	zs->next_out = z->next_out;
+	zs->avail_out = z->avail_out;
+	zs->total_out = z->total_out;
+	zs->msg = z->msg;
+	zs->data_type = z->data_type;
+	zs->adler = z->adler;
+}
+
+z_stream *zlib_new(Zstream *zs) {
+	z_stream *z;
+
+	z = (z_stream *)malloc(sizeof(z_stream));
+	memset(z,0,sizeof(z_stream));
+	z->data_type = zs->data_type;
+	z->zalloc = zarena_alloc;
+	z->zfree = zarena_free;
+	z->opaque = &zarena;
+	zlib_copyin(zs,z);
+	zs->impl = z;
+	return(z);
+}
+
+int zlib_deflate_init(Zstream *zs, int level, int window, int memlevel, int strategy) {
+	z_stream *z = zlib_new(zs);
+	int ret;
+
+	ret = deflateInit2(z,level,Z_DEFLATED,window,memlevel,strategy);
+	zlib_copyout(zs,z);
+	return(ret);
+}
+
+int zlib_deflate(Zstream *zs, int flush) {
+	z_stream *z = zs->impl;
+	int ret;
+
+	zlib_copyin(zs,z);
+	ret = deflate(z,flush);
+	zlib_copyout(zs,z);
+	return(ret);
+}
+
+int zlib_deflate_params(Zstream *zs, int level, int strategy) {
+	z_stream *z = zs->impl;
+	int ret;
+
+	zlib_copyin(zs,z);
+	ret = deflateParams(z,level,strategy);
+	zlib_copyout(zs,z);
+	return(ret);
+}
+
+int zlib_deflate_reset(Zstream *zs) {
+	z_stream *z = zs->impl;
+	int ret;
+
+	zlib_copyin(zs,z);
+	ret = deflateReset(z);
+	zlib_copyout(zs,z);
+	return(ret);
+}
+
+int zlib_deflate_end(Zstream *zs) {
+	z_stream *z = zs->impl;
+	int ret;
+
+	if(!z) return(Z_STREAM_ERROR);
+	ret = deflateEnd(z);
+	free(z);
+	zs->impl = NULL;
+	return(ret);
+}
+
+int zlib_inflate_init(Zstream *zs) {
+	z_stream *z = zlib_new(zs);
+	int ret;
+
+	ret = inflateInit(z);
+	zlib_copyout(zs,z);
+	return(ret);
+}
+
+int zlib_inflate(Zstream *zs, int flush) {
+	z_stream *z = zs->impl;
+	int ret;
+
+	zlib_copyin(zs,z);
+	ret = inflate(z,flush);
+	zlib_copyout(zs,z);
+	return(ret);
+}
+
+int zlib_inflate_reset(Zstream *zs) {
+	z_stream *z = zs->impl;
+	int ret;
+
+	zlib_copyin(zs,z);
+	ret = inflateReset(z);
+	zlib_copyout(zs,z);
+	return(ret);
+}
+
+int zlib_inflate_end(Zstream *zs) {
+	z_stream *z = zs->impl;
+	int ret;
+
+	if(!z) return(Z_STREAM_ERROR);
+	ret = inflateEnd(z);
+	free(z);
+	zs->impl = NULL;
+	return(ret);
+}
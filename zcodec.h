@@ -0,0 +1,122 @@
+/* zcodec.h - pluggable zlib compatible compression backends */
+/* Created: Mon Oct 19 11:45:02 AM EDT 2026 malakai */
+/* $Id: zcodec.h,v 1.1 2026/10/19 15:45:02 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUDITM_ZCODEC_H
+#define MUDITM_ZCODEC_H
+
+/* This header doesn't include zlib.h on purpose.  zlib-ng's native header
+ * refuses to be included alongside it, so each backend gets its own .c file
+ * and they all meet here.  The Z_ flush and return codes are the same
+ * numbers in every zlib compatible library. */
+
+/* global #defines */
+#define ZSTREAM_IDLE 0
+#define ZSTREAM_DEFLATE 1
+#define ZSTREAM_INFLATE 2
+
+/* structs and typedefs */
+
+/* The buffer pointers and counters, same names and meanings as z_stream.
+ * The backend copies them in and out of its own stream around each call. */
+struct zstream_data {
+	unsigned char *next_in;
+	unsigned int avail_in;
+	unsigned long total_in;
+
+	unsigned char *next_out;
+	unsigned int avail_out;
+	unsigned long total_out;
+
+	char *msg;
+	int data_type;
+	unsigned long adler;
+
+	struct zcodec_data *codec;
+	void *impl;		/* the backend's own stream */
+
+	int mode;		/* ZSTREAM_IDLE, _DEFLATE or _INFLATE */
+	int window;		/* what impl was set up with, for reuse */
+	int memlevel;
+	struct zstream_data *next;	/* in the pool */
+};
+
+typedef struct zstream_data Zstream;
+
+struct zcodec_data {
+	char *name;
+	int (*deflate_init)(Zstream *zs, int level, int window, int memlevel, int strategy);
+	int (*deflate)(Zstream *zs, int flush);
+	int (*deflate_params)(Zstream *zs, int level, int strategy);
+	int (*deflate_reset)(Zstream *zs);
+	int (*deflate_end)(Zstream *zs);
+	int (*inflate_init)(Zstream *zs);
+	int (*inflate)(Zstream *zs, int flush);
+	int (*inflate_reset)(Zstream *zs);
+	int (*inflate_end)(Zstream *zs);
+};
+
+typedef struct zcodec_data Zcodec;
+
+/* Where the backends' internal state comes from.  Freed blocks are kept
+ * around for the next stream that wants the same size. */
+struct zarena_data {
+	size_t limit;		/* 0 for no limit */
+	size_t inuse;
+	size_t cached;		/* freed, waiting to be reused */
+	size_t peak;
+	long int mallocs;
+	long int reuses;
+	long int refused;
+	struct zarena_block *free;
+
+	int pool_max;		/* idle streams kept for reuse */
+	int pool_len;
+	long int pool_reuses;
+	Zstream *pool;
+};
+
+/* exported global variable declarations */
+extern Zcodec *zcodec_default;
+extern Zcodec *zcodec_all[];
+extern Zcodec zcodec_zlib;
+extern struct zarena_data zarena;
+#ifdef HAVE_ZLIB_NG
+extern Zcodec zcodec_zlibng;
+#endif
+
+/* exported function declarations */
+Zcodec *zcodec_find(char *name);
+void zcodec_configure(int pool_max, size_t limit);
+int zcodec_printstats(char *buf, size_t len);
+void *zarena_alloc(void *opaque, unsigned int items, unsigned int size);
+void zarena_free(void *opaque, void *ptr);
+Zstream *new_zstream(Zcodec *codec);
+void free_zstream(Zstream *zs);
+int init_deflate_zstream(Zstream *zs, int level, int window, int memlevel, int strategy);
+int deflate_zstream(Zstream *zs, int flush);
+int params_zstream(Zstream *zs, int level, int strategy);
+int end_deflate_zstream(Zstream *zs);
+int init_inflate_zstream(Zstream *zs);
+int inflate_zstream(Zstream *zs, int flush);
+int end_inflate_zstream(Zstream *zs);
+
+#endif /* MUDITM_ZCODEC_H */
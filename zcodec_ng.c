@@ -0,0 +1,193 @@
+/* zcodec_ng.c - zlib-ng native compression backend */
+/* Created: Mon Oct 19 11:45:02 AM EDT 2026 malakai */
+/* $Id: zcodec_ng.c,v 1.1 2026/10/19 15:45:02 malakai Exp $ */
+
+/* Copyright © 2026 Jeff Jahr <malakai@jeffrika.com>
+ *
+ * This file is part of MUDitM - MUD in the Middle
+ *
+ * MUDitM is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * MUDitM is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MUDitM.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Only built in with 'make ZLIBNG=1', which needs the zlib-ng development
+ * package for the native (not the zlib-compat) API.  zlib-ng's SIMD deflate
+ * and inflate are a good deal faster than stock zlib, and the streams it
+ * makes are plain zlib format, so MCCP clients can't tell the difference. */
+
+#ifdef HAVE_ZLIB_NG
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib-ng.h>
+
+#include "zcodec.h"
+
+/* ---- local #defines ---- */
+
+/* ---- structs and typedefs ---- */
+
+/* ---- local variable declarations ---- */
+
+/* ---- local function declarations ---- */
+int zng_be_deflate_init(Zstream *zs, int level, int window, int memlevel, int strategy);
+int zng_be_deflate(Zstream *zs, int flush);
+int zng_be_deflate_params(Zstream *zs, int level, int strategy);
+int zng_be_deflate_reset(Zstream *zs);
+int zng_be_deflate_end(Zstream *zs);
+int zng_be_inflate_init(Zstream *zs);
+int zng_be_inflate(Zstream *zs, int flush);
+int zng_be_inflate_reset(Zstream *zs);
+int zng_be_inflate_end(Zstream *zs);
+
+/* ---- code starts here ---- */
+
+Zcodec zcodec_zlibng = {
+	"zlib-ng",
+	zng_be_deflate_init,
+	zng_be_deflate,
+	zng_be_deflate_params,
+	zng_be_deflate_reset,
+	zng_be_deflate_end,
+	zng_be_inflate_init,
+	zng_be_inflate,
+	zng_be_inflate_reset,
+	zng_be_inflate_end
+};
+
+void zng_be_copyin(Zstream *zs, zng_stream *z) {
+	z->next_in = zs->next_in;
+	z->avail_in = zs->avail_in;
+	z->total_in = zs->total_in;
+	z->next_out = zs->next_out;
+	z->avail_out = zs->avail_out;
+	z->total_out = zs->total_out;
+}
+
+void zng_be_copyout(Zstream *zs, zng_stream *z) {
+	zs->next_in = (unsigned char *)z->next_in;
+	zs->avail_in = z->avail_in;
+	zs->total_in = z->total_in;
+	zs->next_out = z->next_out;
+	zs->avail_out = z->avail_out;
+	zs->total_out = z->total_out;
+	zs->msg = (char *)z->msg;
+	zs->data_type = z->data_type;
+	zs->adler = z->adler;
+}
+
+zng_stream *zng_be_new(Zstream *zs) {
+	zng_stream *z;
+
+	z = (zng_stream *)malloc(sizeof(zng_stream));
+	memset(z,0,sizeof(zng_stream));
+	z->data_type = zs->data_type;
+	z->zalloc = zarena_alloc;
+	z->zfree = zarena_free;
+	z->opaque = &zarena;
+	zng_be_copyin(zs,z);
+	zs->impl = z;
+	return(z);
+}
+
+int zng_be_deflate_init(Zstream *zs, int level, int window, int memlevel, int strategy) {
+	zng_stream *z = zng_be_new(zs);
+	int ret;
+
+	ret = zng_deflateInit2(z,level,Z_DEFLATED,window,memlevel,strategy);
+	zng_be_copyout(zs,z);
+	return(ret);
+}
+
+int zng_be_deflate(Zstream *zs, int flush) {
+	zng_stream *z = zs->impl;
+	int ret;
+
+	zng_be_copyin(zs,z);
+	ret = zng_deflate(z,flush);
+	zng_be_copyout(zs,z);
+	return(ret);
+}
+
+int zng_be_deflate_params(Zstream *zs, int level, int strategy) {
+	zng_stream *z = zs->impl;
+	int ret;
+
+	zng_be_copyin(zs,z);
+	ret = zng_deflateParams(z,level,strategy);
+	zng_be_copyout(zs,z);
+	return(ret);
+}
+
+int zng_be_deflate_reset(Zstream *zs) {
+	zng_stream *z = zs->impl;
+	int ret;
+
+	zng_be_copyin(zs,z);
+	ret = zng_deflateReset(z);
+	zng_be_copyout(zs,z);
+	return(ret);
+}
+
+int zng_be_deflate_end(Zstream *zs) {
+	zng_stream *z = zs->impl;
+	int ret;
+
+	if(!z) return(Z_STREAM_ERROR);
+	ret = zng_deflateEnd(z);
+	free(z);
+	zs->impl = NULL;
+	return(ret);
+}
+
+int zng_be_inflate_init(Zstream *zs) {
+	zng_stream *z = zng_be_new(zs);
+	int ret;
+
+	ret = zng_inflateInit(z);
+	zng_be_copyout(zs,z);
+	return(ret);
+}
+
+int zng_be_inflate(Zstream *zs, int flush) {
+	zng_stream *z = zs->impl;
+	int ret;
+
+	zng_be_copyin(zs,z);
+	ret = zng_inflate(z,flush);
+	zng_be_copyout(zs,z);
+	return(ret);
+}
+
+int zng_be_inflate_reset(Zstream *zs) {
+	zng_stream *z = zs->impl;
+	int ret;
+
+	zng_be_copyin(zs,z);
+	ret = zng_inflateReset(z);
+	zng_be_copyout(zs,z);
+	return(ret);
+}
+
+int zng_be_inflate_end(Zstream *zs) {
+	zng_stream *z = zs->impl;
+	int ret;
+
+	if(!z) return(Z_STREAM_ERROR);
+	ret = zng_inflateEnd(z);
+	free(z);
+	zs->impl = NULL;
+	return(ret);
+}
+
+#endif /* HAVE_ZLIB_NG */